@@ -29,4 +29,29 @@ CC src/*.c
 CC src/common/*.c
 
 # Link files
-RUNONATE $LINKER $LNFLAGS -o gr8emu $OBJECTS
+RUNONATE $LINKER $LNFLAGS -pthread -o gr8emu $OBJECTS
+
+# The batch runner shares the machine, but not the frontend.
+SHARED=""
+for i in src/machine.c src/loader.c src/asm.c src/input_stream.c src/devices.c src/dev_timer.c src/dev_disk.c src/dev_video.c src/dev_uart.c src/dev_perf.c src/dev_mmu.c src/dev_intc.c src/serial.c src/disk.c src/snapshot.c src/json_utils.c src/escape_utils.c src/coverage.c src/engine.c src/common/*.c; do
+	SHARED="$SHARED build/$i.o"
+done
+OBJECTS=""
+CCFLAGS="$CCFLAGS -pthread"
+CC src/batch/*.c
+RUNONATE $LINKER $LNFLAGS -pthread -o gr8emu-batch $OBJECTS $SHARED
+
+# So does the coverage tool.
+OBJECTS=""
+CC src/covtool/*.c
+RUNONATE $LINKER $LNFLAGS -o gr8emu-cov $OBJECTS $SHARED
+
+# And the fuzzer.
+OBJECTS=""
+CC src/fuzz/*.c
+RUNONATE $LINKER $LNFLAGS -pthread -o gr8emu-fuzz $OBJECTS $SHARED
+
+# And the multi-core system.
+OBJECTS=""
+CC src/smp/*.c
+RUNONATE $LINKER $LNFLAGS -pthread -o gr8emu-smp $OBJECTS $SHARED
@@ -0,0 +1,787 @@
+
+#include "asm.h"
+#include "snapshot.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+char asm_error[256];
+
+// Operands, by how they're written.
+#define OP_NONE  0
+#define OP_A     1
+#define OP_X     2
+#define OP_Y     3
+#define OP_SPL   4
+#define OP_SPH   5
+#define OP_F     6
+#define OP_IMM   7  // value, a byte.
+#define OP_ADDR  8  // value, a word.
+#define OP_ABS   9  // [addr]
+#define OP_ABSX  10 // [addr+X]
+#define OP_ABSY  11 // [addr+Y]
+#define OP_IND   12 // (ptr)
+#define OP_INDX  13 // (ptr)+X
+#define OP_INDY  14 // (ptr+Y)
+#define OP_INDYX 15 // (ptr+Y)+X
+#define OP_INDPX 16 // (ptr+X)
+
+// An opcode and the operands it takes.
+typedef struct asm_insn {
+	char    name[5];
+	uint8_t dst;
+	uint8_t src;
+	uint8_t opcode;
+} asm_insn_t;
+
+// Every instruction of the default instruction set, sorted by name.
+static const asm_insn_t insns[] = {
+	{ "ADD",  OP_A,     OP_X,     0x32 },
+	{ "ADD",  OP_A,     OP_Y,     0x33 },
+	{ "ADD",  OP_A,     OP_IMM,   0x38 },
+	{ "ADD",  OP_A,     OP_ABS,   0x39 },
+	{ "ADD",  OP_X,     OP_IMM,   0x5c },
+	{ "ADD",  OP_X,     OP_ABS,   0x5d },
+	{ "ADD",  OP_Y,     OP_IMM,   0x64 },
+	{ "ADD",  OP_Y,     OP_ABS,   0x65 },
+	{ "ADDC", OP_A,     OP_IMM,   0x44 },
+	{ "ADDC", OP_A,     OP_ABS,   0x45 },
+	{ "AND",  OP_A,     OP_IMM,   0x52 },
+	{ "AND",  OP_A,     OP_ABS,   0x53 },
+	{ "BCC",  OP_ADDR,  OP_NONE,  0x16 },
+	{ "BCS",  OP_ADDR,  OP_NONE,  0x15 },
+	{ "BEQ",  OP_ADDR,  OP_NONE,  0x0f },
+	{ "BGE",  OP_ADDR,  OP_NONE,  0x14 },
+	{ "BGT",  OP_ADDR,  OP_NONE,  0x11 },
+	{ "BLE",  OP_ADDR,  OP_NONE,  0x12 },
+	{ "BLT",  OP_ADDR,  OP_NONE,  0x13 },
+	{ "BNE",  OP_ADDR,  OP_NONE,  0x10 },
+	{ "BRK",  OP_NONE,  OP_NONE,  0x00 },
+	{ "CALL", OP_ADDR,  OP_NONE,  0x02 },
+	{ "CALL", OP_IND,   OP_NONE,  0x6c },
+	{ "CALL", OP_INDPX, OP_NONE,  0x76 },
+	{ "CMP",  OP_A,     OP_X,     0x36 },
+	{ "CMP",  OP_A,     OP_Y,     0x37 },
+	{ "CMP",  OP_A,     OP_IMM,   0x3c },
+	{ "CMP",  OP_A,     OP_ABS,   0x3d },
+	{ "CMP",  OP_X,     OP_IMM,   0x60 },
+	{ "CMP",  OP_X,     OP_ABS,   0x61 },
+	{ "CMP",  OP_Y,     OP_IMM,   0x68 },
+	{ "CMP",  OP_Y,     OP_ABS,   0x69 },
+	{ "CMPC", OP_A,     OP_IMM,   0x48 },
+	{ "CMPC", OP_A,     OP_ABS,   0x49 },
+	{ "DEC",  OP_A,     OP_NONE,  0x40 },
+	{ "DEC",  OP_ABS,   OP_NONE,  0x41 },
+	{ "DEC",  OP_X,     OP_NONE,  0x63 },
+	{ "DEC",  OP_Y,     OP_NONE,  0x6b },
+	{ "DECC", OP_A,     OP_NONE,  0x4c },
+	{ "DECC", OP_ABS,   OP_NONE,  0x4d },
+	{ "DI",   OP_NONE,  OP_NONE,  0x7a },
+	{ "EI",   OP_NONE,  OP_NONE,  0x79 },
+	{ "GPTR", OP_ADDR,  OP_NONE,  0x7b },
+	{ "GPTR", OP_ABS,   OP_NONE,  0x7b },
+	{ "HLT",  OP_NONE,  OP_NONE,  0x7f },
+	{ "INC",  OP_A,     OP_NONE,  0x3e },
+	{ "INC",  OP_ABS,   OP_NONE,  0x3f },
+	{ "INC",  OP_X,     OP_NONE,  0x62 },
+	{ "INC",  OP_Y,     OP_NONE,  0x6a },
+	{ "INCC", OP_A,     OP_NONE,  0x4a },
+	{ "INCC", OP_ABS,   OP_NONE,  0x4b },
+	{ "INT",  OP_NONE,  OP_NONE,  0x01 },
+	{ "JMP",  OP_ADDR,  OP_NONE,  0x0e },
+	{ "JMP",  OP_IND,   OP_NONE,  0x6d },
+	{ "JMP",  OP_INDPX, OP_NONE,  0x75 },
+	{ "MOV",  OP_A,     OP_X,     0x17 },
+	{ "MOV",  OP_A,     OP_Y,     0x18 },
+	{ "MOV",  OP_X,     OP_A,     0x19 },
+	{ "MOV",  OP_X,     OP_Y,     0x1a },
+	{ "MOV",  OP_Y,     OP_A,     0x1b },
+	{ "MOV",  OP_Y,     OP_X,     0x1c },
+	{ "MOV",  OP_A,     OP_IMM,   0x1d },
+	{ "MOV",  OP_X,     OP_IMM,   0x1e },
+	{ "MOV",  OP_Y,     OP_IMM,   0x1f },
+	{ "MOV",  OP_A,     OP_ABS,   0x20 },
+	{ "MOV",  OP_X,     OP_ABS,   0x21 },
+	{ "MOV",  OP_Y,     OP_ABS,   0x22 },
+	{ "MOV",  OP_A,     OP_ABSX,  0x23 },
+	{ "MOV",  OP_A,     OP_ABSY,  0x24 },
+	{ "MOV",  OP_A,     OP_IND,   0x25 },
+	{ "MOV",  OP_A,     OP_INDYX, 0x26 },
+	{ "MOV",  OP_A,     OP_INDX,  0x27 },
+	{ "MOV",  OP_A,     OP_INDY,  0x28 },
+	{ "MOV",  OP_ABS,   OP_A,     0x29 },
+	{ "MOV",  OP_ABS,   OP_X,     0x2a },
+	{ "MOV",  OP_ABS,   OP_Y,     0x2b },
+	{ "MOV",  OP_ABSX,  OP_A,     0x2c },
+	{ "MOV",  OP_ABSY,  OP_A,     0x2d },
+	{ "MOV",  OP_IND,   OP_A,     0x2e },
+	{ "MOV",  OP_INDYX, OP_A,     0x2f },
+	{ "MOV",  OP_INDX,  OP_A,     0x30 },
+	{ "MOV",  OP_INDY,  OP_A,     0x31 },
+	{ "MOV",  OP_A,     OP_SPL,   0x6e },
+	{ "MOV",  OP_A,     OP_SPH,   0x6f },
+	{ "MOV",  OP_SPL,   OP_A,     0x70 },
+	{ "MOV",  OP_SPH,   OP_A,     0x71 },
+	{ "MOV",  OP_F,     OP_A,     0x72 },
+	{ "MOV",  OP_A,     OP_F,     0x73 },
+	{ "OR",   OP_A,     OP_IMM,   0x54 },
+	{ "OR",   OP_A,     OP_ABS,   0x55 },
+	{ "PULL", OP_NONE,  OP_NONE,  0x0c },
+	{ "PULL", OP_A,     OP_NONE,  0x09 },
+	{ "PULL", OP_X,     OP_NONE,  0x0a },
+	{ "PULL", OP_Y,     OP_NONE,  0x0b },
+	{ "PULL", OP_ABS,   OP_NONE,  0x0d },
+	{ "PUSH", OP_A,     OP_NONE,  0x04 },
+	{ "PUSH", OP_X,     OP_NONE,  0x05 },
+	{ "PUSH", OP_Y,     OP_NONE,  0x06 },
+	{ "PUSH", OP_IMM,   OP_NONE,  0x07 },
+	{ "PUSH", OP_ABS,   OP_NONE,  0x08 },
+	{ "RET",  OP_NONE,  OP_NONE,  0x03 },
+	{ "ROL",  OP_A,     OP_NONE,  0x5a },
+	{ "ROL",  OP_ABS,   OP_NONE,  0x50 },
+	{ "ROR",  OP_A,     OP_NONE,  0x5b },
+	{ "ROR",  OP_ABS,   OP_NONE,  0x51 },
+	{ "RTI",  OP_NONE,  OP_NONE,  0x74 },
+	{ "SHL",  OP_A,     OP_NONE,  0x58 },
+	{ "SHL",  OP_ABS,   OP_NONE,  0x42 },
+	{ "SHLC", OP_ABS,   OP_NONE,  0x4e },
+	{ "SHR",  OP_A,     OP_NONE,  0x59 },
+	{ "SHR",  OP_ABS,   OP_NONE,  0x43 },
+	{ "SHRC", OP_ABS,   OP_NONE,  0x4f },
+	{ "SIRQ", OP_ADDR,  OP_NONE,  0x7c },
+	{ "SNMI", OP_ADDR,  OP_NONE,  0x7d },
+	{ "SUB",  OP_A,     OP_X,     0x34 },
+	{ "SUB",  OP_A,     OP_Y,     0x35 },
+	{ "SUB",  OP_A,     OP_IMM,   0x3a },
+	{ "SUB",  OP_A,     OP_ABS,   0x3b },
+	{ "SUB",  OP_X,     OP_IMM,   0x5e },
+	{ "SUB",  OP_X,     OP_ABS,   0x5f },
+	{ "SUB",  OP_Y,     OP_IMM,   0x66 },
+	{ "SUB",  OP_Y,     OP_ABS,   0x67 },
+	{ "SUBC", OP_A,     OP_IMM,   0x46 },
+	{ "SUBC", OP_A,     OP_ABS,   0x47 },
+	{ "VST",  OP_IMM,   OP_NONE,  0x7e },
+	{ "XOR",  OP_A,     OP_IMM,   0x56 },
+	{ "XOR",  OP_A,     OP_ABS,   0x57 },
+};
+#define N_INSNS (sizeof(insns) / sizeof(asm_insn_t))
+
+// A symbol while assembling.
+typedef struct asm_sym {
+	char     name[ASM_NAME_LEN];
+	int32_t  value;
+	bool     label;
+} asm_sym_t;
+
+// A value to fill in once every symbol is known.
+typedef struct asm_fixup {
+	const char *expr;
+	const char *end;
+	size_t      pos;                    // In the output.
+	uint16_t    pc;                     // Value of $.
+	int         scope;
+	int         line;
+	uint8_t     size;
+} asm_fixup_t;
+
+typedef struct asm_ctx {
+	const char  *name;
+	int          line;
+	uint16_t     origin;
+	uint32_t     pc;
+	uint8_t     *out;
+	size_t       max;
+	size_t       len;
+	int          scope;                 // Global label before the current line, -1 if none.
+	char         missing[ASM_NAME_LEN]; // First undefined symbol of the last value.
+	// ==== SYMBOLS ====
+	asm_sym_t   *syms;
+	size_t       syms_len;
+	size_t       syms_cap;
+	uint16_t     index[ASM_MAX_SYMBOLS * 2]; // By hash of name, 1 more than the symbol.
+	// ==== FIXUPS ====
+	asm_fixup_t *fixups;
+	size_t       fixups_len;
+	size_t       fixups_cap;
+} asm_ctx_t;
+
+// Sets asm_error to a message about the current line.
+static bool fail(asm_ctx_t *as, const char *fmt, ...) {
+	int n = snprintf(asm_error, sizeof(asm_error), "%s:%d: ", as->name, as->line);
+	if (n >= (int) sizeof(asm_error)) return false;
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(asm_error + n, sizeof(asm_error) - n, fmt, args);
+	va_end(args);
+	return false;
+}
+
+static const char *skip_ws(const char *p, const char *end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+	return p;
+}
+
+static const char *trim_end(const char *p, const char *end) {
+	while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) end--;
+	return end;
+}
+
+static bool is_ident(char c) {
+	return isalnum((uint8_t) c) || c == '_' || c == '.';
+}
+
+// Compares a range to a word, ignoring case.
+static bool word_is(const char *p, const char *end, const char *word) {
+	size_t len = strlen(word);
+	return (size_t) (end - p) == len && !strncasecmp(p, word, len);
+}
+
+static uint16_t name_hash(const char *name) {
+	uint64_t hash = hash_bytes(0xcbf29ce484222325, name, strlen(name));
+	return hash & (ASM_MAX_SYMBOLS * 2 - 1);
+}
+
+// Works out the full name of a symbol, with the label it's local to.
+static bool full_name(asm_ctx_t *as, const char *p, const char *end, int scope, char *buf) {
+	size_t len = end - p;
+	size_t prefix = 0;
+	if (*p == '.' && scope >= 0) {
+		prefix = strlen(as->syms[scope].name);
+	}
+	if (prefix + len >= ASM_NAME_LEN) return fail(as, "%.*s is too long a name", (int) len, p);
+	if (prefix) memcpy(buf, as->syms[scope].name, prefix);
+	memcpy(buf + prefix, p, len);
+	buf[prefix + len] = 0;
+	return true;
+}
+
+// Finds a symbol, or returns -1.
+static int find_sym(asm_ctx_t *as, const char *name) {
+	for (uint16_t i = name_hash(name);; i = (i + 1) & (ASM_MAX_SYMBOLS * 2 - 1)) {
+		if (!as->index[i]) return -1;
+		if (!strcmp(as->syms[as->index[i] - 1].name, name)) return as->index[i] - 1;
+	}
+}
+
+// Defines a symbol, labels starting with . are local to the label before them.
+static bool define(asm_ctx_t *as, const char *p, const char *end, int32_t value, bool label) {
+	char name[ASM_NAME_LEN];
+	if (*p == '.' && as->scope < 0) return fail(as, "local label %.*s isn't after a label", (int) (end - p), p);
+	if (!full_name(as, p, end, as->scope, name)) return false;
+	if (find_sym(as, name) >= 0) return fail(as, "%s is already defined", name);
+	if (as->syms_len == ASM_MAX_SYMBOLS) return fail(as, "more than %d symbols", ASM_MAX_SYMBOLS);
+	if (as->syms_len == as->syms_cap) {
+		as->syms_cap = as->syms_cap ? as->syms_cap * 2 : 64;
+		as->syms     = realloc(as->syms, as->syms_cap * sizeof(asm_sym_t));
+	}
+	asm_sym_t *sym = &as->syms[as->syms_len];
+	strcpy(sym->name, name);
+	sym->value = value;
+	sym->label = label;
+	uint16_t i = name_hash(name);
+	while (as->index[i]) i = (i + 1) & (ASM_MAX_SYMBOLS * 2 - 1);
+	as->index[i] = ++ as->syms_len;
+	if (label && *p != '.') as->scope = as->syms_len - 1;
+	return true;
+}
+
+// Reads a character of a string or character literal.
+static const char *read_char(const char *p, const char *end, int *c) {
+	if (*p != '\\' || p + 1 >= end) {
+		*c = (uint8_t) *p;
+		return p + 1;
+	}
+	switch (p[1]) {
+		case 'n':  *c = '\n'; break;
+		case 't':  *c = '\t'; break;
+		case 'r':  *c = '\r'; break;
+		case '0':  *c = 0;    break;
+		default:   *c = (uint8_t) p[1];
+	}
+	return p + 2;
+}
+
+// Reads a number in a base, returns NULL if there are no digits.
+static const char *read_number(const char *p, const char *end, int base, int32_t *value) {
+	const char *start = p;
+	int64_t num = 0;
+	for (; p < end; p++) {
+		int digit = isdigit((uint8_t) *p) ? *p - '0' : isxdigit((uint8_t) *p) ? (*p | 0x20) - 'a' + 10 : 99;
+		if (digit >= base) break;
+		num = num * base + digit;
+		if (num > 0xffffff) return NULL;
+	}
+	*value = num;
+	return p > start ? p : NULL;
+}
+
+// Works out a value, known is cleared if it uses a symbol that isn't defined yet.
+static bool eval(asm_ctx_t *as, const char *p, const char *end, int scope, uint16_t pc, int32_t *value, bool *known) {
+	p   = skip_ws(p, end);
+	end = trim_end(p, end);
+	*known = true;
+	if (p == end) return fail(as, "expected a value");
+	if (*p == '<' || *p == '>') {
+		if (!eval(as, p + 1, end, scope, pc, value, known)) return false;
+		*value = *p == '<' ? *value & 0xff : (*value >> 8) & 0xff;
+		return true;
+	}
+	*value = 0;
+	int sign = 1;
+	if (*p == '-') {
+		sign = -1;
+		p = skip_ws(p + 1, end);
+	}
+	while (true) {
+		int32_t term;
+		const char *next;
+		if (p == end) return fail(as, "expected a value");
+		if (*p == '$' && (p + 1 == end || !isxdigit((uint8_t) p[1]))) {
+			term = pc;
+			next = p + 1;
+		} else if (*p == '$') {
+			next = read_number(p + 1, end, 16, &term);
+		} else if (*p == '0' && p + 1 < end && (p[1] | 0x20) == 'x') {
+			next = read_number(p + 2, end, 16, &term);
+		} else if (*p == '%') {
+			next = read_number(p + 1, end, 2, &term);
+		} else if (isdigit((uint8_t) *p)) {
+			next = read_number(p, end, 10, &term);
+		} else if (*p == '\'' && p + 2 < end) {
+			int c;
+			next = read_char(p + 1, end, &c);
+			term = c;
+			if (next >= end || *next != '\'') return fail(as, "unterminated character");
+			next ++;
+		} else if (is_ident(*p)) {
+			for (next = p; next < end && is_ident(*next); next++);
+			char name[ASM_NAME_LEN];
+			if (!full_name(as, p, next, scope, name)) return false;
+			int sym = find_sym(as, name);
+			if (sym < 0) {
+				if (*known) strcpy(as->missing, name);
+				*known = false;
+				term = 0;
+			} else {
+				term = as->syms[sym].value;
+			}
+		} else {
+			return fail(as, "unexpected '%c'", *p);
+		}
+		if (!next) return fail(as, "bad number");
+		*value += sign * term;
+		p = skip_ws(next, end);
+		if (p == end) return true;
+		if (*p != '+' && *p != '-') return fail(as, "unexpected '%c'", *p);
+		sign = *p == '+' ? 1 : -1;
+		p = skip_ws(p + 1, end);
+	}
+}
+
+// Writes a byte at the current address.
+static bool put(asm_ctx_t *as, uint8_t value) {
+	size_t pos = as->pc - as->origin;
+	if (as->pc > 0xffff || pos >= as->max) return fail(as, "program doesn't fit below %04zx", as->origin + as->max);
+	if (pos > as->len) memset(as->out + as->len, 0, pos - as->len);
+	as->out[pos] = value;
+	if (pos >= as->len) as->len = pos + 1;
+	as->pc ++;
+	return true;
+}
+
+// Checks a value fits in a byte or a word.
+static bool check_size(asm_ctx_t *as, int32_t value, uint8_t size) {
+	if (size == 1 && (value < -128 || value > 0xff)) return fail(as, "%d doesn't fit in a byte", value);
+	if (size == 2 && (value < -32768 || value > 0xffff)) return fail(as, "%d doesn't fit in a word", value);
+	return true;
+}
+
+// Writes a value of a byte or a word, or leaves room for it if it isn't known yet.
+static bool put_value(asm_ctx_t *as, const char *p, const char *end, uint8_t size, uint16_t pc) {
+	int32_t value;
+	bool known;
+	if (!eval(as, p, end, as->scope, pc, &value, &known)) return false;
+	if (!known) {
+		if (as->fixups_len == as->fixups_cap) {
+			as->fixups_cap = as->fixups_cap ? as->fixups_cap * 2 : 64;
+			as->fixups     = realloc(as->fixups, as->fixups_cap * sizeof(asm_fixup_t));
+		}
+		as->fixups[as->fixups_len ++] = (asm_fixup_t) { p, end, as->pc - as->origin, pc, as->scope, as->line, size };
+	} else if (!check_size(as, value, size)) {
+		return false;
+	}
+	if (!put(as, value)) return false;
+	return size == 1 || put(as, value >> 8);
+}
+
+// Splits operands at commas outside of strings, returns how many there are.
+static int split(const char *p, const char *end, const char **ops, const char **ends, int max) {
+	int n = 0;
+	p = skip_ws(p, end);
+	if (p == end) return 0;
+	char quote = 0;
+	ops[0] = p;
+	for (; p < end; p++) {
+		if (quote) {
+			if (*p == '\\') p++;
+			else if (*p == quote) quote = 0;
+		} else if (*p == '"' || *p == '\'') {
+			quote = *p;
+		} else if (*p == ',') {
+			if (n + 1 == max) return max + 1;
+			ends[n] = trim_end(ops[n], p);
+			ops[++ n] = skip_ws(p + 1, end);
+		}
+	}
+	ends[n] = trim_end(ops[n], end);
+	return n + 1;
+}
+
+// Removes a trailing +X or +Y, returns which one or 0.
+static char strip_index(const char *p, const char **end) {
+	const char *e = trim_end(p, *end);
+	if (e - p < 3 || ((e[-1] | 0x20) != 'x' && (e[-1] | 0x20) != 'y')) return 0;
+	const char *plus = trim_end(p, e - 1);
+	if (plus == p || plus[-1] != '+') return 0;
+	*end = plus - 1;
+	return e[-1] | 0x20;
+}
+
+// Works out how an operand is written, and where its value is.
+static bool classify(asm_ctx_t *as, const char *p, const char *end, int *kind, const char **ep, const char **ee) {
+	*ep = p;
+	*ee = end;
+	if (word_is(p, end, "A"))        *kind = OP_A;
+	else if (word_is(p, end, "X"))   *kind = OP_X;
+	else if (word_is(p, end, "Y"))   *kind = OP_Y;
+	else if (word_is(p, end, "SPL")) *kind = OP_SPL;
+	else if (word_is(p, end, "SPH")) *kind = OP_SPH;
+	else if (word_is(p, end, "F"))   *kind = OP_F;
+	else if (*p == '[') {
+		if (end[-1] != ']') return fail(as, "expected ]");
+		*ep = p + 1;
+		*ee = end - 1;
+		char index = strip_index(*ep, ee);
+		*kind = index == 'x' ? OP_ABSX : index == 'y' ? OP_ABSY : OP_ABS;
+	} else if (*p == '(') {
+		const char *close = memchr(p, ')', end - p);
+		if (!close) return fail(as, "expected )");
+		const char *after = skip_ws(close + 1, end);
+		const char *after_end = after;
+		char post = 0;
+		if (after < end) {
+			if (*after != '+') return fail(as, "unexpected '%c'", *after);
+			after_end = end;
+			post = strip_index(close, &after_end);
+			if (post != 'x') return fail(as, "only X can be added after a pointer");
+		}
+		*ep = p + 1;
+		*ee = close;
+		char pre = strip_index(*ep, ee);
+		if (!pre && !post)                  *kind = OP_IND;
+		else if (!pre)                      *kind = OP_INDX;
+		else if (pre == 'y' && !post)       *kind = OP_INDY;
+		else if (pre == 'y')                *kind = OP_INDYX;
+		else if (pre == 'x' && !post)       *kind = OP_INDPX;
+		else return fail(as, "can't add X both before and after a pointer");
+	} else {
+		*kind = OP_IMM;
+	}
+	return true;
+}
+
+// Assembles an instruction.
+static bool instruction(asm_ctx_t *as, const char *mnem, const char *mend, const char *p, const char *end) {
+	// Find the instructions by that name.
+	char name[8];
+	size_t len = mend - mnem;
+	if (len >= sizeof(name)) return fail(as, "no such instruction %.*s", (int) len, mnem);
+	for (size_t i = 0; i < len; i++) name[i] = toupper((uint8_t) mnem[i]);
+	name[len] = 0;
+	size_t lo = 0, hi = N_INSNS;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (strcmp(insns[mid].name, name) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == N_INSNS || strcmp(insns[lo].name, name)) return fail(as, "no such instruction %s", name);
+	// Then the one with those operands.
+	const char *ops[2], *ends[2];
+	int n = split(p, end, ops, ends, 2);
+	if (n > 2) return fail(as, "too many operands");
+	int kinds[2] = { OP_NONE, OP_NONE };
+	const char *eps[2], *ees[2];
+	for (int i = 0; i < n; i++) {
+		if (!classify(as, ops[i], ends[i], &kinds[i], &eps[i], &ees[i])) return false;
+	}
+	for (size_t i = lo; i < N_INSNS && !strcmp(insns[i].name, name); i++) {
+		const asm_insn_t *insn = &insns[i];
+		bool dst = insn->dst == kinds[0] || (insn->dst == OP_ADDR && kinds[0] == OP_IMM);
+		bool src = insn->src == kinds[1] || (insn->src == OP_ADDR && kinds[1] == OP_IMM);
+		if (!dst || !src) continue;
+		uint16_t pc = as->pc;
+		if (!put(as, insn->opcode)) return false;
+		for (int j = 0; j < n; j++) {
+			int kind = j ? insn->src : insn->dst;
+			if (kind >= OP_IMM && !put_value(as, eps[j], ees[j], kind == OP_IMM ? 1 : 2, pc)) return false;
+		}
+		return true;
+	}
+	return fail(as, "%s doesn't take those operands", name);
+}
+
+// Assembles a directive, returns false with asm_error unset if it isn't one.
+static bool directive(asm_ctx_t *as, const char *word, const char *wend, const char *p, const char *end, bool *handled) {
+	if (*word == '.') word ++;
+	*handled = true;
+	uint16_t pc = as->pc;
+	if (word_is(word, wend, "org") || word_is(word, wend, "ds")) {
+		int32_t value;
+		bool known;
+		if (!eval(as, p, end, as->scope, pc, &value, &known)) return false;
+		if (!known) return fail(as, "%s must be defined before it's used here", as->missing);
+		if (word_is(word, wend, "ds")) {
+			if (value < 0 || value > 0xffff) return fail(as, "bad size %d", value);
+			value += as->pc;
+		}
+		if (value < as->origin || value > 0x10000) return fail(as, "%04x is outside of the program", value);
+		// Zero up to the new address, or go back to write over what's there.
+		while (as->pc < (uint32_t) value) {
+			if (!put(as, 0)) return false;
+		}
+		as->pc = value;
+		return true;
+	}
+	if (word_is(word, wend, "db") || word_is(word, wend, "dw")) {
+		uint8_t size = (word[1] | 0x20) == 'w' ? 2 : 1;
+		while (p < end) {
+			p = skip_ws(p, end);
+			if (*p == '"' && size == 1) {
+				// A string.
+				for (p++; p < end && *p != '"';) {
+					int c;
+					p = read_char(p, end, &c);
+					if (!put(as, c)) return false;
+				}
+				if (p >= end) return fail(as, "unterminated string");
+				p = skip_ws(p + 1, end);
+				if (p < end && *p != ',') return fail(as, "expected ,");
+				p ++;
+			} else {
+				const char *ops[1], *ends[1];
+				const char *comma = p;
+				char quote = 0;
+				for (; comma < end && (quote || *comma != ','); comma++) {
+					if (quote && *comma == '\\') comma++;
+					else if (*comma == '\'') quote = !quote;
+				}
+				if (split(p, comma, ops, ends, 1) != 1) return fail(as, "expected a value");
+				if (!put_value(as, ops[0], ends[0], size, pc)) return false;
+				p = comma + 1;
+			}
+		}
+		return true;
+	}
+	*handled = false;
+	return true;
+}
+
+// Assembles a line.
+static bool line(asm_ctx_t *as, const char *p, const char *end) {
+	// Cut off the comment.
+	char quote = 0;
+	for (const char *c = p; c < end; c++) {
+		if (quote) {
+			if (*c == '\\') c++;
+			else if (*c == quote) quote = 0;
+		} else if (*c == '"' || *c == '\'') {
+			quote = *c;
+		} else if (*c == ';' || (*c == '/' && c + 1 < end && c[1] == '/')) {
+			end = c;
+			break;
+		}
+	}
+	p   = skip_ws(p, end);
+	end = trim_end(p, end);
+	if (p == end) return true;
+	// A label, a symbol or an instruction.
+	const char *word = p;
+	while (p < end && is_ident(*p)) p++;
+	const char *wend = p;
+	if (word == wend) return fail(as, "unexpected '%c'", *p);
+	p = skip_ws(p, end);
+	if (p < end && *p == ':') {
+		if (!define(as, word, wend, as->pc, true)) return false;
+		p = skip_ws(p + 1, end);
+		if (p == end) return true;
+		word = p;
+		while (p < end && is_ident(*p)) p++;
+		wend = p;
+		if (word == wend) return fail(as, "unexpected '%c'", *p);
+		p = skip_ws(p, end);
+	}
+	const char *equ = p;
+	while (equ < end && is_ident(*equ)) equ++;
+	if ((p < end && *p == '=') || word_is(p, equ, "equ")) {
+		int32_t value;
+		bool known;
+		if (!eval(as, *p == '=' ? p + 1 : equ, end, as->scope, as->pc, &value, &known)) return false;
+		if (!known) return fail(as, "%s must be defined before it's used here", as->missing);
+		return define(as, word, wend, value, false);
+	}
+	bool handled;
+	if (!directive(as, word, wend, p, end, &handled)) return false;
+	return handled || instruction(as, word, wend, p, end);
+}
+
+// Assembles a source for code starting at origin into out, which has room for max bytes.
+// The labels are added to symbols, if not NULL.
+bool asm_assemble(const char *name, const char *src, size_t len, uint16_t origin,
+		uint8_t *out, size_t max, size_t *out_len, asm_symbols_t *symbols) {
+	asm_ctx_t *as = malloc(sizeof(asm_ctx_t));
+	if (!as) {
+		snprintf(asm_error, sizeof(asm_error), "%s: out of memory", name);
+		return false;
+	}
+	memset(as, 0, sizeof(asm_ctx_t));
+	as->name   = name;
+	as->origin = origin;
+	as->pc     = origin;
+	as->out    = out;
+	as->max    = max;
+	as->scope  = -1;
+	bool ok = true;
+	const char *end = src + len;
+	for (const char *p = src; ok && p < end;) {
+		const char *eol = memchr(p, '\n', end - p);
+		if (!eol) eol = end;
+		as->line ++;
+		ok = line(as, p, eol);
+		p = eol + 1;
+	}
+	// Fill in what was used before it was defined.
+	for (size_t i = 0; ok && i < as->fixups_len; i++) {
+		asm_fixup_t *fix = &as->fixups[i];
+		int32_t value;
+		bool known;
+		as->line = fix->line;
+		ok = eval(as, fix->expr, fix->end, fix->scope, fix->pc, &value, &known)
+			&& (known || fail(as, "%s is not defined", as->missing))
+			&& check_size(as, value, fix->size);
+		if (!ok) break;
+		out[fix->pos] = value;
+		if (fix->size == 2) out[fix->pos + 1] = value >> 8;
+	}
+	if (ok && !as->len) {
+		snprintf(asm_error, sizeof(asm_error), "%s: no code", name);
+		ok = false;
+	}
+	if (ok) {
+		*out_len = as->len;
+		for (size_t i = 0; symbols && i < as->syms_len; i++) {
+			if (as->syms[i].label) asm_symbols_add(symbols, as->syms[i].name, as->syms[i].value);
+		}
+	}
+	free(as->syms);
+	free(as->fixups);
+	free(as);
+	return ok;
+}
+
+static asm_result_t *cache[ASM_CACHE_SIZE];
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Assembles a source, or finds what it was the last time.
+// Results are shared and live as long as the process.
+const asm_result_t *asm_cached(const char *name, const char *src, size_t len, uint16_t origin) {
+	uint64_t hash = hash_bytes(0xcbf29ce484222325, src, len);
+	hash = hash_bytes(hash, &origin, sizeof(origin));
+	pthread_mutex_lock(&cache_lock);
+	asm_result_t **bucket = &cache[hash % ASM_CACHE_SIZE];
+	for (asm_result_t *res = *bucket; res; res = res->next) {
+		if (res->hash == hash && res->src_len == len && res->origin == origin) {
+			pthread_mutex_unlock(&cache_lock);
+			return res;
+		}
+	}
+	asm_result_t *res = calloc(1, sizeof(asm_result_t));
+	size_t max = 0x10000 - origin;
+	if (res) res->data = malloc(max);
+	if (!res || !res->data) {
+		free(res);
+		pthread_mutex_unlock(&cache_lock);
+		snprintf(asm_error, sizeof(asm_error), "%s: out of memory", name);
+		return NULL;
+	}
+	if (!asm_assemble(name, src, len, origin, res->data, max, &res->len, &res->symbols)) {
+		free(res->data);
+		asm_symbols_free(&res->symbols);
+		free(res);
+		pthread_mutex_unlock(&cache_lock);
+		return NULL;
+	}
+	res->data    = realloc(res->data, res->len);
+	res->hash    = hash;
+	res->src_len = len;
+	res->origin  = origin;
+	res->next    = *bucket;
+	*bucket      = res;
+	pthread_mutex_unlock(&cache_lock);
+	return res;
+}
+
+// Adds a label, keeping them sorted.
+void asm_symbols_add(asm_symbols_t *symbols, const char *name, uint16_t address) {
+	if (symbols->len == symbols->cap) {
+		symbols->cap    = symbols->cap ? symbols->cap * 2 : 64;
+		symbols->symbol = realloc(symbols->symbol, symbols->cap * sizeof(asm_symbol_t));
+	}
+	size_t i = symbols->len ++;
+	for (; i > 0 && symbols->symbol[i - 1].address > address; i--) {
+		symbols->symbol[i] = symbols->symbol[i - 1];
+	}
+	snprintf(symbols->symbol[i].name, ASM_NAME_LEN, "%s", name);
+	symbols->symbol[i].address = address;
+}
+
+// Describes an address as the label before it, like print+3.
+// Returns false if there's no label before it.
+bool asm_symbolize(const asm_symbols_t *symbols, uint16_t address, char *buf, size_t len) {
+	size_t lo = 0, hi = symbols->len;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (symbols->symbol[mid].address <= address) lo = mid + 1;
+		else hi = mid;
+	}
+	if (!lo) return false;
+	const asm_symbol_t *sym = &symbols->symbol[lo - 1];
+	if (sym->address == address) snprintf(buf, len, "%s", sym->name);
+	else snprintf(buf, len, "%s+%u", sym->name, address - sym->address);
+	return true;
+}
+
+// Finds the address of a label.
+bool asm_lookup(const asm_symbols_t *symbols, const char *name, uint16_t *address) {
+	for (size_t i = 0; i < symbols->len; i++) {
+		if (!strcmp(symbols->symbol[i].name, name)) {
+			*address = symbols->symbol[i].address;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Writes the labels, one per line.
+void asm_symbols_print(const asm_symbols_t *symbols, FILE *fd) {
+	for (size_t i = 0; i < symbols->len; i++) {
+		fprintf(fd, "%04x %s\n", symbols->symbol[i].address, symbols->symbol[i].name);
+	}
+}
+
+// Frees the labels.
+void asm_symbols_free(asm_symbols_t *symbols) {
+	free(symbols->symbol);
+	memset(symbols, 0, sizeof(asm_symbols_t));
+}
@@ -0,0 +1,104 @@
+
+#ifndef ASM_H
+#define ASM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Longest symbol name, local labels include their scope.
+#define ASM_NAME_LEN    32
+// Most symbols in one source.
+#define ASM_MAX_SYMBOLS 2048
+// Buckets of the cache of assembled sources.
+#define ASM_CACHE_SIZE  256
+
+/*
+
+Sources have one instruction per line, with optional labels:
+	entry:  VST $ff             ; comments start with ; or //
+	        GPTR [text]
+	        MOV [ptr], X
+	        MOV [ptr+1], Y
+	        CALL print
+	        HLT
+	print:  MOV A, (ptr)
+	        CMP A, 0
+	        BEQ .exit           ; .exit is local to print
+	        ...
+	.exit:  RET
+	text:   db "Hello, World!", 10, 0
+	ptr = $0100
+
+Operands are registers (A, X, Y, SPL, SPH, F), values (CMP A, 3), addresses
+(JMP print), memory ([addr], [addr+X], [addr+Y]) and pointers in memory ((ptr),
+(ptr)+X, (ptr+Y), (ptr+Y)+X, and (ptr+X) for JMP and CALL).
+
+Values are decimal, $hex, 0xhex, %binary, 'c', symbols and $ for the address of
+the instruction, added or subtracted; <value and >value take the low and high
+byte. Symbols may be used before they're defined, except in org and ds.
+
+	org addr    Carries on at addr, after zeroes up to it.
+	db x, ...   Bytes, or strings with \n, \t, \0, \\ and \" escapes.
+	dw x, ...   Words, low byte first.
+	ds n        n zero bytes.
+	name = x    Defines a symbol, also name equ x.
+
+The mnemonics are those of the default instruction set:
+	BRK INT CALL RET RTI JMP BEQ BNE BGT BLE BLT BGE BCS BCC PUSH PULL MOV
+	ADD ADDC SUB SUBC CMP CMPC INC INCC DEC DECC SHL SHLC SHR SHRC ROL ROR
+	AND OR XOR EI DI GPTR SIRQ SNMI VST HLT
+BGT and friends compare as unsigned after CMP. See asm.c for the operands each
+one takes.
+
+*/
+
+// Where a label is.
+typedef struct asm_symbol {
+	char     name[ASM_NAME_LEN];
+	uint16_t address;
+} asm_symbol_t;
+
+// Labels, by address.
+typedef struct asm_symbols {
+	asm_symbol_t *symbol;
+	size_t        len;
+	size_t        cap;
+} asm_symbols_t;
+
+// A source assembled before, see asm_cached.
+typedef struct asm_result {
+	uint64_t           hash;
+	size_t             src_len;
+	uint16_t           origin;
+	uint8_t           *data;
+	size_t             len;
+	asm_symbols_t      symbols;
+	struct asm_result *next;
+} asm_result_t;
+
+// What went wrong with the last source, with the file and line.
+extern char asm_error[256];
+
+// Assembles a source for code starting at origin into out, which has room for max bytes.
+// The labels are added to symbols, if not NULL.
+bool asm_assemble(const char *name, const char *src, size_t len, uint16_t origin,
+		uint8_t *out, size_t max, size_t *out_len, asm_symbols_t *symbols);
+// Assembles a source, or finds what it was the last time.
+// Results are shared and live as long as the process.
+const asm_result_t *asm_cached(const char *name, const char *src, size_t len, uint16_t origin);
+
+// Adds a label, keeping them sorted.
+void asm_symbols_add(asm_symbols_t *symbols, const char *name, uint16_t address);
+// Describes an address as the label before it, like print+3.
+// Returns false if there's no label before it.
+bool asm_symbolize(const asm_symbols_t *symbols, uint16_t address, char *buf, size_t len);
+// Finds the address of a label.
+bool asm_lookup(const asm_symbols_t *symbols, const char *name, uint16_t *address);
+// Writes the labels, one per line.
+void asm_symbols_print(const asm_symbols_t *symbols, FILE *fd);
+// Frees the labels.
+void asm_symbols_free(asm_symbols_t *symbols);
+
+#endif //ASM_H
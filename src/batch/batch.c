@@ -0,0 +1,543 @@
+
+#define _GNU_SOURCE
+#include "batch.h"
+#include "serve.h"
+#include "lockstep.h"
+#include "../machine.h"
+#include "../snapshot.h"
+#include "../json_utils.h"
+#include "../coverage.h"
+#include "../disk.h"
+#include "../asm.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char *reg_names[BATCH_REGS] = {
+	"pc", "a", "b", "x", "y", "sp"
+};
+
+static batch_job_t   *jobs;
+static size_t         jobs_len;
+static batch_file_t **files;
+static size_t         files_len;
+static char          *base_dir;
+
+static batch_queue_t *queues;
+static int            workers;
+static bool           pin;
+static bool           any_failed;
+static char          *coverage_file;
+static gr8cpurev3_cov_t **coverage;  // One per worker, merged at the end.
+static const engine_t *check_engine;
+static size_t         check_every = 1;
+
+// A job being run by a worker.
+typedef struct batch_run {
+	batch_job_t *job;
+	size_t       out_pos;   // Bytes of output that matched.
+	bool         mismatch;  // Set when the output stops matching.
+	lockstep_t  *lockstep;  // Set when checking an engine.
+} batch_run_t;
+
+// Maps a file for jobs to use, or finds it if it was mapped already.
+// Relative paths are relative to the manifest.
+batch_file_t *batch_open(char *path) {
+	char *full = path;
+	if (*path != '/') {
+		full = malloc(strlen(base_dir) + strlen(path) + 2);
+		if (!full) return NULL;
+		sprintf(full, "%s/%s", base_dir, path);
+	}
+	int fd = open(full, O_RDONLY);
+	if (full != path) free(full);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	// The same file by any path is only mapped once.
+	for (size_t i = 0; i < files_len; i++) {
+		if (files[i]->dev == st.st_dev && files[i]->ino == st.st_ino) {
+			close(fd);
+			return files[i];
+		}
+	}
+	batch_file_t *file = malloc(sizeof(batch_file_t));
+	batch_file_t **mem = realloc(files, (files_len + 1) * sizeof(batch_file_t *));
+	if (!file || !mem) {
+		free(file);
+		close(fd);
+		return NULL;
+	}
+	files = mem;
+	file->dev  = st.st_dev;
+	file->ino  = st.st_ino;
+	file->len  = st.st_size;
+	file->data = NULL;
+	if (file->len) {
+		file->data = mmap(NULL, file->len, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (file->data == MAP_FAILED) {
+		free(file);
+		return NULL;
+	}
+	files[files_len ++] = file;
+	return file;
+}
+
+// Assembles a source for jobs to run, or finds it if it was assembled already.
+batch_file_t *batch_assemble(batch_file_t *src, char *path) {
+	if (src->assembled) return src->assembled;
+	const asm_result_t *res = asm_cached(path, (const char *) src->data, src->len, 0);
+	if (!res) {
+		fprintf(stderr, "%s\n", asm_error);
+		return NULL;
+	}
+	batch_file_t *file = malloc(sizeof(batch_file_t));
+	if (!file) return NULL;
+	*file = *src;
+	file->data      = res->data;
+	file->len       = res->len;
+	file->assembled = NULL;
+	src->assembled  = file;
+	return file;
+}
+
+// Parses a hexadecimal number of at most max.
+static bool parse_hex(char *str, uint64_t max, uint64_t *out) {
+	char *end;
+	*out = strtoull(str, &end, 16);
+	return *str && !*end && *out <= max;
+}
+
+// Parses expected memory, as addr:hex.
+static bool parse_mem(char *str, batch_mem_t *out) {
+	char *colon = strchr(str, ':');
+	uint64_t address;
+	if (!colon) return false;
+	*colon = 0;
+	if (!parse_hex(str, 0xffff, &address)) return false;
+	size_t len = strlen(colon + 1);
+	if (!len || len % 2 || len / 2 > BATCH_MEM_LEN) return false;
+	out->address = address;
+	out->len     = len / 2;
+	for (size_t i = 0; i < out->len; i++) {
+		char hex[3] = { colon[1 + i * 2], colon[2 + i * 2], 0 };
+		uint64_t value;
+		if (!parse_hex(hex, 0xff, &value)) return false;
+		out->data[i] = value;
+	}
+	return true;
+}
+
+// Parses one line of the manifest into a job.
+// Returns the key that was wrong, or NULL.
+static char *parse_job(char *line, size_t line_no, batch_job_t *job) {
+	memset(job, 0, sizeof(batch_job_t));
+	job->cycles = BATCH_CYCLES;
+	for (int i = 0; i < BATCH_REGS; i++) job->regs[i] = -1;
+	char *save = NULL;
+	for (char *pair = strtok_r(line, " \t\r", &save); pair; pair = strtok_r(NULL, " \t\r", &save)) {
+		char *value = strchr(pair, '=');
+		if (!value) return pair;
+		*value++ = 0;
+		uint64_t num;
+		if (!strcmp(pair, "name")) {
+			job->name = strdup(value);
+		} else if (!strcmp(pair, "rom")) {
+			char *ext = strrchr(value, '.');
+			if (!(job->rom = batch_open(value))) return pair;
+			if (ext && !strcmp(ext, ".asm") && !(job->rom = batch_assemble(job->rom, value))) return pair;
+			if (job->rom->len > MMU_ROM_MAX) return pair;
+		} else if (!strcmp(pair, "input")) {
+			if (!(job->input = batch_open(value))) return pair;
+		} else if (!strcmp(pair, "output")) {
+			if (!(job->output = batch_open(value))) return pair;
+		} else if (!strcmp(pair, "disk")) {
+			if (!(job->disk = batch_open(value)) || job->disk->len < DISK_SECTOR) return pair;
+		} else if (!strcmp(pair, "cycles")) {
+			char *end;
+			job->cycles = strtoull(value, &end, 10);
+			if (!*value || *end || !job->cycles) return pair;
+		} else if (!strcmp(pair, "result")) {
+			job->result = strdup(value);
+		} else if (!strcmp(pair, "hash")) {
+			if (!parse_hex(value, UINT64_MAX, &job->hash)) return pair;
+			job->has_hash = true;
+		} else if (!strcmp(pair, "mem")) {
+			if (job->mem_len == BATCH_MEM_CHECKS || !parse_mem(value, &job->mem[job->mem_len])) return pair;
+			job->mem_len ++;
+		} else {
+			int reg = 0;
+			while (reg < BATCH_REGS && strcmp(pair, reg_names[reg])) reg ++;
+			if (reg == BATCH_REGS || !parse_hex(value, reg == BATCH_REG_PC || reg == BATCH_REG_SP ? 0xffff : 0xff, &num)) {
+				return pair;
+			}
+			job->regs[reg] = num;
+		}
+	}
+	if (!job->rom) return "rom";
+	if (!job->name) {
+		char buf[24];
+		sprintf(buf, "%zu", line_no);
+		job->name = strdup(buf);
+	}
+	return NULL;
+}
+
+// Reads all jobs from the manifest.
+static bool load_manifest(char *path) {
+	FILE *fd = fopen(path, "r");
+	if (!fd) {
+		fprintf(stderr, "Could not read '%s'\n", path);
+		return false;
+	}
+	char *slash = strrchr(path, '/');
+	base_dir = slash ? strndup(path, slash - path) : ".";
+	char *line = NULL;
+	size_t line_cap = 0;
+	size_t line_no = 0;
+	size_t cap = 0;
+	bool ok = true;
+	while (ok && getline(&line, &line_cap, fd) > 0) {
+		line_no ++;
+		line[strcspn(line, "\n")] = 0;
+		char *start = line + strspn(line, " \t\r");
+		if (!*start || *start == '#') continue;
+		if (jobs_len == cap) {
+			cap = cap ? cap * 2 : 256;
+			jobs = realloc(jobs, cap * sizeof(batch_job_t));
+			if (!jobs) {
+				fputs("Out of memory\n", stderr);
+				ok = false;
+				break;
+			}
+		}
+		char *bad = parse_job(start, line_no, &jobs[jobs_len]);
+		if (bad) {
+			fprintf(stderr, "%s:%zu: bad '%s'\n", path, line_no, bad);
+			ok = false;
+		}
+		jobs_len ++;
+	}
+	free(line);
+	fclose(fd);
+	return ok;
+}
+
+// Takes the next job, from this worker's queue or stolen from another.
+static bool batch_take(int self, size_t *index) {
+	batch_queue_t *own = &queues[self];
+	pthread_mutex_lock(&own->lock);
+	bool found = own->head < own->tail;
+	if (found) *index = own->head ++;
+	pthread_mutex_unlock(&own->lock);
+	while (!found) {
+		// Find the queue with the most jobs left.
+		int victim = -1;
+		size_t most = 0;
+		for (int i = 0; i < workers; i++) {
+			pthread_mutex_lock(&queues[i].lock);
+			size_t left = queues[i].tail - queues[i].head;
+			pthread_mutex_unlock(&queues[i].lock);
+			if (left > most) {
+				victim = i;
+				most   = left;
+			}
+		}
+		if (victim < 0) return false;
+		// Steal the back half of it, which its owner won't get to soon.
+		batch_queue_t *other = &queues[victim];
+		pthread_mutex_lock(&other->lock);
+		size_t left = other->tail - other->head;
+		size_t start = other->head + left / 2;
+		size_t end   = other->tail;
+		other->tail  = start;
+		pthread_mutex_unlock(&other->lock);
+		if (start < end) {
+			pthread_mutex_lock(&own->lock);
+			own->head = start + 1;
+			own->tail = end;
+			pthread_mutex_unlock(&own->lock);
+			*index = start;
+			found  = true;
+		}
+	}
+	return true;
+}
+
+// Checks console output against the expected output as it is written.
+static void check_output(machine_t *m, uint8_t value) {
+	batch_run_t *run = m->ctx;
+	batch_file_t *out = run->job->output;
+	if (run->lockstep) lockstep_console(run->lockstep, 0, value);
+	if (!out || run->mismatch) return;
+	if (run->out_pos < out->len && out->data[run->out_pos] == value) {
+		run->out_pos ++;
+	} else {
+		run->mismatch = true;
+	}
+}
+
+// Keeps track of the output of the machine being checked against the reference.
+static void other_output(machine_t *m, uint8_t value) {
+	batch_run_t *run = m->ctx;
+	lockstep_console(run->lockstep, 1, value);
+}
+
+// Finds the first assertion of a job that failed.
+// Returns false and describes it in failure if there is one.
+static bool check_job(machine_t *m, batch_run_t *run, const char *result, char *failure, size_t len) {
+	batch_job_t *job = run->job;
+	gr8cpurev3_t *cpu = &m->cpu;
+	if (run->lockstep && run->lockstep->diverged) {
+		snprintf(failure, len, "%s differs from the reference at cycle %lu",
+				run->lockstep->field, run->lockstep->states[0].cycles);
+		return false;
+	}
+	if (run->mismatch) {
+		snprintf(failure, len, "output differs at byte %zu", run->out_pos);
+		return false;
+	}
+	if (job->output && run->out_pos < job->output->len) {
+		snprintf(failure, len, "output ended at byte %zu of %zu", run->out_pos, job->output->len);
+		return false;
+	}
+	if (job->result && strcmp(job->result, result)) {
+		snprintf(failure, len, "result is %s, expected %s", result, job->result);
+		return false;
+	}
+	uint16_t regs[BATCH_REGS] = {
+		cpu->regPC, cpu->regA, cpu->regB, cpu->regX, cpu->regY, cpu->stackPtr
+	};
+	for (int i = 0; i < BATCH_REGS; i++) {
+		if (job->regs[i] >= 0 && job->regs[i] != regs[i]) {
+			snprintf(failure, len, "%s is %x, expected %x", reg_names[i], regs[i], job->regs[i]);
+			return false;
+		}
+	}
+	for (size_t i = 0; i < job->mem_len; i++) {
+		batch_mem_t *mem = &job->mem[i];
+		for (size_t j = 0; j < mem->len; j++) {
+			uint16_t address = mem->address + j;
+			uint8_t value = gr8cpurev3_readmem(cpu, address, true);
+			if (value != mem->data[j]) {
+				snprintf(failure, len, "memory at %04x is %02x, expected %02x", address, value, mem->data[j]);
+				return false;
+			}
+		}
+	}
+	if (job->has_hash && state_hash(cpu) != job->hash) {
+		snprintf(failure, len, "hash is %016lx, expected %016lx", state_hash(cpu), job->hash);
+		return false;
+	}
+	return true;
+}
+
+// Runs a job to the end, or to its first mismatch, and reports it.
+// With other set, also runs it there with the engine being checked.
+static void run_job(machine_t *m, machine_t *other, gr8cpurev3_cov_t *cov, size_t index) {
+	batch_job_t *job = &jobs[index];
+	batch_run_t run = { .job = job };
+	lockstep_t lockstep;
+	disk_t disk, other_disk;
+	machine_init(m, job->rom->data, job->rom->len);
+	if (cov) m->cpu.coverage = cov;
+	m->console = job->output || other ? check_output : NULL;
+	m->ctx     = &run;
+	if (job->disk) {
+		// Every job gets its own overlay, the image is shared by all of them.
+		disk_from_map(&disk, job->disk->data, job->disk->len);
+		disk_overlay(&disk, NULL);
+		dev_disk_insert(&m->disk_dev, &disk);
+	}
+	if (other) {
+		machine_init(other, job->rom->data, job->rom->len);
+		other->console = other_output;
+		other->ctx     = &run;
+		if (job->disk) {
+			disk_from_map(&other_disk, job->disk->data, job->disk->len);
+			disk_overlay(&other_disk, NULL);
+			dev_disk_insert(&other->disk_dev, &other_disk);
+		}
+		if (lockstep_init(&lockstep, m, other, check_engine, check_every)) run.lockstep = &lockstep;
+	}
+	// Run it, feeding the keyboard as it empties.
+	gr8cpurev3_t *cpu = &m->cpu;
+	size_t fed = 0;
+	int res = EXC_NORM;
+	while (res == EXC_NORM && !run.mismatch && cpu->numCycles < job->cycles) {
+		while (job->input && fed < job->input->len && machine_key(m, job->input->data[fed])) {
+			if (other) machine_key(other, job->input->data[fed]);
+			fed ++;
+		}
+		uint64_t n = job->cycles - cpu->numCycles;
+		if (n > BATCH_CHUNK) n = BATCH_CHUNK;
+		res = run.lockstep ? lockstep_run(run.lockstep, n) : gr8cpurev3_tick(cpu, n, TICK_NORMAL << 16);
+	}
+	bool diverged = run.lockstep && run.lockstep->diverged;
+	const char *result = diverged ? "diverged" : run.mismatch ? "stopped" : res == EXC_NORM ? "max_cycles" : exc_desc(res);
+	char failure[96];
+	bool pass = check_job(m, &run, result, failure, sizeof(failure));
+	if (!pass) __atomic_store_n(&any_failed, true, __ATOMIC_RELAXED);
+	// Report it as one line.
+	flockfile(stdout);
+	printf("{\"job\":%zu,\"name\":", index);
+	json_write_string(stdout, job->name, strlen(job->name));
+	printf(",\"status\":\"%s\",\"result\":\"%s\",\"cycles\":%lu,\"insns\":%lu,\"hash\":\"%016lx\"",
+			pass ? "pass" : "fail", result, cpu->numCycles, cpu->numInsns, state_hash(cpu));
+	if (!pass) {
+		fputs(",\"failure\":", stdout);
+		json_write_string(stdout, failure, strlen(failure));
+	}
+	if (diverged) {
+		fputs(",\"divergence\":", stdout);
+		lockstep_write_json(run.lockstep, stdout);
+	}
+	fputs("}\n", stdout);
+	funlockfile(stdout);
+	if (run.lockstep) lockstep_destroy(run.lockstep);
+	if (job->disk) {
+		disk_close(&disk);
+		if (other) disk_close(&other_disk);
+	}
+	machine_free(m);
+	if (other) machine_free(other);
+}
+
+static void *worker(void *arg) {
+	int self = (intptr_t) arg;
+	if (pin) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(self % sysconf(_SC_NPROCESSORS_ONLN), &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+	machine_t *m = malloc(sizeof(machine_t));
+	machine_t *other = check_engine ? malloc(sizeof(machine_t)) : NULL;
+	gr8cpurev3_cov_t *cov = NULL;
+	if (coverage_file) {
+		cov = coverage[self] = calloc(1, sizeof(gr8cpurev3_cov_t));
+	}
+	if (!m || (check_engine && !other) || (coverage_file && !cov)) {
+		fputs("Out of memory\n", stderr);
+		__atomic_store_n(&any_failed, true, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	size_t index;
+	while (batch_take(self, &index)) {
+		run_job(m, other, cov, index);
+	}
+	free(m);
+	free(other);
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	// Parse the options.
+	workers = sysconf(_SC_NPROCESSORS_ONLN);
+	char *manifest = NULL;
+	char *sock_path = NULL;
+	char *warm[argc];
+	size_t warm_len = 0;
+	for (int i = 1; i < argc; i++) {
+		if ((!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) && i < argc - 1) {
+			workers = atoi(argv[++ i]);
+		} else if (!strcmp(argv[i], "--pin")) {
+			pin = true;
+		} else if (!strcmp(argv[i], "--coverage") && i < argc - 1) {
+			coverage_file = argv[++ i];
+		} else if (!strcmp(argv[i], "--check") && i < argc - 1) {
+			if (!(check_engine = engine_find(argv[++ i]))) workers = 0;
+		} else if (!strcmp(argv[i], "--check-every") && i < argc - 1) {
+			check_every = atoi(argv[++ i]);
+			if (!check_every) workers = 0;
+		} else if (!strcmp(argv[i], "--serve") && i < argc - 1) {
+			sock_path = argv[++ i];
+		} else if (!strcmp(argv[i], "--warm") && i < argc - 1) {
+			warm[warm_len ++] = argv[++ i];
+		} else if (*argv[i] != '-' && !manifest) {
+			manifest = argv[i];
+		} else {
+			manifest  = NULL;
+			sock_path = NULL;
+			break;
+		}
+	}
+	if (sock_path && !manifest && workers > 0) {
+		base_dir = ".";
+		return serve_run(sock_path, workers, warm, warm_len);
+	}
+	if (!manifest || workers < 1) {
+		printf("%s [-j count] [--pin] [--coverage file] [--check engine] manifest\n", *argv);
+		printf("%s [-j count] [--warm rom]... --serve socket\n\n", *argv);
+		printf("    -j count\n");
+		printf("    --jobs count\n");
+		printf("                Number of worker threads, one per CPU by default.\n\n");
+		printf("    --pin\n");
+		printf("                Pin every worker thread to its own CPU.\n\n");
+		printf("    --coverage file\n");
+		printf("                Write what all jobs covered together to file, see gr8emu-cov.\n");
+		printf("                All jobs must run the same ROM.\n\n");
+		printf("    --check engine\n");
+		printf("                Also run every job with engine, in lockstep with the reference,\n");
+		printf("                and fail it where they differ. Engines are:\n");
+		for (const engine_t *engine = engines; engine->name; engine++) {
+			printf("                    %-8s%s\n", engine->name, engine->desc);
+		}
+		printf("\n");
+		printf("    --check-every count\n");
+		printf("                Instructions between comparisons with --check, 1 by default.\n\n");
+		printf("    --serve socket\n");
+		printf("                Run as a daemon answering requests on a Unix socket instead,\n");
+		printf("                see src/batch/serve.h for what they look like.\n\n");
+		printf("    --warm rom\n");
+		printf("                Boot rom in every worker before taking requests.\n\n");
+		printf("Runs every job in manifest and writes the results to stdout, one JSON\n");
+		printf("object per line. Exits with 1 if any job failed.\n");
+		return 2;
+	}
+	if (!load_manifest(manifest)) return 2;
+	for (size_t i = 1; coverage_file && i < jobs_len; i++) {
+		if (jobs[i].rom != jobs[0].rom) {
+			fprintf(stderr, "Coverage needs every job to run the same ROM, %s doesn't\n", jobs[i].name);
+			return 2;
+		}
+	}
+	// Give every worker an equal share of the jobs to start with.
+	if (workers > jobs_len) workers = jobs_len ? jobs_len : 1;
+	queues   = malloc(workers * sizeof(batch_queue_t));
+	coverage = calloc(workers, sizeof(gr8cpurev3_cov_t *));
+	pthread_t threads[workers];
+	for (int i = 0; i < workers; i++) {
+		pthread_mutex_init(&queues[i].lock, NULL);
+		queues[i].head = jobs_len * i / workers;
+		queues[i].tail = jobs_len * (i + 1) / workers;
+	}
+	for (int i = 0; i < workers; i++) {
+		pthread_create(&threads[i], NULL, worker, (void *) (intptr_t) i);
+	}
+	for (int i = 0; i < workers; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	// Combine the coverage of all workers.
+	if (coverage_file && jobs_len) {
+		for (int i = 1; i < workers; i++) {
+			if (coverage[i]) coverage_merge(coverage[0], coverage[i]);
+		}
+		uint64_t rom_hash = hash_bytes(0xcbf29ce484222325, jobs[0].rom->data, jobs[0].rom->len);
+		if (!coverage[0] || !coverage_save(coverage[0], coverage_file, rom_hash)) {
+			fprintf(stderr, "Could not save '%s': %s\n", coverage_file, coverage_error);
+			return 2;
+		}
+	}
+	return any_failed;
+}
@@ -0,0 +1,99 @@
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// Cycles to run at a time, between feeding the keyboard and checking for mismatches.
+#define BATCH_CHUNK      1024
+// Cycle limit of jobs that don't set one.
+#define BATCH_CYCLES     10000000
+// Most memory assertions per job.
+#define BATCH_MEM_CHECKS 8
+// Most bytes per memory assertion.
+#define BATCH_MEM_LEN    64
+
+/*
+
+Manifests list one job per line as key=value pairs, separated by spaces:
+	name=boot rom=fw.bin input=boot.txt cycles=500000 output=boot.out result=halt pc=0123
+Empty lines and lines starting with # are skipped.
+
+	name=text        Name of the job in the results, the line number by default.
+	rom=path         ROM image to run, required. Assembled first if it ends in .asm.
+	input=path       Typed on the keyboard as fast as the firmware takes it.
+	disk=path        Disk image, written to a copy-on-write overlay the job drops.
+	cycles=count     Most cycles to run for, BATCH_CYCLES by default.
+	output=path      Expected console output, exactly.
+	result=reason    Expected reason to stop: halt, max_cycles, no_insn, ...
+	pc=hex           Expected register value, also for a, b, x, y and sp.
+	hash=hex         Expected state hash, as printed in the results.
+	mem=addr:hex     Expected bytes in memory from addr, may be repeated.
+
+Paths are relative to the manifest. A job stops at its first assertion that fails;
+the output is checked while running, everything else once the job has stopped.
+
+A manifest of ROMs with the hash of their final state is a golden corpus: with
+--check, every job also runs in lockstep on another engine, and fails with result
+diverged at the first comparison where the engines disagree.
+
+*/
+
+// A file used by jobs, mapped once and shared by all of them.
+typedef struct batch_file {
+	uint8_t *data;
+	size_t   len;
+	dev_t    dev;
+	ino_t    ino;
+	struct batch_file *assembled;       // The ROM, if this is assembly and it was assembled.
+} batch_file_t;
+
+// Expected bytes in memory.
+typedef struct batch_mem {
+	uint16_t address;
+	uint8_t  len;
+	uint8_t  data[BATCH_MEM_LEN];
+} batch_mem_t;
+
+// Registers that can be asserted.
+#define BATCH_REG_PC 0
+#define BATCH_REG_A  1
+#define BATCH_REG_B  2
+#define BATCH_REG_X  3
+#define BATCH_REG_Y  4
+#define BATCH_REG_SP 5
+#define BATCH_REGS   6
+
+typedef struct batch_job {
+	char         *name;
+	batch_file_t *rom;
+	batch_file_t *input;                // Optional.
+	batch_file_t *output;               // Optional.
+	batch_file_t *disk;                 // Optional.
+	uint64_t      cycles;
+	char         *result;               // Optional.
+	int32_t       regs[BATCH_REGS];     // -1 if not asserted.
+	bool          has_hash;
+	uint64_t      hash;
+	batch_mem_t   mem[BATCH_MEM_CHECKS];
+	size_t        mem_len;
+} batch_job_t;
+
+// Jobs left for a worker, others steal from the end.
+typedef struct batch_queue {
+	pthread_mutex_t lock;
+	size_t          head;
+	size_t          tail;
+} batch_queue_t;
+
+// Maps a file for jobs to use, or finds it if it was mapped already.
+// Relative paths are relative to the manifest.
+batch_file_t *batch_open(char *path);
+// Assembles a source for jobs to run, or finds it if it was assembled already.
+batch_file_t *batch_assemble(batch_file_t *src, char *path);
+
+#endif //BATCH_H
@@ -0,0 +1,148 @@
+
+#include "lockstep.h"
+#include "../snapshot.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Sets up comparing two machines, which must be identical.
+// Returns false if out of memory.
+bool lockstep_init(lockstep_t *ls, machine_t *ref, machine_t *other, const engine_t *engine, size_t every) {
+	memset(ls, 0, sizeof(lockstep_t));
+	ls->ref     = ref;
+	ls->other   = other;
+	ls->engine  = engine;
+	ls->every   = every;
+	ls->insn_pc = ref->cpu.regPC;
+	ls->console[0] = ls->console[1] = 0xcbf29ce484222325;
+	ls->dev_buf = malloc(devbus_state_len(&ref->bus) + 1);
+	return ls->dev_buf;
+}
+
+// Frees what lockstep_init allocated.
+void lockstep_destroy(lockstep_t *ls) {
+	free(ls->dev_buf);
+	ls->dev_buf = NULL;
+}
+
+// Hashes console output of a machine, 0 for the reference and 1 for the other.
+void lockstep_console(lockstep_t *ls, int which, uint8_t value) {
+	ls->console[which] = hash_bytes(ls->console[which], &value, 1);
+}
+
+static void capture(lockstep_t *ls, int which, int res, lockstep_state_t *out) {
+	machine_t *m = which ? ls->other : ls->ref;
+	gr8cpurev3_t *cpu = &m->cpu;
+	devbus_save(&m->bus, ls->dev_buf);
+	*out = (lockstep_state_t) {
+		.res     = res,
+		.cycles  = cpu->numCycles,
+		.insns   = cpu->numInsns,
+		.pc      = cpu->regPC,
+		.ar      = cpu->regAR,
+		.sp      = cpu->stackPtr,
+		.a       = cpu->regA,
+		.b       = cpu->regB,
+		.x       = cpu->regX,
+		.y       = cpu->regY,
+		.ir      = cpu->regIR,
+		.flags   = gr8cpurev3_readflags(cpu),
+		.mode    = cpu->mode,
+		.stage   = cpu->stage,
+		.ram     = state_hash(cpu),
+		.devices = hash_bytes(0xcbf29ce484222325, ls->dev_buf, devbus_state_len(&m->bus)),
+		.console = ls->console[which],
+		.reads   = m->bus.reads,
+		.writes  = m->bus.writes
+	};
+}
+
+// Names the first field that differs between two states, or returns NULL.
+static const char *compare(lockstep_state_t *a, lockstep_state_t *b) {
+#define LOCKSTEP_FIELD(name) if (a->name != b->name) return #name;
+	LOCKSTEP_FIELD(res)
+	LOCKSTEP_FIELD(cycles)
+	LOCKSTEP_FIELD(insns)
+	LOCKSTEP_FIELD(pc)
+	LOCKSTEP_FIELD(ar)
+	LOCKSTEP_FIELD(sp)
+	LOCKSTEP_FIELD(a)
+	LOCKSTEP_FIELD(b)
+	LOCKSTEP_FIELD(x)
+	LOCKSTEP_FIELD(y)
+	LOCKSTEP_FIELD(ir)
+	LOCKSTEP_FIELD(flags)
+	LOCKSTEP_FIELD(mode)
+	LOCKSTEP_FIELD(stage)
+	LOCKSTEP_FIELD(ram)
+	LOCKSTEP_FIELD(devices)
+	LOCKSTEP_FIELD(console)
+	LOCKSTEP_FIELD(reads)
+	LOCKSTEP_FIELD(writes)
+#undef LOCKSTEP_FIELD
+	return NULL;
+}
+
+// Runs both machines for at most n cycles, comparing them as often as set up.
+// Returns the result of the reference, or EXC_ERR if they diverged.
+int lockstep_run(lockstep_t *ls, uint64_t n) {
+	gr8cpurev3_t *ref = &ls->ref->cpu;
+	uint64_t start = ref->numCycles;
+	int res = EXC_NORM;
+	while (res == EXC_NORM && ref->numCycles - start < n) {
+		// The reference goes first, a cycle at a time to find instruction boundaries.
+		uint64_t before = ref->numCycles;
+		size_t insns = 0;
+		while (insns < ls->every && ref->numCycles - start < n) {
+			res = engines[0].run(ref, 1);
+			if (res != EXC_NORM) break;
+			if (ref->mode == MODE_LOAD && ref->stage == 0) {
+				lockstep_insn_t *insn = &ls->trace[ls->trace_len ++ % LOCKSTEP_TRACE];
+				insn->cycle = ref->numCycles;
+				insn->pc    = ls->insn_pc;
+				insn->ir    = ref->regIR;
+				ls->insn_pc = ref->regPC;
+				insns ++;
+			}
+		}
+		// Then the other catches up all at once.
+		int other = ls->engine->run(&ls->other->cpu, ref->numCycles - before);
+		if (res != EXC_NORM && other == EXC_NORM) {
+			// Some stop before counting their cycle, so give it one more to get there.
+			other = ls->engine->run(&ls->other->cpu, 1);
+		}
+		capture(ls, 0, res, &ls->states[0]);
+		capture(ls, 1, other, &ls->states[1]);
+		ls->field = compare(&ls->states[0], &ls->states[1]);
+		if (ls->field) {
+			ls->diverged = true;
+			return EXC_ERR;
+		}
+		ls->last_match = ref->numCycles;
+	}
+	return res;
+}
+
+static void write_state(lockstep_state_t *state, FILE *fd) {
+	fprintf(fd, "{\"result\":\"%s\",\"cycles\":%lu,\"insns\":%lu,", exc_desc(state->res), state->cycles, state->insns);
+	fprintf(fd, "\"pc\":%u,\"ar\":%u,\"sp\":%u,\"a\":%u,\"b\":%u,\"x\":%u,\"y\":%u,\"ir\":%u,",
+			state->pc, state->ar, state->sp, state->a, state->b, state->x, state->y, state->ir);
+	fprintf(fd, "\"flags\":%u,\"mode\":%u,\"stage\":%u,\"ram\":\"%016lx\",\"devices\":\"%016lx\",",
+			state->flags, state->mode, state->stage, state->ram, state->devices);
+	fprintf(fd, "\"console\":\"%016lx\",\"reads\":%zu,\"writes\":%zu}", state->console, state->reads, state->writes);
+}
+
+// Writes the divergence as a JSON object.
+void lockstep_write_json(lockstep_t *ls, FILE *fd) {
+	fprintf(fd, "{\"engine\":\"%s\",\"field\":\"%s\",\"last_match\":%lu,\"reference\":",
+			ls->engine->name, ls->field, ls->last_match);
+	write_state(&ls->states[0], fd);
+	fputs(",\"other\":", fd);
+	write_state(&ls->states[1], fd);
+	fputs(",\"trace\":[", fd);
+	size_t first = ls->trace_len > LOCKSTEP_TRACE ? ls->trace_len - LOCKSTEP_TRACE : 0;
+	for (size_t i = first; i < ls->trace_len; i++) {
+		lockstep_insn_t *insn = &ls->trace[i % LOCKSTEP_TRACE];
+		fprintf(fd, "%s{\"cycle\":%lu,\"pc\":%u,\"ir\":%u}", i > first ? "," : "", insn->cycle, insn->pc, insn->ir);
+	}
+	fputs("]}", fd);
+}
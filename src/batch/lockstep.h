@@ -0,0 +1,68 @@
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "../machine.h"
+#include "../engine.h"
+
+// Instructions the reference ran before a divergence, kept for the report.
+#define LOCKSTEP_TRACE 16
+
+// What is compared between the machines.
+typedef struct lockstep_state {
+	int      res;                       // Result of the last run.
+	uint64_t cycles;
+	uint64_t insns;
+	uint16_t pc, ar, sp;
+	uint8_t  a, b, x, y, ir;
+	uint8_t  flags, mode, stage;
+	uint64_t ram;                       // state_hash of the CPU.
+	uint64_t devices;                   // Hash of the device states.
+	uint64_t console;                   // Hash of the console output.
+	size_t   reads, writes;             // MMIO accesses.
+} lockstep_state_t;
+
+// An instruction in the trace.
+typedef struct lockstep_insn {
+	uint64_t cycle;
+	uint16_t pc;
+	uint8_t  ir;
+} lockstep_insn_t;
+
+// Two machines running the same thing, one with the reference engine.
+typedef struct lockstep {
+	machine_t        *ref;
+	machine_t        *other;
+	const engine_t   *engine;
+	size_t            every;            // Instructions between comparisons.
+	uint64_t          console[2];       // Console output hashes, by machine.
+	uint8_t          *dev_buf;          // For hashing device states.
+	// ==== TRACE ====
+	lockstep_insn_t   trace[LOCKSTEP_TRACE];
+	size_t            trace_len;        // Total, the ring has the last LOCKSTEP_TRACE.
+	uint16_t          insn_pc;          // Where the running instruction started.
+	// ==== DIVERGENCE ====
+	bool              diverged;
+	const char       *field;            // First field that differs.
+	uint64_t          last_match;       // Cycle both last agreed at.
+	lockstep_state_t  states[2];        // Where they differed.
+} lockstep_t;
+
+// Sets up comparing two machines, which must be identical.
+// Returns false if out of memory.
+bool lockstep_init(lockstep_t *ls, machine_t *ref, machine_t *other, const engine_t *engine, size_t every);
+// Frees what lockstep_init allocated.
+void lockstep_destroy(lockstep_t *ls);
+// Hashes console output of a machine, 0 for the reference and 1 for the other.
+void lockstep_console(lockstep_t *ls, int which, uint8_t value);
+// Runs both machines for at most n cycles, comparing them as often as set up.
+// Returns the result of the reference, or EXC_ERR if they diverged.
+int lockstep_run(lockstep_t *ls, uint64_t n);
+// Writes the divergence as a JSON object.
+void lockstep_write_json(lockstep_t *ls, FILE *fd);
+
+#endif //LOCKSTEP_H
@@ -0,0 +1,298 @@
+
+#define _GNU_SOURCE
+#include "serve.h"
+#include "../json_utils.h"
+#include "../escape_utils.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+static int listen_fd;
+static char **warm_roms;
+static size_t warm_len;
+// Files are mapped by any worker, batch_open isn't thread safe.
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// A worker, with its own pool so snapshots are never shared between threads.
+typedef struct serve_worker {
+	serve_slot_t pool[SERVE_POOL];
+	uint64_t     requests;
+	char         output[SERVE_OUTPUT_MAX];
+	size_t       output_len;
+} serve_worker_t;
+
+static uint64_t micros() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static batch_file_t *serve_open(char *path) {
+	pthread_mutex_lock(&files_lock);
+	batch_file_t *file = batch_open(path);
+	pthread_mutex_unlock(&files_lock);
+	return file;
+}
+
+// Parses a memory selector, as addr:len.
+static bool parse_mem(char *str, serve_mem_t *out) {
+	char *end;
+	unsigned long address = strtoul(str, &end, 16);
+	if (end == str || *end != ':' || address > 0xffff) return false;
+	str = end + 1;
+	unsigned long len = strtoul(str, &end, 16);
+	if (end == str || *end || !len || len > 0x100) return false;
+	out->address = address;
+	out->len     = len;
+	return true;
+}
+
+// Parses one request line.
+// Returns the key that was wrong, or NULL.
+static char *parse_req(char *line, serve_req_t *req) {
+	memset(req, 0, sizeof(serve_req_t));
+	req->boot   = true;
+	req->cycles = BATCH_CYCLES;
+	char *save = NULL;
+	for (char *pair = strtok_r(line, " \t\r", &save); pair; pair = strtok_r(NULL, " \t\r", &save)) {
+		char *value = strchr(pair, '=');
+		if (!value) return pair;
+		*value++ = 0;
+		if (!strcmp(pair, "rom")) {
+			if (!(req->rom = serve_open(value)) || req->rom->len > MMU_ROM_MAX) return pair;
+		} else if (!strcmp(pair, "boot")) {
+			if (!strcmp(value, "input")) req->boot = true;
+			else if (!strcmp(value, "reset")) req->boot = false;
+			else return pair;
+		} else if (!strcmp(pair, "input")) {
+			req->input     = value;
+			req->input_len = unescape(value);
+		} else if (!strcmp(pair, "cycles")) {
+			char *end;
+			req->cycles = strtoull(value, &end, 10);
+			if (!*value || *end || !req->cycles) return pair;
+		} else if (!strcmp(pair, "select")) {
+			char *inner = NULL;
+			for (char *sel = strtok_r(value, ",", &inner); sel; sel = strtok_r(NULL, ",", &inner)) {
+				if (!strcmp(sel, "output")) {
+					req->select |= SERVE_SEL_OUTPUT;
+				} else if (!strcmp(sel, "regs")) {
+					req->select |= SERVE_SEL_REGS;
+				} else if (!strcmp(sel, "hash")) {
+					req->select |= SERVE_SEL_HASH;
+				} else if (!strncmp(sel, "mem:", 4) && req->mem_len < SERVE_MEM && parse_mem(sel + 4, &req->mem[req->mem_len])) {
+					req->mem_len ++;
+				} else {
+					return pair;
+				}
+			}
+		} else {
+			return pair;
+		}
+	}
+	if (!req->rom) return "rom";
+	return NULL;
+}
+
+static void capture(machine_t *m, uint8_t value) {
+	serve_worker_t *self = m->ctx;
+	if (self->output_len < SERVE_OUTPUT_MAX) {
+		self->output[self->output_len ++] = value;
+	}
+}
+
+// Boots a machine and snapshots where requests on it start.
+static bool slot_boot(serve_worker_t *self, serve_slot_t *slot, batch_file_t *rom, bool boot) {
+	if (slot->rom) {
+		snapshot_free(slot->golden);
+		snapctx_destroy(&slot->snapctx);
+		machine_free(&slot->m);
+		slot->rom = NULL;
+	}
+	machine_t *m = &slot->m;
+	machine_init(m, rom->data, rom->len);
+	m->ctx = self;
+	snapctx_init(&slot->snapctx, &m->cpu, &m->bus);
+	int res = EXC_NORM;
+	while (boot && res == EXC_NORM && !m->keyb_polled && m->cpu.numCycles < SERVE_BOOT) {
+		res = gr8cpurev3_tick(&m->cpu, BATCH_CHUNK, TICK_NORMAL << 16);
+	}
+	slot->golden = snapshot_take(&slot->snapctx);
+	if (!slot->golden) {
+		snapctx_destroy(&slot->snapctx);
+		return false;
+	}
+	slot->rom  = rom;
+	slot->boot = boot;
+	return true;
+}
+
+// Finds a warm machine for a request, booting one if there is none.
+// Sets warm if the machine was already in the pool.
+static serve_slot_t *slot_get(serve_worker_t *self, batch_file_t *rom, bool boot, bool *warm) {
+	serve_slot_t *oldest = &self->pool[0];
+	for (int i = 0; i < SERVE_POOL; i++) {
+		serve_slot_t *slot = &self->pool[i];
+		if (slot->rom == rom && slot->boot == boot) {
+			*warm = true;
+			return slot;
+		}
+		if (!slot->rom || (oldest->rom && slot->used < oldest->used)) oldest = slot;
+	}
+	*warm = false;
+	return slot_boot(self, oldest, rom, boot) ? oldest : NULL;
+}
+
+// Runs one request and writes the answer.
+static void serve_req(serve_worker_t *self, serve_req_t *req, FILE *out) {
+	uint64_t start = micros();
+	bool warm;
+	serve_slot_t *slot = slot_get(self, req->rom, req->boot, &warm);
+	if (!slot) {
+		fputs("{\"status\":\"error\",\"error\":\"out of memory\"}\n", out);
+		return;
+	}
+	slot->used = ++ self->requests;
+	machine_t *m = &slot->m;
+	gr8cpurev3_t *cpu = &m->cpu;
+	m->console = capture;
+	self->output_len = 0;
+	// Run from the golden state, feeding the keyboard as it empties.
+	uint64_t cycles = cpu->numCycles;
+	uint64_t insns  = cpu->numInsns;
+	size_t fed = 0;
+	int res = EXC_NORM;
+	while (res == EXC_NORM && cpu->numCycles - cycles < req->cycles) {
+		while (fed < req->input_len && machine_key(m, req->input[fed])) fed ++;
+		uint64_t n = req->cycles - (cpu->numCycles - cycles);
+		res = gr8cpurev3_tick(cpu, n < BATCH_CHUNK ? n : BATCH_CHUNK, TICK_NORMAL << 16);
+	}
+	m->console = NULL;
+	// Answer with what was selected.
+	fprintf(out, "{\"status\":\"ok\",\"result\":\"%s\",\"cycles\":%lu,\"insns\":%lu",
+			res == EXC_NORM ? "max_cycles" : exc_desc(res), cpu->numCycles - cycles, cpu->numInsns - insns);
+	if (req->select & SERVE_SEL_OUTPUT) {
+		fputs(",\"output\":", out);
+		json_write_string(out, self->output, self->output_len);
+	}
+	if (req->select & SERVE_SEL_REGS) {
+		fprintf(out, ",\"regs\":{\"pc\":%u,\"a\":%u,\"b\":%u,\"x\":%u,\"y\":%u,\"sp\":%u,\"flags\":%u}",
+				cpu->regPC, cpu->regA, cpu->regB, cpu->regX, cpu->regY, cpu->stackPtr, gr8cpurev3_readflags(cpu));
+	}
+	if (req->select & SERVE_SEL_HASH) {
+		fprintf(out, ",\"hash\":\"%016lx\"", state_hash(cpu));
+	}
+	if (req->mem_len) {
+		fputs(",\"mem\":{", out);
+		for (size_t i = 0; i < req->mem_len; i++) {
+			fprintf(out, "%s\"%04x\":\"", i ? "," : "", req->mem[i].address);
+			for (size_t j = 0; j < req->mem[i].len; j++) {
+				fprintf(out, "%02x", gr8cpurev3_readmem(cpu, req->mem[i].address + j, true));
+			}
+			fputc('"', out);
+		}
+		fputc('}', out);
+	}
+	// Put it back for the next request, only the pages it changed are copied.
+	snapshot_restore(&slot->snapctx, slot->golden);
+	m->keyb_polled = false;
+	fprintf(out, ",\"warm\":%s,\"micros\":%lu}\n", warm ? "true" : "false", micros() - start);
+}
+
+// Answers requests on one connection until it is closed.
+static void serve_conn(serve_worker_t *self, int fd) {
+	FILE *in  = fdopen(fd, "r");
+	int out_fd = dup(fd);
+	FILE *out = out_fd >= 0 ? fdopen(out_fd, "w") : NULL;
+	if (!in || !out) {
+		if (in) fclose(in); else close(fd);
+		if (out) fclose(out); else if (out_fd >= 0) close(out_fd);
+		return;
+	}
+	char *line = NULL;
+	size_t line_cap = 0;
+	while (getline(&line, &line_cap, in) > 0) {
+		line[strcspn(line, "\n")] = 0;
+		char *start = line + strspn(line, " \t\r");
+		if (!*start) continue;
+		serve_req_t req;
+		char *bad = parse_req(start, &req);
+		if (bad) {
+			char error[96];
+			snprintf(error, sizeof(error), "bad '%s'", bad);
+			fputs("{\"status\":\"error\",\"error\":", out);
+			json_write_string(out, error, strlen(error));
+			fputs("}\n", out);
+		} else {
+			serve_req(self, &req, out);
+		}
+		if (fflush(out)) break;
+	}
+	free(line);
+	fclose(in);
+	fclose(out);
+}
+
+static void *worker(void *arg) {
+	serve_worker_t *self = calloc(1, sizeof(serve_worker_t));
+	if (!self) {
+		fputs("Out of memory\n", stderr);
+		return NULL;
+	}
+	// Boot the ROMs asked for up front, so the first requests are fast too.
+	for (size_t i = 0; i < warm_len && i < SERVE_POOL; i++) {
+		batch_file_t *rom = serve_open(warm_roms[i]);
+		bool warm;
+		if (rom && rom->len <= MMU_ROM_MAX) slot_get(self, rom, true, &warm);
+	}
+	while (1) {
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd >= 0) serve_conn(self, fd);
+	}
+	return NULL;
+}
+
+// Serves requests on a Unix socket until killed.
+// Returns 2 if the socket can't be made.
+int serve_run(char *path, int workers, char **warm, size_t len) {
+	warm_roms = warm;
+	warm_len  = len;
+	for (size_t i = 0; i < len; i++) {
+		batch_file_t *rom = batch_open(warm[i]);
+		if (!rom || rom->len > MMU_ROM_MAX) {
+			fprintf(stderr, "Could not load '%s'\n", warm[i]);
+			return 2;
+		}
+	}
+	// Clients that hang up early shouldn't take the daemon with them.
+	signal(SIGPIPE, SIG_IGN);
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path '%s' is too long\n", path);
+		return 2;
+	}
+	strcpy(addr.sun_path, path);
+	// Replace a socket left behind, but nothing else.
+	struct stat st;
+	if (!stat(path, &st) && S_ISSOCK(st.st_mode)) unlink(path);
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) || listen(listen_fd, SOMAXCONN)) {
+		perror(path);
+		return 2;
+	}
+	// Every worker takes connections as they come.
+	pthread_t threads[workers];
+	for (int i = 0; i < workers; i++) {
+		pthread_create(&threads[i], NULL, worker, NULL);
+	}
+	for (int i = 0; i < workers; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	return 0;
+}
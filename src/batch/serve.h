@@ -0,0 +1,74 @@
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "batch.h"
+#include "../machine.h"
+#include "../snapshot.h"
+
+// Warm machines kept by every worker, the least recently used one is replaced.
+#define SERVE_POOL       8
+// Most cycles to boot for before the first keyboard read.
+#define SERVE_BOOT       10000000
+// Most bytes of console output returned.
+#define SERVE_OUTPUT_MAX 65536
+// Most memory ranges returned per request.
+#define SERVE_MEM        8
+
+/*
+
+Requests are one line of key=value pairs, like a manifest, and answered with one
+line of JSON. A connection may send any number of requests, one at a time:
+	rom=fw.bin input=help\n cycles=200000 select=output,regs,mem:0100:10
+
+	rom=path         ROM image to run, required. Relative to where the daemon runs.
+	boot=mode        Where to start: input, the first keyboard read, by default.
+	                 Or reset, the very first cycle.
+	input=text       Typed on the keyboard, with C escapes. \s is a space.
+	cycles=count     Most cycles to run for, BATCH_CYCLES by default.
+	select=list      What to return besides the result, separated by commas:
+	                 output, regs, hash or mem:addr:len, in hexadecimal,
+	                 at most 100 bytes each.
+
+Every worker keeps booted machines in a pool, with a snapshot of where requests
+start. After a request only the pages it changed are restored.
+
+*/
+
+// Selectors of a request.
+#define SERVE_SEL_OUTPUT 0x01
+#define SERVE_SEL_REGS   0x02
+#define SERVE_SEL_HASH   0x04
+
+// A range of memory to return.
+typedef struct serve_mem {
+	uint16_t address;
+	uint16_t len;
+} serve_mem_t;
+
+typedef struct serve_req {
+	batch_file_t *rom;
+	bool          boot;                 // Start from the first keyboard read.
+	char         *input;                // Unescaped, in the request line.
+	size_t        input_len;
+	uint64_t      cycles;
+	int           select;
+	serve_mem_t   mem[SERVE_MEM];
+	size_t        mem_len;
+} serve_req_t;
+
+// A warm machine and where requests on it start.
+typedef struct serve_slot {
+	batch_file_t *rom;                  // NULL if unused.
+	bool          boot;
+	machine_t     m;
+	snapctx_t     snapctx;
+	snapshot_t   *golden;
+	uint64_t      used;                 // Request count when last used.
+} serve_slot_t;
+
+// Serves requests on a Unix socket until killed.
+// Returns 2 if the socket can't be made.
+int serve_run(char *path, int workers, char **warm, size_t len);
+
+#endif //SERVE_H
@@ -55,8 +55,12 @@ Outputs 16-bit:
 
 */
 
-extern uint8_t gr8cpu_mmio_read(uint16_t address, bool notouchy);
-extern void gr8cpu_mmio_write(uint16_t address, uint8_t value);
+extern uint8_t gr8cpu_mmio_read(gr8cpurev3_t *cpu, uint16_t address, bool notouchy);
+extern void gr8cpu_mmio_write(gr8cpurev3_t *cpu, uint16_t address, uint8_t value);
+extern void gr8cpu_mmio_event(gr8cpurev3_t *cpu);
+extern uint8_t *gr8cpu_mmio_bank(gr8cpurev3_t *cpu, uint16_t address);
+
+static int gr8cpurev3_sleep(gr8cpurev3_t *cpu, int maxTicks);
 
 int gr8cpurev3_tick(gr8cpurev3_t *cpu, int maxTicks, int tickOp) {
 	int tickMode = tickOp >> 16;
@@ -178,6 +182,11 @@ int gr8cpurev3_tick(gr8cpurev3_t *cpu, int maxTicks, int tickOp) {
 	{
 		/* Normal tick. */
 		for (int i = 0; i < maxTicks; i++) {
+			if (gr8cpurev3_asleep(cpu)) {
+				// Skip ahead to whatever can wake it.
+				i += gr8cpurev3_sleep(cpu, maxTicks - i) - 1;
+				continue;
+			}
 			a = gr8cpurev3_pretick(cpu);
 			if (a != EXC_NORM) return a;
 			a = gr8cpurev3_posttick(cpu);
@@ -191,11 +200,15 @@ int gr8cpurev3_tick(gr8cpurev3_t *cpu, int maxTicks, int tickOp) {
 // If notouchy is nonzero, anything that activates on read will not be activated.
 // Another read is done in posttick, with notouchy off so as to do stuff.
 uint8_t gr8cpurev3_readmem(gr8cpurev3_t *cpu, uint16_t address, bool notouchy) {
+	if (cpu->banked && (cpu->banked >> (address >> BANK_SHIFT) & 1) && (address & 0xFF00) != 0xFE00) {
+		// Windows the MMU moved somewhere else.
+		return cpu->bankRead[address >> BANK_SHIFT][address & (BANK_SIZE - 1)];
+	}
 	if (address < cpu->romLen) {
 		return cpu->rom[address];
 	}
 	else if ((address & 0xFF00) == 0xFE00) {
-		return gr8cpu_mmio_read(address, notouchy);
+		return gr8cpu_mmio_read(cpu, address, notouchy);
 	}
 	else
 	{
@@ -203,18 +216,47 @@ uint8_t gr8cpurev3_readmem(gr8cpurev3_t *cpu, uint16_t address, bool notouchy) {
 	}
 }
 
-void gr8cpurev3_writemem(gr8cpurev3_t *cpu, uint16_t address, uint8_t value) {
-	if (address < cpu->romLen) {
+void gr8cpurev3_dirtymem(gr8cpurev3_t *cpu, uint16_t address) {
+	if (cpu->ramDirty) {
+		// Keep track of changed pages for snapshots.
+		cpu->ramDirty[address >> 8] = 1;
+	}
+}
+
+void gr8cpurev3_storemem(gr8cpurev3_t *cpu, uint16_t address, uint8_t value) {
+	bool banked = cpu->banked && (cpu->banked >> (address >> BANK_SHIFT) & 1) && (address & 0xFF00) != 0xFE00;
+	if (banked) {
+		// Windows the MMU moved somewhere else, which keep track of their own pages.
+		uint8_t window = address >> BANK_SHIFT;
+		uint8_t *bank = cpu->bankWrite[window];
+		if (!bank) bank = gr8cpu_mmio_bank(cpu, address);
+		if (bank) bank[address & (BANK_SIZE - 1)] = value;
+		if (bank && cpu->bankDirty[window]) cpu->bankDirty[window][(address & (BANK_SIZE - 1)) >> 8] = 1;
+	}
+	else if (address < cpu->romLen) {
 		// You can't write ROM, so we'll write RAM instead.
 		cpu->ram[address] = value;
 	}
 	else if ((address & 0xFF00) == 0xFE00) {
-		gr8cpu_mmio_write(address, value);
+		gr8cpu_mmio_write(cpu, address, value);
 	}
 	else
 	{
 		cpu->ram[address] = value;
 	}
+	if (!banked && (address & 0xFF00) != 0xFE00) {
+		gr8cpurev3_dirtymem(cpu, address);
+	}
+}
+
+void gr8cpurev3_writemem(gr8cpurev3_t *cpu, uint16_t address, uint8_t value) {
+	gr8cpurev3_storemem(cpu, address, value);
+	for (uint32_t i = 0; i < cpu->watchpointsLen; i++) {
+		if (address == cpu->watchpoints[i]) {
+			// Le watchpoint hit, reported at the end of the cycle.
+			cpu->watchHit = 1;
+		}
+	}
 }
 
 uint16_t gr8cpurev3_find_address(gr8cpurev3_t *cpu, int ctrl) {
@@ -366,6 +408,39 @@ void gr8cpurev3_poll_interrupts(gr8cpurev3_t *cpu) {
 			cpu->wasHWI = 1;
 		}
 	}
+	if (cpu->mode != MODE_LOAD) {
+		// Taking an interrupt is what sleeping waits for.
+		cpu->sleeping = false;
+	}
+}
+
+// Whether the CPU is sleeping between instructions, so that nothing runs.
+// Sleeping starts when the instruction that asked for it has finished.
+bool gr8cpurev3_asleep(gr8cpurev3_t *cpu) {
+	return cpu->sleeping && cpu->mode == MODE_LOAD && cpu->stage == 0;
+}
+
+// Lets at most maxTicks cycles pass while asleep, but not past the next thing that can wake the CPU.
+// Returns the number of cycles that passed.
+static int gr8cpurev3_sleep(gr8cpurev3_t *cpu, int maxTicks) {
+	uint64_t n = maxTicks;
+	if (cpu->eventCycle > cpu->numCycles && cpu->eventCycle - cpu->numCycles < n) n = cpu->eventCycle - cpu->numCycles;
+	if (cpu->schduledIRQ > 0 && (uint64_t) cpu->schduledIRQ < n) n = cpu->schduledIRQ;
+	if (cpu->schduledNMI > 0 && (uint64_t) cpu->schduledNMI < n) n = cpu->schduledNMI;
+	if (n < 1) n = 1;
+	cpu->numCycles += n;
+	if (cpu->schduledIRQ > 0) cpu->schduledIRQ -= n;
+	if (cpu->schduledNMI > 0) cpu->schduledNMI -= n;
+	if (cpu->numCycles >= cpu->eventCycle) {
+		// Let the peripherals catch up.
+		gr8cpu_mmio_event(cpu);
+	}
+	if (cpu->schduledIRQ == 0 || cpu->schduledNMI == 0 || cpu->debugIRQ || cpu->debugNMI) {
+		// Woken up even if interrupts are disabled, then it just carries on.
+		cpu->sleeping = false;
+		gr8cpurev3_poll_interrupts(cpu);
+	}
+	return n;
 }
 
 // Gets the state of the bus ready.
@@ -503,6 +578,10 @@ int gr8cpurev3_posttick(gr8cpurev3_t *cpu) {
 	{
 		ctrlAddr = (cpu->mode << 4) | cpu->stage | (1 << 11);
 	}
+	if (gr8cpurev3_asleep(cpu)) {
+		gr8cpurev3_sleep(cpu, 1);
+		return EXC_NORM;
+	}
 	if (ctrlAddr >= cpu->isaRomLen) {
 		printf("Error: no instruction (postTick, out of bounds).\n");
 		printf("addr=%08x, ir=%02x, stage=%02x, mode=%02x\n", ctrlAddr, cpu->regIR, cpu->stage, cpu->mode);
@@ -519,6 +598,9 @@ int gr8cpurev3_posttick(gr8cpurev3_t *cpu) {
 			return EXC_NOINSN;
 		}
 	}
+	if (cpu->coverage) {
+		cpu->coverage->rows[ctrlAddr] = 1;
+	}
 
 	// Start by getting read / write signals.
 	int in = ((ctrl & _C_in_0) ? 1 : 0)
@@ -571,6 +653,13 @@ int gr8cpurev3_posttick(gr8cpurev3_t *cpu) {
 		break;
 	case(_I_IRI):
 		cpu->regIR = cpu->bus;
+		if (cpu->coverage) {
+			// Mark the instruction and how we got to it.
+			gr8cpurev3_cov_t *cov = cpu->coverage;
+			cov->addrs[address] = 1;
+			cov->edges[(uint16_t) (cpu->covPrevPC * 0x9e37) ^ address] = 1;
+			cpu->covPrevPC = address;
+		}
 		break;
 	case(_I_ISALO):
 		cpu->regAR = cpu->bus | (cpu->regAR & 0xff00);
@@ -649,6 +738,10 @@ int gr8cpurev3_posttick(gr8cpurev3_t *cpu) {
 	cpu->numCycles ++;
 	if (cpu->schduledIRQ > 0) cpu->schduledIRQ --;
 	if (cpu->schduledNMI > 0) cpu->schduledNMI --;
+	if (cpu->numCycles >= cpu->eventCycle) {
+		// Let the peripherals catch up.
+		gr8cpu_mmio_event(cpu);
+	}
 	if ((ctrl & _C_STR) || (ctrl & _C_OMGWTF && (cpu->regIR & 0x80) == 0)) {
 		cpu->stage = 0;
 		cpu->flagHWI |= cpu->wasHWI;
@@ -669,6 +762,7 @@ int gr8cpurev3_posttick(gr8cpurev3_t *cpu) {
 			for (uint32_t i = 0; i < cpu->breakpointsLen; i++) {
 				if (cpu->regPC == cpu->breakpoints[i]) {
 					// Le breakpoint hit.
+					cpu->watchHit = 0;
 					return EXC_BRK;
 				}
 			}
@@ -681,6 +775,10 @@ int gr8cpurev3_posttick(gr8cpurev3_t *cpu) {
 		cpu->stage ++;
 		cpu->stage &= 0xf;
 	}
+	if (cpu->watchHit) {
+		cpu->watchHit = 0;
+		return EXC_WATCH;
+	}
 	return EXC_NORM;
 }
 
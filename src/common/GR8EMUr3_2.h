@@ -24,6 +24,7 @@ extern "C" {
 #define EXC_WAIT_STEP 5
 #define EXC_RESET 6
 #define EXC_TCON 7
+#define EXC_WATCH 8
 	
 #define _C_AIA 1 << 0
 #define _C_AIB 1 << 1
@@ -120,6 +121,24 @@ extern "C" {
 
 #define MAX_INSN_LEN 16
 
+#define COV_ROWS 4096
+
+// Windows of the address space that can be banked.
+#define BANK_WINDOWS 8
+#define BANK_SIZE 0x2000
+#define BANK_SHIFT 13
+
+// Coverage maps, set to 1 for everything that ran.
+// A byte per entry, so marking one is a single store.
+// Only maps, so processes running machines of their own can share them.
+struct gr8cpurev3_cov_t {
+	uint8_t addrs[65536];					// Instructions fetched, by address.
+	uint8_t edges[65536];					// Consecutive fetches, by hashed address pair.
+	uint8_t rows[COV_ROWS];					// Microcode rows, by ISA ROM address.
+};
+
+typedef struct gr8cpurev3_cov_t gr8cpurev3_cov_t;
+
 struct gr8cpurev3_t {
 	// ==== FLAGS ====
 	bool flagCout, flagZero;				// ALU output flags.
@@ -134,6 +153,7 @@ struct gr8cpurev3_t {
 	uint8_t stage, mode;					// Control unit state.
 	int64_t schduledIRQ;					// IRQ scheduled by number of cycles.
 	int64_t schduledNMI;					// NMI scheduled by number of cycles.
+	bool sleeping;							// Time passes without running anything until an interrupt is pending.
 	// ==== REGISTERS ====
 	uint8_t regA, regB, regX, regY, regIR;	// 8-bit registers.
 	uint16_t regPC, regAR, stackPtr;		// 16-bit registers.
@@ -143,6 +163,9 @@ struct gr8cpurev3_t {
 	uint16_t skipDepth;						// How deep in methods we are.
 	uint16_t *breakpoints;					// Breakpoints.
 	uint32_t breakpointsLen;				// Number of breakpoints.
+	uint16_t *watchpoints;					// Watchpoints, hit when written.
+	uint32_t watchpointsLen;				// Number of watchpoints.
+	bool watchHit;							// A watchpoint was written this cycle.
 	bool debugIRQ, debugNMI;				// Debugger interrupts.
 	// ==== INSTRUCTION SET ====
 	uint32_t *isaRom;						// Instruction set ROM.
@@ -151,6 +174,18 @@ struct gr8cpurev3_t {
 	uint8_t *ram;							// Must always be 65536 in size.
 	uint8_t *rom;							// Program ROM.
 	uint32_t romLen;						// Length of the ROM.
+	uint8_t *ramDirty;						// Optional, set to 1 per 256-byte page written.
+	// ==== BANKS ====
+	uint8_t banked;							// A bit per window that shows bankRead instead, except the MMIO page.
+	uint8_t *bankRead[BANK_WINDOWS];		// Memory banked windows are read from.
+	uint8_t *bankWrite[BANK_WINDOWS];		// Memory banked windows are written to, gr8cpu_mmio_bank is asked if NULL.
+	uint8_t *bankDirty[BANK_WINDOWS];		// Optional, set to 1 per 256-byte page written through the window.
+	// ==== COVERAGE ====
+	gr8cpurev3_cov_t *coverage;				// Optional, marks what ran.
+	uint16_t covPrevPC;						// Address of the last fetch, for coverage edges.
+	// ==== PERIPHERALS ====
+	void *mmioCtx;							// Passed along to the MMIO handlers.
+	uint64_t eventCycle;					// gr8cpu_mmio_event is called when numCycles reaches this.
 	// ==== STATISTICS ====
 	uint64_t numCycles;						// The number of emulated clock cycles.
 	uint64_t numInsns;						// The number of emulated instrucitons.
@@ -163,6 +198,10 @@ extern int gr8cpurev3_tick(gr8cpurev3_t *cpu, int maxTicks, int tickMode);
 extern int gr8cpurev3_pretick(gr8cpurev3_t *cpu);
 extern int gr8cpurev3_posttick(gr8cpurev3_t *cpu);
 extern uint8_t gr8cpurev3_readflags(gr8cpurev3_t *cpu);
+extern uint8_t gr8cpurev3_readmem(gr8cpurev3_t *cpu, uint16_t address, bool notouchy);
+extern void gr8cpurev3_dirtymem(gr8cpurev3_t *cpu, uint16_t address);
+extern void gr8cpurev3_storemem(gr8cpurev3_t *cpu, uint16_t address, uint8_t value);
+extern bool gr8cpurev3_asleep(gr8cpurev3_t *cpu);
 
 #ifdef __cplusplus
 }
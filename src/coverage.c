@@ -0,0 +1,163 @@
+
+#include "coverage.h"
+#include <string.h>
+#include <inttypes.h>
+
+const char *coverage_error = "";
+
+// Names a microcode row, as opcode.stage or mode.stage.
+static void row_name(char *buf, size_t len, int row) {
+	static const char *modes[] = { "exec", "load", "irq", "nmi" };
+	if (row & 0x800) {
+		snprintf(buf, len, "%s.%x", modes[(row >> 4) & 3], row & 0xf);
+	} else {
+		snprintf(buf, len, "%02x.%x", row >> 4, row & 0xf);
+	}
+}
+
+// Writes coverage to a file.
+bool coverage_save(gr8cpurev3_cov_t *cov, const char *path, uint64_t rom_hash) {
+	FILE *fd = fopen(path, "wb");
+	if (!fd) {
+		coverage_error = "could not open file";
+		return false;
+	}
+	fprintf(fd, "%s %d %016" PRIx64 "\n", COVERAGE_MAGIC, COVERAGE_VERSION, rom_hash);
+	fwrite(cov->addrs, 1, sizeof(cov->addrs), fd);
+	fwrite(cov->edges, 1, sizeof(cov->edges), fd);
+	fwrite(cov->rows,  1, sizeof(cov->rows),  fd);
+	if (ferror(fd) | fclose(fd)) {
+		coverage_error = "could not write file";
+		return false;
+	}
+	return true;
+}
+
+// Reads coverage from a file.
+bool coverage_load(gr8cpurev3_cov_t *cov, const char *path, uint64_t *rom_hash) {
+	FILE *fd = fopen(path, "rb");
+	if (!fd) {
+		coverage_error = "could not open file";
+		return false;
+	}
+	char magic[8];
+	int version;
+	if (fscanf(fd, "%7s %d %" SCNx64, magic, &version, rom_hash) != 3 || strcmp(magic, COVERAGE_MAGIC)
+			|| fgetc(fd) != '\n') {
+		coverage_error = "not a coverage file";
+		fclose(fd);
+		return false;
+	}
+	if (version != COVERAGE_VERSION) {
+		coverage_error = "unsupported version";
+		fclose(fd);
+		return false;
+	}
+	memset(cov, 0, sizeof(gr8cpurev3_cov_t));
+	bool ok = fread(cov->addrs, 1, sizeof(cov->addrs), fd) == sizeof(cov->addrs)
+			&& fread(cov->edges, 1, sizeof(cov->edges), fd) == sizeof(cov->edges)
+			&& fread(cov->rows,  1, sizeof(cov->rows),  fd) == sizeof(cov->rows);
+	fclose(fd);
+	if (!ok) coverage_error = "file is truncated";
+	return ok;
+}
+
+// Adds everything covered in src to dest.
+void coverage_merge(gr8cpurev3_cov_t *dest, const gr8cpurev3_cov_t *src) {
+	for (size_t i = 0; i < sizeof(dest->addrs); i++) dest->addrs[i] |= src->addrs[i];
+	for (size_t i = 0; i < sizeof(dest->edges); i++) dest->edges[i] |= src->edges[i];
+	for (size_t i = 0; i < sizeof(dest->rows);  i++) dest->rows[i]  |= src->rows[i];
+}
+
+// Counts what is covered: addresses, edges and microcode rows.
+void coverage_count(const gr8cpurev3_cov_t *cov, size_t counts[3]) {
+	counts[0] = counts[1] = counts[2] = 0;
+	for (size_t i = 0; i < sizeof(cov->addrs); i++) counts[0] += cov->addrs[i] != 0;
+	for (size_t i = 0; i < sizeof(cov->edges); i++) counts[1] += cov->edges[i] != 0;
+	for (size_t i = 0; i < sizeof(cov->rows);  i++) counts[2] += cov->rows[i]  != 0;
+}
+
+// Writes an lcov tracefile, with ROM addresses as lines from 1 and microcode rows
+// as a second source file. Only rows that exist in the ISA ROM are listed.
+void coverage_write_lcov(FILE *fd, const gr8cpurev3_cov_t *cov, const char *rom_name,
+		uint32_t rom_len, const uint32_t *isa, uint32_t isa_len) {
+	size_t hit = 0;
+	fprintf(fd, "TN:\nSF:%s\n", rom_name);
+	for (uint32_t i = 0; i < rom_len && i < sizeof(cov->addrs); i++) {
+		fprintf(fd, "DA:%u,%u\n", i + 1, cov->addrs[i] != 0);
+		hit += cov->addrs[i] != 0;
+	}
+	fprintf(fd, "LF:%u\nLH:%zu\nend_of_record\n", rom_len, hit);
+	// Microcode, as if it were source too.
+	size_t found = 0;
+	hit = 0;
+	fprintf(fd, "TN:\nSF:%s.isa\n", rom_name);
+	for (uint32_t i = 0; i < isa_len && i < COV_ROWS; i++) {
+		if (!isa[i]) continue;
+		fprintf(fd, "DA:%u,%u\n", i + 1, cov->rows[i] != 0);
+		found ++;
+		hit += cov->rows[i] != 0;
+	}
+	fprintf(fd, "LF:%zu\nLH:%zu\nend_of_record\n", found, hit);
+}
+
+// Writes a hex dump of the ROM with every executed address marked,
+// then every opcode with its microcode rows, # if covered and . if not.
+void coverage_write_hex(FILE *fd, const gr8cpurev3_cov_t *cov, const uint8_t *rom,
+		uint32_t rom_len, const uint32_t *isa, uint32_t isa_len) {
+	size_t counts[3];
+	coverage_count(cov, counts);
+	fprintf(fd, "; %zu addresses, %zu edges, %zu microcode rows covered\n", counts[0], counts[1], counts[2]);
+	fputs("; * marks the first byte of an executed instruction\n", fd);
+	for (uint32_t i = 0; i < rom_len; i += 16) {
+		fprintf(fd, "%04x ", i);
+		for (uint32_t j = i; j < i + 16 && j < rom_len; j++) {
+			fprintf(fd, " %02x%c", rom[j], cov->addrs[j] ? '*' : ' ');
+		}
+		fputc('\n', fd);
+	}
+	fputs("\n; microcode rows by stage\n", fd);
+	for (uint32_t base = 0; base < isa_len && base < COV_ROWS; base += 16) {
+		char name[16];
+		char rows[17];
+		size_t len = 0;
+		for (uint32_t i = base; i < base + 16 && i < isa_len; i++) {
+			rows[len ++] = !isa[i] ? ' ' : cov->rows[i] ? '#' : '.';
+		}
+		while (len && rows[len - 1] == ' ') len --;
+		if (!len) continue;
+		rows[len] = 0;
+		row_name(name, sizeof(name), base);
+		*strchr(name, '.') = 0;
+		fprintf(fd, "%-4s  %s\n", name, rows);
+	}
+}
+
+// Writes what is covered only in old (-) or only in new (+).
+// Returns false if there were no differences.
+bool coverage_write_diff(FILE *fd, const gr8cpurev3_cov_t *old, const gr8cpurev3_cov_t *new) {
+	bool differ = false;
+	for (size_t i = 0; i < sizeof(old->addrs); i++) {
+		if (!old->addrs[i] != !new->addrs[i]) {
+			fprintf(fd, "%c addr %04zx\n", new->addrs[i] ? '+' : '-', i);
+			differ = true;
+		}
+	}
+	for (size_t i = 0; i < sizeof(old->rows); i++) {
+		if (!old->rows[i] != !new->rows[i]) {
+			char name[16];
+			row_name(name, sizeof(name), i);
+			fprintf(fd, "%c row %s\n", new->rows[i] ? '+' : '-', name);
+			differ = true;
+		}
+	}
+	// Edges are hashed, so only how many changed means anything.
+	size_t added = 0, removed = 0;
+	for (size_t i = 0; i < sizeof(old->edges); i++) {
+		added   += !old->edges[i] && new->edges[i];
+		removed += old->edges[i] && !new->edges[i];
+	}
+	if (added)   fprintf(fd, "+ %zu edges\n", added);
+	if (removed) fprintf(fd, "- %zu edges\n", removed);
+	return differ || added || removed;
+}
@@ -0,0 +1,48 @@
+
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "common/GR8EMUr3_2.h"
+
+#define COVERAGE_MAGIC   "GR8COV"
+#define COVERAGE_VERSION 1
+
+/*
+
+Coverage files have a text header, then the maps of gr8cpurev3_cov_t as they are:
+	GR8COV <version> <ROM hash>
+	<65536 bytes of addresses><65536 bytes of edges><COV_ROWS bytes of rows>
+
+Only files of the same ROM can be merged or compared.
+
+*/
+
+// Why the last coverage file could not be read or written.
+extern const char *coverage_error;
+
+// Writes coverage to a file.
+bool coverage_save(gr8cpurev3_cov_t *cov, const char *path, uint64_t rom_hash);
+// Reads coverage from a file.
+bool coverage_load(gr8cpurev3_cov_t *cov, const char *path, uint64_t *rom_hash);
+// Adds everything covered in src to dest.
+void coverage_merge(gr8cpurev3_cov_t *dest, const gr8cpurev3_cov_t *src);
+// Counts what is covered: addresses, edges and microcode rows.
+void coverage_count(const gr8cpurev3_cov_t *cov, size_t counts[3]);
+
+// Writes an lcov tracefile, with ROM addresses as lines from 1 and microcode rows
+// as a second source file. Only rows that exist in the ISA ROM are listed.
+void coverage_write_lcov(FILE *fd, const gr8cpurev3_cov_t *cov, const char *rom_name,
+		uint32_t rom_len, const uint32_t *isa, uint32_t isa_len);
+// Writes a hex dump of the ROM with every executed address marked,
+// then every opcode with its microcode rows, # if covered and . if not.
+void coverage_write_hex(FILE *fd, const gr8cpurev3_cov_t *cov, const uint8_t *rom,
+		uint32_t rom_len, const uint32_t *isa, uint32_t isa_len);
+// Writes what is covered only in old (-) or only in new (+).
+// Returns false if there were no differences.
+bool coverage_write_diff(FILE *fd, const gr8cpurev3_cov_t *old, const gr8cpurev3_cov_t *new);
+
+#endif //COVERAGE_H
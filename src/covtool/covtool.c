@@ -0,0 +1,104 @@
+
+#include "../coverage.h"
+#include "../snapshot.h"
+#include "../common/default_isa.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static gr8cpurev3_cov_t cov, other;
+
+static bool load(const char *path, gr8cpurev3_cov_t *into, uint64_t *rom_hash) {
+	if (!coverage_load(into, path, rom_hash)) {
+		fprintf(stderr, "Could not read '%s': %s\n", path, coverage_error);
+		return false;
+	}
+	return true;
+}
+
+// Reads a ROM, which must be the one the coverage is of.
+static uint8_t *load_rom(const char *path, uint64_t rom_hash, uint32_t *len) {
+	FILE *fd = fopen(path, "rb");
+	uint8_t *rom = malloc(65536);
+	if (!fd || !rom) {
+		fprintf(stderr, "Could not read '%s'\n", path);
+		if (fd) fclose(fd);
+		free(rom);
+		return NULL;
+	}
+	*len = fread(rom, 1, 65536, fd);
+	fclose(fd);
+	if (hash_bytes(0xcbf29ce484222325, rom, *len) != rom_hash) {
+		fprintf(stderr, "Coverage is not of '%s'\n", path);
+		free(rom);
+		return NULL;
+	}
+	return rom;
+}
+
+static int usage(char *self) {
+	printf("%s merge out in...\n", self);
+	printf("                Combine coverage of the same ROM into out.\n\n");
+	printf("%s lcov coverage rom\n", self);
+	printf("                Write an lcov tracefile to stdout, with ROM addresses as\n");
+	printf("                line numbers from 1 and microcode rows in rom.isa.\n\n");
+	printf("%s hex coverage rom\n", self);
+	printf("                Write a hex dump of rom with executed addresses marked, and\n");
+	printf("                which microcode rows of every opcode ran.\n\n");
+	printf("%s diff old new\n", self);
+	printf("                Write what only one of them covers, exits with 1 if anything.\n\n");
+	printf("%s info coverage...\n", self);
+	printf("                Count what is covered.\n");
+	return 2;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3) return usage(*argv);
+	char *cmd = argv[1];
+	uint64_t rom_hash, other_hash;
+	if (!strcmp(cmd, "merge") && argc >= 4) {
+		if (!load(argv[3], &cov, &rom_hash)) return 2;
+		for (int i = 4; i < argc; i++) {
+			if (!load(argv[i], &other, &other_hash)) return 2;
+			if (other_hash != rom_hash) {
+				fprintf(stderr, "'%s' is of a different ROM than '%s'\n", argv[i], argv[3]);
+				return 2;
+			}
+			coverage_merge(&cov, &other);
+		}
+		if (!coverage_save(&cov, argv[2], rom_hash)) {
+			fprintf(stderr, "Could not write '%s': %s\n", argv[2], coverage_error);
+			return 2;
+		}
+		return 0;
+	} else if ((!strcmp(cmd, "lcov") || !strcmp(cmd, "hex")) && argc == 4) {
+		uint32_t rom_len;
+		if (!load(argv[2], &cov, &rom_hash)) return 2;
+		uint8_t *rom = load_rom(argv[3], rom_hash, &rom_len);
+		if (!rom) return 2;
+		if (*cmd == 'l') {
+			coverage_write_lcov(stdout, &cov, argv[3], rom_len, default_isa_rom, DEFAULT_ISA_ROM_LEN);
+		} else {
+			coverage_write_hex(stdout, &cov, rom, rom_len, default_isa_rom, DEFAULT_ISA_ROM_LEN);
+		}
+		free(rom);
+		return 0;
+	} else if (!strcmp(cmd, "diff") && argc == 4) {
+		if (!load(argv[2], &cov, &rom_hash) || !load(argv[3], &other, &other_hash)) return 2;
+		if (other_hash != rom_hash) {
+			fprintf(stderr, "'%s' is of a different ROM than '%s'\n", argv[3], argv[2]);
+			return 2;
+		}
+		return coverage_write_diff(stdout, &cov, &other);
+	} else if (!strcmp(cmd, "info")) {
+		for (int i = 2; i < argc; i++) {
+			size_t counts[3];
+			if (!load(argv[i], &cov, &rom_hash)) return 2;
+			coverage_count(&cov, counts);
+			printf("%s: rom %016lx, %zu addresses, %zu edges, %zu microcode rows\n",
+					argv[i], rom_hash, counts[0], counts[1], counts[2]);
+		}
+		return 0;
+	}
+	return usage(*argv);
+}
@@ -0,0 +1,157 @@
+
+#include "dev_disk.h"
+#include <string.h>
+
+static uint8_t disk_status(device_t *dev) {
+	dev_disk_t *state = dev->state;
+	disk_t *disk = dev->ctx;
+	return state->status
+		| (!disk ? DISK_STATUS_NO_DISK : 0)
+		| (disk && disk_read_only(disk) ? DISK_STATUS_READ_ONLY : 0);
+}
+
+static uint8_t disk_read(device_t *dev, uint16_t address, bool notouchy) {
+	dev_disk_t *state = dev->state;
+	switch (address) {
+		case DISK_SECTOR_LO:
+			return state->sector & 0xff;
+		case DISK_SECTOR_HI:
+			return state->sector >> 8;
+		case DISK_DMA_LO:
+			return state->dma & 0xff;
+		case DISK_DMA_HI:
+			return state->dma >> 8;
+		case DISK_OFFSET:
+			return state->offset;
+		case DISK_DATA: {
+			uint8_t *data = disk_sector(dev->ctx, state->sector, false);
+			if (notouchy) return data ? data[state->offset] : 0;
+			if (!data) {
+				state->status |= DISK_STATUS_ERROR;
+				return 0;
+			}
+			return data[state->offset ++];
+		}
+		case DISK_CMD:
+			return state->cmd;
+		case DISK_CTRL:
+			return state->ctrl;
+		case DISK_STATUS: {
+			uint8_t status = disk_status(dev);
+			if (!notouchy) state->status &= ~DISK_STATUS_DONE;
+			return status;
+		}
+	}
+	return 0;
+}
+
+static void disk_write(device_t *dev, uint16_t address, uint8_t value) {
+	dev_disk_t *state = dev->state;
+	switch (address) {
+		case DISK_SECTOR_LO:
+			state->sector = (state->sector & 0xff00) | value;
+			break;
+		case DISK_SECTOR_HI:
+			state->sector = (state->sector & 0x00ff) | (value << 8);
+			break;
+		case DISK_DMA_LO:
+			state->dma = (state->dma & 0xff00) | value;
+			break;
+		case DISK_DMA_HI:
+			state->dma = (state->dma & 0x00ff) | (value << 8);
+			break;
+		case DISK_OFFSET:
+			state->offset = value;
+			break;
+		case DISK_DATA: {
+			uint8_t *data = disk_sector(dev->ctx, state->sector, true);
+			if (data) {
+				data[state->offset ++] = value;
+			} else {
+				state->status |= DISK_STATUS_ERROR;
+			}
+		} break;
+		case DISK_CMD:
+			// One at a time.
+			if (state->status & DISK_STATUS_BUSY) break;
+			state->cmd    = value;
+			state->status = DISK_STATUS_BUSY;
+			device_restart(dev);
+			break;
+		case DISK_CTRL:
+			state->ctrl = value;
+			break;
+	}
+}
+
+static void disk_reset(device_t *dev) {
+	memset(dev->state, 0, sizeof(dev_disk_t));
+}
+
+// Carries out a command.
+// Returns false if it failed.
+static bool disk_execute(device_t *dev) {
+	dev_disk_t *state = dev->state;
+	gr8cpurev3_t *cpu = dev->bus->cpu;
+	disk_t *disk = dev->ctx;
+	uint8_t *data;
+	switch (state->cmd) {
+		case DISK_CMD_READ:
+			if (!(data = disk_sector(disk, state->sector, false))) return false;
+			for (int i = 0; i < DISK_SECTOR; i++) {
+				uint16_t address = state->dma + i;
+				// Nothing to DMA to in the MMIO page.
+				if ((address & 0xFF00) == MMIO_PAGE) continue;
+				// Through the MMU's windows, like the CPU's own writes.
+				gr8cpurev3_storemem(cpu, address, data[i]);
+			}
+			return true;
+		case DISK_CMD_WRITE:
+			if (!(data = disk_sector(disk, state->sector, true))) return false;
+			for (int i = 0; i < DISK_SECTOR; i++) {
+				data[i] = gr8cpurev3_readmem(cpu, state->dma + i, true);
+			}
+			return true;
+		case DISK_CMD_FLUSH:
+			if (!disk) return false;
+			disk_flush(disk, false);
+			return true;
+	}
+	return false;
+}
+
+static void disk_run(device_t *dev) {
+	dev_disk_t *state = dev->state;
+	disk_t *disk = dev->ctx;
+	DEV_BEGIN(dev);
+	if (state->cmd) {
+		if (disk && disk->latency) {
+			DEV_WAIT_CYCLES(dev, disk->latency);
+		}
+		state->status = disk_execute(dev) ? DISK_STATUS_DONE : DISK_STATUS_DONE | DISK_STATUS_ERROR;
+		state->cmd    = 0;
+		if (state->ctrl & DISK_CTRL_IRQ) {
+			device_raise_irq(dev);
+		}
+	}
+	DEV_END(dev);
+}
+
+// Initialises a disk device with no disk in it.
+void dev_disk_init(device_t *dev, dev_disk_t *state) {
+	memset(dev, 0, sizeof(device_t));
+	dev->name      = "disk";
+	dev->base      = DISK_BASE;
+	dev->len       = DISK_LEN;
+	dev->read      = disk_read;
+	dev->write     = disk_write;
+	dev->reset     = disk_reset;
+	dev->run       = disk_run;
+	dev->state     = state;
+	dev->state_len = sizeof(dev_disk_t);
+}
+
+// Puts a disk in the device, or takes it out if NULL.
+void dev_disk_insert(device_t *dev, disk_t *disk) {
+	dev->ctx = disk;
+}
@@ -0,0 +1,62 @@
+
+#ifndef DEV_DISK_H
+#define DEV_DISK_H
+
+#include <stdint.h>
+#include "devices.h"
+#include "disk.h"
+
+// Registers.
+#define DISK_BASE      0xFEE0
+#define DISK_LEN       9
+#define DISK_SECTOR_LO 0xFEE0
+#define DISK_SECTOR_HI 0xFEE1
+#define DISK_DMA_LO    0xFEE2 // RAM address for DMA commands.
+#define DISK_DMA_HI    0xFEE3
+#define DISK_OFFSET    0xFEE4 // Position of the data port in the sector.
+#define DISK_DATA      0xFEE5 // Reads or writes the sector at the offset, then increments it.
+#define DISK_CMD       0xFEE6
+#define DISK_CTRL      0xFEE7
+#define DISK_STATUS    0xFEE8
+
+// Commands, written to DISK_CMD.
+#define DISK_CMD_READ  0x01 // Copy the sector to RAM at the DMA address.
+#define DISK_CMD_WRITE 0x02 // Copy RAM at the DMA address to the sector.
+#define DISK_CMD_FLUSH 0x03 // Start writing changed sectors back to the image.
+
+// Control bits.
+#define DISK_CTRL_IRQ  0x01 // Raise an IRQ when a command is done.
+
+// Status bits.
+#define DISK_STATUS_BUSY      0x01 // A command is running.
+#define DISK_STATUS_DONE      0x02 // A command finished, cleared by reading.
+#define DISK_STATUS_ERROR     0x04 // The last command or data access failed.
+#define DISK_STATUS_NO_DISK   0x08
+#define DISK_STATUS_READ_ONLY 0x10
+
+/*
+
+The data port works on the image or its overlay directly, so it costs no copying.
+Commands take disk->latency cycles, and the data port keeps working meanwhile.
+DMA sees memory the way the CPU does, through whatever the MMU's windows show.
+Disk contents are not part of the machine state: snapshots and save states leave
+them alone. Going back in the debugger undoes the disk's writes too, so running
+forwards again finds it as it was.
+
+*/
+
+typedef struct dev_disk {
+	uint16_t sector;
+	uint16_t dma;
+	uint8_t  offset;
+	uint8_t  cmd;       // Running command, or 0.
+	uint8_t  ctrl;
+	uint8_t  status;
+} dev_disk_t;
+
+// Initialises a disk device with no disk in it.
+void dev_disk_init(device_t *dev, dev_disk_t *state);
+// Puts a disk in the device, or takes it out if NULL.
+void dev_disk_insert(device_t *dev, disk_t *disk);
+
+#endif //DEV_DISK_H
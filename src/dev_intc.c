@@ -0,0 +1,65 @@
+
+#include "dev_intc.h"
+#include <string.h>
+
+// Interrupts the CPU if an enabled source is pending.
+static void intc_update(device_t *dev) {
+	dev_intc_t *intc = dev->state;
+	if (intc->status & intc->enable) device_raise_cpu_irq(dev);
+}
+
+static uint8_t intc_read(device_t *dev, uint16_t address, bool notouchy) {
+	dev_intc_t *intc = dev->state;
+	switch (address) {
+		case INTC_STATUS:
+			return intc->status;
+		case INTC_ENABLE:
+			return intc->enable;
+	}
+	return 0;
+}
+
+static void intc_write(device_t *dev, uint16_t address, uint8_t value) {
+	dev_intc_t *intc = dev->state;
+	switch (address) {
+		case INTC_STATUS:
+			intc->status &= ~value;
+			intc_update(dev);
+			break;
+		case INTC_ENABLE:
+			intc->enable = value;
+			intc_update(dev);
+			break;
+		case INTC_SLEEP:
+			dev->bus->cpu->sleeping = true;
+			break;
+	}
+}
+
+static void intc_route(device_t *dev, device_t *from) {
+	dev_intc_t *intc = dev->state;
+	intc->status |= from->irq;
+	// Every IRQ counts, even if the last one wasn't acknowledged.
+	if (intc->enable & from->irq) device_raise_cpu_irq(dev);
+}
+
+static void intc_reset(device_t *dev) {
+	dev_intc_t *intc = dev->state;
+	intc->status = 0;
+	intc->enable = INTC_DEFAULT;
+}
+
+// Initialises an interrupt controller, which takes IRQs of devices with irq bits on its bus.
+void dev_intc_init(device_t *dev, dev_intc_t *intc) {
+	memset(dev, 0, sizeof(device_t));
+	memset(intc, 0, sizeof(dev_intc_t));
+	dev->name      = "intc";
+	dev->base      = INTC_BASE;
+	dev->len       = INTC_LEN;
+	dev->read      = intc_read;
+	dev->write     = intc_write;
+	dev->reset     = intc_reset;
+	dev->route     = intc_route;
+	dev->state     = intc;
+	dev->state_len = sizeof(dev_intc_t);
+}
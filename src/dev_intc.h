@@ -0,0 +1,52 @@
+
+#ifndef DEV_INTC_H
+#define DEV_INTC_H
+
+#include <stdint.h>
+#include "devices.h"
+
+// Registers.
+#define INTC_BASE   0xFE98
+#define INTC_LEN    3
+#define INTC_STATUS 0xFE98 // Sources that raised an IRQ, writing 1s acknowledges them.
+#define INTC_ENABLE 0xFE99 // Sources that may interrupt the CPU.
+#define INTC_SLEEP  0xFE9A // Writing sleeps until an interrupt is pending.
+
+// Sources.
+#define INTC_KEYB    0x01 // A character was typed.
+#define INTC_CONSOLE 0x02 // The console took all output.
+#define INTC_TIMER   0x04
+#define INTC_UART    0x08
+#define INTC_DISK    0x10
+
+// Enabled after reset, these have their own enable bits.
+#define INTC_DEFAULT (INTC_TIMER | INTC_UART | INTC_DISK)
+
+/*
+
+Every time a source raises an IRQ its status bit is set, and the CPU is
+interrupted if the source is enabled. A handler finds out why from INTC_STATUS
+and acknowledges what it has handled; if enabled sources are still pending then,
+the CPU is interrupted again. Enabling a source that is pending interrupts too.
+
+Writing INTC_SLEEP makes the CPU sleep once the instruction is done: no
+instructions run, and time passes as fast as the host can skip it, until an
+interrupt is pending. With IRQs disabled it wakes up all the same and carries on
+after the write, without taking the interrupt.
+	        MOV A, 1
+	        MOV [$fe99], A      ; enable the keyboard
+	        EI
+	idle:   MOV [$fe9a], A      ; sleep, the handler does the work
+	        JMP idle
+
+*/
+
+typedef struct dev_intc {
+	uint8_t status;
+	uint8_t enable;
+} dev_intc_t;
+
+// Initialises an interrupt controller, which takes IRQs of devices with irq bits on its bus.
+void dev_intc_init(device_t *dev, dev_intc_t *intc);
+
+#endif //DEV_INTC_H
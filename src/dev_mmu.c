@@ -0,0 +1,131 @@
+
+#include "dev_mmu.h"
+#include <stdlib.h>
+#include <string.h>
+
+// What unwritten RAM banks and ROM banks past the image read as.
+static const uint8_t zero_bank[BANK_SIZE];
+
+// Finds a bank of the ROM image.
+static uint8_t *mmu_rom_bank(mmu_banks_t *banks, size_t bank) {
+	size_t offset = bank * BANK_SIZE;
+	if (offset >= banks->rom_len) {
+		return (uint8_t *) zero_bank;
+	} else if (offset + BANK_SIZE <= banks->rom_len) {
+		return (uint8_t *) banks->rom + offset;
+	}
+	// Reading past the end of the image could run off its mapping, so the end is padded.
+	if (!banks->rom_tail) {
+		banks->rom_tail = calloc(1, BANK_SIZE);
+		if (!banks->rom_tail) return (uint8_t *) zero_bank;
+		memcpy(banks->rom_tail, banks->rom + offset, banks->rom_len - offset);
+	}
+	return banks->rom_tail;
+}
+
+// Points the CPU at what the windows show.
+static void mmu_update(device_t *dev) {
+	dev_mmu_t *mmu = dev->state;
+	mmu_banks_t *banks = dev->ctx;
+	gr8cpurev3_t *cpu = dev->bus->cpu;
+	cpu->banked = 0;
+	for (int i = 0; i < BANK_WINDOWS; i++) {
+		uint8_t bank = mmu->window[i];
+		if (!bank) {
+			cpu->bankRead[i]  = NULL;
+			cpu->bankWrite[i] = NULL;
+			cpu->bankDirty[i] = NULL;
+			continue;
+		}
+		cpu->banked |= 1 << i;
+		if (bank >= MMU_ROM) {
+			cpu->bankRead[i]  = mmu_rom_bank(banks, bank - MMU_ROM);
+			cpu->bankWrite[i] = NULL;
+			cpu->bankDirty[i] = NULL;
+		} else {
+			cpu->bankRead[i]  = banks->ram[bank] ? banks->ram[bank] : (uint8_t *) zero_bank;
+			cpu->bankWrite[i] = banks->ram[bank];
+			cpu->bankDirty[i] = banks->dirty[bank];
+		}
+	}
+}
+
+static uint8_t mmu_read(device_t *dev, uint16_t address, bool notouchy) {
+	dev_mmu_t *mmu = dev->state;
+	return mmu->window[address - MMU_WINDOW];
+}
+
+static void mmu_write(device_t *dev, uint16_t address, uint8_t value) {
+	dev_mmu_t *mmu = dev->state;
+	mmu->window[address - MMU_WINDOW] = value;
+	mmu_update(dev);
+}
+
+static void mmu_reset(device_t *dev) {
+	memset(dev->state, 0, sizeof(dev_mmu_t));
+	dev_mmu_free(dev);
+	mmu_update(dev);
+}
+
+// Initialises an MMU with all windows showing the machine's own memory.
+void dev_mmu_init(device_t *dev, dev_mmu_t *mmu, mmu_banks_t *banks) {
+	memset(dev, 0, sizeof(device_t));
+	memset(mmu, 0, sizeof(dev_mmu_t));
+	memset(banks, 0, sizeof(mmu_banks_t));
+	dev->name      = "mmu";
+	dev->base      = MMU_BASE;
+	dev->len       = MMU_LEN;
+	dev->read      = mmu_read;
+	dev->write     = mmu_write;
+	dev->reset     = mmu_reset;
+	dev->load      = mmu_update;
+	dev->ctx       = banks;
+	dev->state     = mmu;
+	dev->state_len = sizeof(dev_mmu_t);
+}
+
+// Sets the image ROM banks come from.
+void dev_mmu_rom(device_t *dev, const uint8_t *rom, size_t len) {
+	mmu_banks_t *banks = dev->ctx;
+	free(banks->rom_tail);
+	banks->rom_tail = NULL;
+	banks->rom      = rom;
+	banks->rom_len  = len;
+	if (dev->bus) mmu_update(dev);
+}
+
+// Finds where a write to a banked window goes, allocating RAM banks as needed.
+// Returns NULL if the window shows ROM.
+uint8_t *dev_mmu_fault(device_t *dev, uint16_t address) {
+	dev_mmu_t *mmu = dev->state;
+	mmu_banks_t *banks = dev->ctx;
+	uint8_t bank = mmu->window[address >> BANK_SHIFT];
+	if (!bank || bank >= MMU_ROM) return NULL;
+	if (!banks->ram[bank]) {
+		banks->ram[bank] = calloc(1, BANK_SIZE);
+		if (!banks->ram[bank]) return NULL;
+		// Snapshots taken before may have had different contents.
+		memset(banks->dirty[bank], 1, MMU_BANK_PAGES);
+		// Other windows may show the same bank.
+		mmu_update(dev);
+	}
+	return banks->ram[bank];
+}
+
+// Finds the banks of the MMU on a bus.
+// Returns NULL if there is no MMU.
+mmu_banks_t *dev_mmu_banks(devbus_t *bus) {
+	device_t *dev = bus->map[MMU_WINDOW & 0xFF];
+	return dev && dev->read == mmu_read ? dev->ctx : NULL;
+}
+
+// Frees the banks allocated so far, RAM banks read as zeroes again.
+void dev_mmu_free(device_t *dev) {
+	mmu_banks_t *banks = dev->ctx;
+	for (int i = 1; i <= MMU_RAM_BANKS; i++) {
+		free(banks->ram[i]);
+		banks->ram[i] = NULL;
+	}
+	free(banks->rom_tail);
+	banks->rom_tail = NULL;
+}
@@ -0,0 +1,72 @@
+
+#ifndef DEV_MMU_H
+#define DEV_MMU_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "devices.h"
+
+// Registers.
+#define MMU_BASE    0xFE90
+#define MMU_LEN     BANK_WINDOWS
+#define MMU_WINDOW  0xFE90 // Bank of each window, the first one is at 0000.
+
+// Banks.
+#define MMU_RAM_BANKS 127       // Banks 1 to 127 are RAM.
+#define MMU_ROM       0x80      // Banks from here on are the ROM image, 8 KiB each.
+#define MMU_ROM_MAX   (128 * BANK_SIZE)
+// ROM always there when the image is too big for the address space.
+#define MMU_ROM_FIXED 0x8000
+// 256-byte pages in a bank, as tracked for snapshots.
+#define MMU_BANK_PAGES (BANK_SIZE / 256)
+
+/*
+
+The address space is split into BANK_WINDOWS windows of BANK_SIZE bytes, and
+each window has a register saying what it shows:
+	00          The machine's own ROM and RAM, as if there was no MMU.
+	01 to 7f    A bank of RAM.
+	80 to ff    A bank of the ROM image, 80 being its first 8 KiB.
+Several windows may show the same bank. The MMIO page always shows the devices,
+whatever window 7 is set to. Writes to ROM banks are dropped.
+
+ROM images up to MMU_ROM_MAX bytes can be loaded, of which the first
+MMU_ROM_FIXED are always in place when the image doesn't fit below the MMIO page.
+The rest is only seen through the MMU. ROM banks are read straight from the
+image, so machines running the same one share them.
+
+RAM banks take no memory until they are first written, until then they read as
+zeroes. They are freed on reset. Their contents are part of the machine state:
+snapshots keep the pages of each bank like those of RAM, copying only the ones
+written since the last snapshot, and save states store every bank in use.
+
+*/
+
+typedef struct dev_mmu {
+	uint8_t window[BANK_WINDOWS];
+} dev_mmu_t;
+
+// Memory behind the banks.
+typedef struct mmu_banks {
+	uint8_t       *ram[MMU_RAM_BANKS + 1];  // NULL until written, 0 is not used.
+	uint8_t        dirty[MMU_RAM_BANKS + 1][MMU_BANK_PAGES];    // Pages written since the last snapshot.
+	const uint8_t *rom;                     // Image the ROM banks are in.
+	size_t         rom_len;
+	uint8_t       *rom_tail;                // Last ROM bank, if the image ends inside it.
+} mmu_banks_t;
+
+// Initialises an MMU with all windows showing the machine's own memory.
+void dev_mmu_init(device_t *dev, dev_mmu_t *mmu, mmu_banks_t *banks);
+// Sets the image ROM banks come from.
+void dev_mmu_rom(device_t *dev, const uint8_t *rom, size_t len);
+// Finds where a write to a banked window goes, allocating RAM banks as needed.
+// Returns NULL if the window shows ROM.
+uint8_t *dev_mmu_fault(device_t *dev, uint16_t address);
+// Finds the banks of the MMU on a bus.
+// Returns NULL if there is no MMU.
+mmu_banks_t *dev_mmu_banks(devbus_t *bus);
+// Frees the banks allocated so far, RAM banks read as zeroes again.
+void dev_mmu_free(device_t *dev);
+
+#endif //DEV_MMU_H
@@ -0,0 +1,83 @@
+
+#include "dev_perf.h"
+#include <time.h>
+#include <string.h>
+
+static uint64_t perf_nanos() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static uint8_t perf_read(device_t *dev, uint16_t address, bool notouchy) {
+	dev_perf_t *perf = dev->state;
+	if (address >= PERF_CYCLES && address < PERF_CYCLES + 4) {
+		return perf->cycles >> (address - PERF_CYCLES) * 8;
+	} else if (address >= PERF_INSNS && address < PERF_INSNS + 4) {
+		return perf->insns >> (address - PERF_INSNS) * 8;
+	}
+	return 0;
+}
+
+static void perf_write(device_t *dev, uint16_t address, uint8_t value) {
+	dev_perf_t *perf = dev->state;
+	perf_regions_t *regions = dev->ctx;
+	gr8cpurev3_t *cpu = dev->bus->cpu;
+	perf_region_t *region = &regions->region[value];
+	switch (address) {
+		case PERF_LATCH:
+			perf->cycles = cpu->numCycles;
+			perf->insns  = cpu->numInsns;
+			break;
+		case PERF_BEGIN:
+			if (regions->mute && *regions->mute) break;
+			region->begun       = true;
+			region->begin_cycle = cpu->numCycles;
+			region->begin_insn  = cpu->numInsns;
+			region->begin_nanos = perf_nanos();
+			break;
+		case PERF_END:
+			if (regions->mute && *regions->mute) break;
+			if (!region->begun) break;
+			region->begun   = false;
+			if (cpu->numCycles < region->begin_cycle || cpu->numInsns < region->begin_insn) break;
+			region->count  ++;
+			region->cycles += cpu->numCycles - region->begin_cycle;
+			region->insns  += cpu->numInsns - region->begin_insn;
+			region->nanos  += perf_nanos() - region->begin_nanos;
+			regions->used   = true;
+			break;
+	}
+}
+
+// Ends every region without counting it.
+static void perf_forget(perf_regions_t *regions) {
+	for (int i = 0; i < PERF_REGIONS; i++) {
+		regions->region[i].begun = false;
+	}
+}
+
+static void perf_reset(device_t *dev) {
+	memset(dev->state, 0, sizeof(dev_perf_t));
+	perf_forget(dev->ctx);
+}
+
+static void perf_load(device_t *dev) {
+	perf_forget(dev->ctx);
+}
+
+// Initialises a performance counter device, measuring regions into regions.
+void dev_perf_init(device_t *dev, dev_perf_t *perf, perf_regions_t *regions) {
+	memset(dev, 0, sizeof(device_t));
+	memset(regions, 0, sizeof(perf_regions_t));
+	dev->name      = "perf";
+	dev->base      = PERF_BASE;
+	dev->len       = PERF_LEN;
+	dev->read      = perf_read;
+	dev->write     = perf_write;
+	dev->reset     = perf_reset;
+	dev->load      = perf_load;
+	dev->ctx       = regions;
+	dev->state     = perf;
+	dev->state_len = sizeof(dev_perf_t);
+}
@@ -0,0 +1,63 @@
+
+#ifndef DEV_PERF_H
+#define DEV_PERF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "devices.h"
+
+// Registers.
+#define PERF_BASE   0xFEA0
+#define PERF_LEN    11
+#define PERF_LATCH  0xFEA0 // Writing copies the counters to the count registers.
+#define PERF_CYCLES 0xFEA1 // Cycles, 32 bits starting at the lowest byte.
+#define PERF_INSNS  0xFEA5 // Instructions, likewise.
+#define PERF_BEGIN  0xFEA9 // Writing a region number starts measuring it.
+#define PERF_END    0xFEAA // Writing a region number stops measuring it.
+
+// Number of regions.
+#define PERF_REGIONS 256
+
+/*
+
+Latching makes the four bytes of a count belong together, without it the low
+byte would be stale by the time the high byte is read. The latched counts are the
+CPU's own, so they are the same on every run.
+
+Regions are measured by the host: every time the guest ends one, the cycles,
+instructions and host time since it began are added to its totals. Beginning a
+region that's already begun starts it over, and ending one that isn't begun does
+nothing. The totals are not part of the machine state, and they survive resets.
+Loading a state ends every region without counting it, since the cycles it began
+at may be in the future now. While mute is set, as when re-executing history,
+regions are neither begun nor ended, so nothing is counted twice.
+
+*/
+
+typedef struct dev_perf {
+	uint32_t cycles;    // Latched.
+	uint32_t insns;     // Latched.
+} dev_perf_t;
+
+// Totals of a region, and where it began if it is begun.
+typedef struct perf_region {
+	uint64_t count;
+	uint64_t cycles;
+	uint64_t insns;
+	uint64_t nanos;
+	bool     begun;
+	uint64_t begin_cycle;
+	uint64_t begin_insn;
+	uint64_t begin_nanos;
+} perf_region_t;
+
+typedef struct perf_regions {
+	perf_region_t region[PERF_REGIONS];
+	bool          used;                 // Set once any region ended.
+	const bool   *mute;                 // Optional, regions are left alone while it's true.
+} perf_regions_t;
+
+// Initialises a performance counter device, measuring regions into regions.
+void dev_perf_init(device_t *dev, dev_perf_t *perf, perf_regions_t *regions);
+
+#endif //DEV_PERF_H
@@ -0,0 +1,72 @@
+
+#include "dev_timer.h"
+#include <string.h>
+
+static uint8_t timer_read(device_t *dev, uint16_t address, bool notouchy) {
+	dev_timer_t *timer = dev->state;
+	switch (address) {
+		case TIMER_PERIOD_LO:
+			return timer->period & 0xff;
+		case TIMER_PERIOD_HI:
+			return timer->period >> 8;
+		case TIMER_CTRL:
+			return timer->ctrl;
+		case TIMER_STATUS: {
+			uint8_t status = timer->status;
+			if (!notouchy) timer->status = 0;
+			return status;
+		}
+	}
+	return 0;
+}
+
+static void timer_write(device_t *dev, uint16_t address, uint8_t value) {
+	dev_timer_t *timer = dev->state;
+	switch (address) {
+		case TIMER_PERIOD_LO:
+			timer->period = (timer->period & 0xff00) | value;
+			break;
+		case TIMER_PERIOD_HI:
+			timer->period = (timer->period & 0x00ff) | (value << 8);
+			break;
+		case TIMER_CTRL:
+			// Start counting from here.
+			timer->ctrl = value;
+			device_restart(dev);
+			break;
+	}
+}
+
+static void timer_reset(device_t *dev) {
+	memset(dev->state, 0, sizeof(dev_timer_t));
+}
+
+static void timer_run(device_t *dev) {
+	dev_timer_t *timer = dev->state;
+	DEV_BEGIN(dev);
+	while (timer->ctrl & TIMER_CTRL_RUN) {
+		DEV_WAIT_CYCLES(dev, timer->period ? timer->period : 65536);
+		timer->status |= TIMER_STATUS_EXPIRED;
+		if (timer->ctrl & TIMER_CTRL_IRQ) {
+			device_raise_irq(dev);
+		}
+		if (!(timer->ctrl & TIMER_CTRL_REPEAT)) {
+			timer->ctrl &= ~TIMER_CTRL_RUN;
+		}
+	}
+	DEV_END(dev);
+}
+
+// Initialises a timer device; writing TIMER_CTRL (re)starts it.
+void dev_timer_init(device_t *dev, dev_timer_t *timer) {
+	memset(dev, 0, sizeof(device_t));
+	dev->name      = "timer";
+	dev->base      = TIMER_BASE;
+	dev->len       = TIMER_LEN;
+	dev->read      = timer_read;
+	dev->write     = timer_write;
+	dev->reset     = timer_reset;
+	dev->run       = timer_run;
+	dev->state     = timer;
+	dev->state_len = sizeof(dev_timer_t);
+}
@@ -0,0 +1,33 @@
+
+#ifndef DEV_TIMER_H
+#define DEV_TIMER_H
+
+#include <stdint.h>
+#include "devices.h"
+
+// Registers.
+#define TIMER_BASE      0xFEF0
+#define TIMER_LEN       4
+#define TIMER_PERIOD_LO 0xFEF0
+#define TIMER_PERIOD_HI 0xFEF1
+#define TIMER_CTRL      0xFEF2
+#define TIMER_STATUS    0xFEF3
+
+// Control bits.
+#define TIMER_CTRL_RUN    0x01 // Count down the period.
+#define TIMER_CTRL_IRQ    0x02 // Raise an IRQ when the period has passed.
+#define TIMER_CTRL_REPEAT 0x04 // Start over when the period has passed.
+
+// Status bits, cleared by reading.
+#define TIMER_STATUS_EXPIRED 0x01
+
+typedef struct dev_timer {
+	uint16_t period;    // In cycles, 0 means 65536.
+	uint8_t  ctrl;
+	uint8_t  status;
+} dev_timer_t;
+
+// Initialises a timer device; writing TIMER_CTRL (re)starts it.
+void dev_timer_init(device_t *dev, dev_timer_t *timer);
+
+#endif //DEV_TIMER_H
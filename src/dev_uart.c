@@ -0,0 +1,148 @@
+
+#include "dev_uart.h"
+#include <string.h>
+
+static uint16_t fifo_used(dev_uart_t *uart) {
+	return (uint16_t) (uart->fifo_tail - uart->fifo_head);
+}
+
+// Tells whether the coroutine has anything left to do.
+static bool uart_busy(device_t *dev) {
+	dev_uart_t *uart = dev->state;
+	return !(uart->status & UART_STATUS_TX_READY)
+		|| (!(uart->status & UART_STATUS_RX_READY) && fifo_used(uart));
+}
+
+// Starts receiving if the FIFO has bytes and the UART was idle.
+static void uart_kick(device_t *dev) {
+	if (dev->resume == DEV_DONE && uart_busy(dev)) {
+		device_restart(dev);
+	}
+}
+
+static uint8_t uart_read(device_t *dev, uint16_t address, bool notouchy) {
+	dev_uart_t *uart = dev->state;
+	switch (address) {
+		case UART_DATA:
+			if (!notouchy && (uart->status & UART_STATUS_RX_READY)) {
+				uart->status &= ~UART_STATUS_RX_READY;
+				// Carry on with the next byte.
+				uart_kick(dev);
+			}
+			return uart->rx;
+		case UART_STATUS: {
+			uint8_t status = uart->status | (dev->ctx ? 0 : UART_STATUS_NO_PORT);
+			if (!notouchy) uart->status &= ~UART_STATUS_OVERRUN;
+			return status;
+		}
+		case UART_CTRL:
+			return uart->ctrl;
+		case UART_DIV_LO:
+			return uart->divisor & 0xff;
+		case UART_DIV_HI:
+			return uart->divisor >> 8;
+	}
+	return 0;
+}
+
+static void uart_write(device_t *dev, uint16_t address, uint8_t value) {
+	dev_uart_t *uart = dev->state;
+	switch (address) {
+		case UART_DATA:
+			if (!(uart->status & UART_STATUS_TX_READY)) {
+				uart->status |= UART_STATUS_OVERRUN;
+				break;
+			}
+			uart->tx      = value;
+			uart->status &= ~UART_STATUS_TX_READY;
+			if (dev->resume == DEV_DONE) device_restart(dev);
+			break;
+		case UART_CTRL:
+			uart->ctrl = value;
+			break;
+		case UART_DIV_LO:
+			uart->divisor = (uart->divisor & 0xff00) | value;
+			break;
+		case UART_DIV_HI:
+			uart->divisor = (uart->divisor & 0x00ff) | (value << 8);
+			break;
+	}
+}
+
+static void uart_reset(device_t *dev) {
+	dev_uart_t *uart = dev->state;
+	memset(uart, 0, sizeof(dev_uart_t));
+	uart->divisor = UART_DEFAULT_DIVISOR;
+	uart->status  = UART_STATUS_TX_READY;
+}
+
+static void uart_run(device_t *dev) {
+	dev_uart_t *uart = dev->state;
+	DEV_BEGIN(dev);
+	while (uart_busy(dev)) {
+		DEV_WAIT_CYCLES(dev, uart->divisor ? uart->divisor : 65536);
+		serial_t *serial = dev->ctx;
+		// Sending: done once the host end takes it, which it does unless it's full.
+		if (!(uart->status & UART_STATUS_TX_READY) && (!serial || serial_tx_put(serial, uart->tx))) {
+			uart->status |= UART_STATUS_TX_READY;
+		}
+		// Receiving: the next byte waits until the guest read the last one.
+		if (!(uart->status & UART_STATUS_RX_READY) && fifo_used(uart)) {
+			uart->rx      = uart->fifo[uart->fifo_head ++ % UART_RX_FIFO];
+			uart->status |= UART_STATUS_RX_READY;
+			if (uart->ctrl & UART_CTRL_RX_IRQ) {
+				device_raise_irq(dev);
+			}
+		}
+	}
+	DEV_END(dev);
+}
+
+// Initialises a UART with nothing connected.
+void dev_uart_init(device_t *dev, dev_uart_t *uart) {
+	memset(dev, 0, sizeof(device_t));
+	dev->name      = "uart";
+	dev->base      = UART_BASE;
+	dev->len       = UART_LEN;
+	dev->read      = uart_read;
+	dev->write     = uart_write;
+	dev->reset     = uart_reset;
+	dev->run       = uart_run;
+	dev->state     = uart;
+	dev->state_len = sizeof(dev_uart_t);
+}
+
+// Connects the host end of a serial port, or disconnects it if NULL.
+void dev_uart_connect(device_t *dev, serial_t *serial) {
+	dev->ctx = serial;
+}
+
+// Moves bytes between the terminal and the host end, without waiting for either.
+// If receive is set, received bytes are handed to the UART too, otherwise they're left for dev_uart_rx.
+// Call it from the event loop.
+void dev_uart_poll(device_t *dev, bool receive) {
+	serial_t *serial = dev->ctx;
+	if (!serial) return;
+	serial_poll(serial);
+	uint8_t value;
+	while (receive && dev_uart_rx_room(dev) && serial_rx_get(serial, &value)) {
+		dev_uart_rx(dev, value);
+	}
+	// Sending may have been waiting for room.
+	uart_kick(dev);
+}
+
+// Tells how many bytes the UART can take from the host end.
+size_t dev_uart_rx_room(device_t *dev) {
+	return UART_RX_FIFO - fifo_used(dev->state);
+}
+
+// Hands the UART a byte from the host end, the guest gets it after the ones before.
+// Returns false if the FIFO is full.
+bool dev_uart_rx(device_t *dev, uint8_t value) {
+	dev_uart_t *uart = dev->state;
+	if (!dev_uart_rx_room(dev)) return false;
+	uart->fifo[uart->fifo_tail ++ % UART_RX_FIFO] = value;
+	uart_kick(dev);
+	return true;
+}
@@ -0,0 +1,71 @@
+
+#ifndef DEV_UART_H
+#define DEV_UART_H
+
+#include <stdint.h>
+#include "devices.h"
+#include "serial.h"
+
+// Registers.
+#define UART_BASE    0xFEC0
+#define UART_LEN     5
+#define UART_DATA    0xFEC0 // Reads the received byte, or sends a byte.
+#define UART_STATUS  0xFEC1
+#define UART_CTRL    0xFEC2
+#define UART_DIV_LO  0xFEC3 // Cycles a byte takes either way.
+#define UART_DIV_HI  0xFEC4
+
+// Control bits.
+#define UART_CTRL_RX_IRQ 0x01 // Raise an IRQ when a byte is received.
+
+// Status bits.
+#define UART_STATUS_RX_READY 0x01 // UART_DATA has a byte, cleared by reading it.
+#define UART_STATUS_TX_READY 0x02 // A byte can be sent.
+#define UART_STATUS_OVERRUN  0x04 // A byte was sent before the last one was done and got lost, cleared by reading.
+#define UART_STATUS_NO_PORT  0x08 // Nothing is connected.
+
+// Cycles per byte after a reset.
+#define UART_DEFAULT_DIVISOR 100
+// Bytes the host end can hand over before the guest reads them, a power of two.
+#define UART_RX_FIFO 256
+
+/*
+
+Bytes take the divisor in cycles to be sent or received, no matter how fast the
+host end is. Both ways are buffered: received bytes wait in the UART's FIFO until
+the guest has read the one before, and sent bytes wait until the host end has
+room, so nothing is lost as long as the guest waits for UART_STATUS_TX_READY.
+
+Received bytes are inputs to the machine, like keys: the frontend hands them
+over with dev_uart_rx between ticks, so they are recorded, replayed and fed back
+when re-executing. Sent bytes can't be taken back, so rewinding doesn't, and
+the host end drops what the guest sends again while re-executing.
+
+*/
+
+typedef struct dev_uart {
+	uint16_t divisor;   // 0 means 65536.
+	uint8_t  ctrl;
+	uint8_t  status;
+	uint8_t  rx;
+	uint8_t  tx;        // Being sent unless UART_STATUS_TX_READY is set.
+	uint8_t  fifo[UART_RX_FIFO];    // Received, but not in UART_DATA yet.
+	uint16_t fifo_head;             // Moved to UART_DATA from here.
+	uint16_t fifo_tail;             // Added here.
+} dev_uart_t;
+
+// Initialises a UART with nothing connected.
+void dev_uart_init(device_t *dev, dev_uart_t *uart);
+// Connects the host end of a serial port, or disconnects it if NULL.
+void dev_uart_connect(device_t *dev, serial_t *serial);
+// Moves bytes between the terminal and the host end, without waiting for either.
+// If receive is set, received bytes are handed to the UART too, otherwise they're left for dev_uart_rx.
+// Call it from the event loop.
+void dev_uart_poll(device_t *dev, bool receive);
+// Tells how many bytes the UART can take from the host end.
+size_t dev_uart_rx_room(device_t *dev);
+// Hands the UART a byte from the host end, the guest gets it after the ones before.
+// Returns false if the FIFO is full.
+bool dev_uart_rx(device_t *dev, uint8_t value);
+
+#endif //DEV_UART_H
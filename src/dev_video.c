@@ -0,0 +1,60 @@
+
+#include "dev_video.h"
+#include <string.h>
+
+static uint8_t video_read(device_t *dev, uint16_t address, bool notouchy) {
+	dev_video_t *video = dev->state;
+	switch (address) {
+		case VIDEO_CTRL:
+			return video->ctrl;
+		case VIDEO_PAGE:
+			return video->page;
+	}
+	return 0;
+}
+
+static void video_write(device_t *dev, uint16_t address, uint8_t value) {
+	dev_video_t *video = dev->state;
+	switch (address) {
+		case VIDEO_CTRL:
+			video->ctrl = value & (VIDEO_CTRL_ON | VIDEO_CTRL_BITMAP);
+			break;
+		case VIDEO_PAGE:
+			video->page = value;
+			break;
+	}
+}
+
+static void video_reset(device_t *dev) {
+	dev_video_t *video = dev->state;
+	video->ctrl = 0;
+	video->page = VIDEO_DEFAULT_PAGE;
+}
+
+// Initialises a video device, which starts out off.
+void dev_video_init(device_t *dev, dev_video_t *video) {
+	memset(dev, 0, sizeof(device_t));
+	dev->name      = "video";
+	dev->base      = VIDEO_BASE;
+	dev->len       = VIDEO_LEN;
+	dev->read      = video_read;
+	dev->write     = video_write;
+	dev->reset     = video_reset;
+	dev->state     = video;
+	dev->state_len = sizeof(dev_video_t);
+}
+
+// Tells where the framebuffer is, with a length of 0 if it's off.
+// It's cut short if it would run past the end of RAM.
+void dev_video_window(dev_video_t *video, uint16_t *base, uint16_t *len) {
+	*base = video->page << 8;
+	if (!(video->ctrl & VIDEO_CTRL_ON)) {
+		*len = 0;
+	} else if (video->ctrl & VIDEO_CTRL_BITMAP) {
+		*len = VIDEO_BITMAP_W * VIDEO_BITMAP_H / 8;
+	} else {
+		*len = VIDEO_TEXT_COLS * VIDEO_TEXT_ROWS;
+	}
+	// The end of RAM cuts it short.
+	if (*base + *len > 0x10000) *len = 0x10000 - *base;
+}
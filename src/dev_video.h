@@ -0,0 +1,51 @@
+
+#ifndef DEV_VIDEO_H
+#define DEV_VIDEO_H
+
+#include <stdint.h>
+#include "devices.h"
+
+// Registers.
+#define VIDEO_BASE 0xFED0
+#define VIDEO_LEN  2
+#define VIDEO_CTRL 0xFED0
+#define VIDEO_PAGE 0xFED1 // High byte of the framebuffer address in RAM.
+
+// Control bits.
+#define VIDEO_CTRL_ON     0x01 // Show the framebuffer.
+#define VIDEO_CTRL_BITMAP 0x02 // Pixels instead of characters.
+
+// Framebuffer geometry.
+#define VIDEO_TEXT_COLS   32
+#define VIDEO_TEXT_ROWS   16
+#define VIDEO_BITMAP_W    64
+#define VIDEO_BITMAP_H    32
+#define VIDEO_MAX_LEN     (VIDEO_TEXT_COLS * VIDEO_TEXT_ROWS)
+#define VIDEO_ROWS        16 // Lines of the terminal taken in either mode.
+#define VIDEO_DEFAULT_PAGE 0xFC
+
+/*
+
+The framebuffer is plain RAM from VIDEO_PAGE on, which the device only describes.
+In text mode it has a byte per character, row by row, using the same character
+set as the console. In bitmap mode it has a bit per pixel, 8 pixels to a byte
+with the leftmost in the highest bit, row by row. Two rows of pixels make a line
+of half-block characters on the terminal.
+
+Displays only repaint what changed, by comparing a copy of the framebuffer with
+what they show.
+
+*/
+
+typedef struct dev_video {
+	uint8_t ctrl;
+	uint8_t page;
+} dev_video_t;
+
+// Initialises a video device, which starts out off.
+void dev_video_init(device_t *dev, dev_video_t *video);
+// Tells where the framebuffer is, with a length of 0 if it's off.
+// It's cut short if it would run past the end of RAM.
+void dev_video_window(dev_video_t *video, uint16_t *base, uint16_t *len);
+
+#endif //DEV_VIDEO_H
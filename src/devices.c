@@ -0,0 +1,185 @@
+
+#include "devices.h"
+#include <string.h>
+
+// Resumes the coroutine of a device.
+static void device_resume(device_t *dev) {
+	if (!dev->run || dev->resume == DEV_DONE) return;
+	dev->wake_cycle = DEV_NEVER;
+	dev->wake_addr  = DEV_NO_ADDR;
+	dev->run(dev);
+}
+
+// Resumes devices waiting for an access to this address.
+static void devbus_wake_addr(devbus_t *bus, uint16_t address, uint8_t value, bool is_read) {
+	bool resumed = false;
+	for (device_t *dev = bus->devices; dev; dev = dev->next) {
+		if (dev->wake_addr == address && dev->wake_on_read == is_read) {
+			dev->woke_addr  = address;
+			dev->woke_value = value;
+			device_resume(dev);
+			resumed = true;
+		}
+	}
+	if (resumed) devbus_schedule(bus);
+}
+
+// Initialises an empty bus and connects it to the CPU.
+void devbus_init(devbus_t *bus, gr8cpurev3_t *cpu) {
+	memset(bus, 0, sizeof(devbus_t));
+	bus->cpu        = cpu;
+	bus->next_wake  = DEV_NEVER;
+	cpu->mmioCtx    = bus;
+	cpu->eventCycle = DEV_NEVER;
+}
+
+// Attaches a device to the bus.
+// Returns false if the device's registers are taken or outside MMIO_PAGE.
+bool devbus_attach(devbus_t *bus, device_t *dev) {
+	if ((dev->base & 0xFF00) != MMIO_PAGE || (dev->base & 0xFF) + dev->len > 256) {
+		return false;
+	}
+	for (int i = 0; i < dev->len; i++) {
+		if (bus->map[(dev->base + i) & 0xFF]) return false;
+	}
+	for (int i = 0; i < dev->len; i++) {
+		bus->map[(dev->base + i) & 0xFF] = dev;
+	}
+	dev->bus        = bus;
+	dev->resume     = DEV_START;
+	dev->wake_cycle = DEV_NEVER;
+	dev->wake_addr  = DEV_NO_ADDR;
+	dev->next       = bus->devices;
+	bus->devices    = dev;
+	if (dev->route) bus->intc = dev;
+	return true;
+}
+
+// Resets all devices and starts their coroutines.
+void devbus_reset(devbus_t *bus) {
+	for (device_t *dev = bus->devices; dev; dev = dev->next) {
+		if (dev->reset) dev->reset(dev);
+		dev->resume = DEV_START;
+		device_resume(dev);
+	}
+	devbus_schedule(bus);
+}
+
+// Handler for MMIO reading.
+uint8_t devbus_read(devbus_t *bus, uint16_t address, bool notouchy) {
+	device_t *dev = bus->map[address & 0xFF];
+	uint8_t value = 0;
+	if (dev && dev->read) {
+		value = dev->read(dev, address, notouchy);
+	}
+	if (!notouchy) {
+		bus->reads ++;
+		devbus_wake_addr(bus, address, value, true);
+	}
+	return value;
+}
+
+// Handler for MMIO writing.
+void devbus_write(devbus_t *bus, uint16_t address, uint8_t value) {
+	device_t *dev = bus->map[address & 0xFF];
+	bus->writes ++;
+	if (dev && dev->write) {
+		dev->write(dev, address, value);
+	}
+	devbus_wake_addr(bus, address, value, false);
+}
+
+// Resumes all devices that are due.
+void devbus_event(devbus_t *bus) {
+	uint64_t now = bus->cpu->numCycles;
+	for (device_t *dev = bus->devices; dev; dev = dev->next) {
+		if (dev->wake_cycle <= now) {
+			device_resume(dev);
+		}
+	}
+	devbus_schedule(bus);
+}
+
+// Finds the next cycle a device is due and tells the CPU.
+void devbus_schedule(devbus_t *bus) {
+	uint64_t next = DEV_NEVER;
+	for (device_t *dev = bus->devices; dev; dev = dev->next) {
+		if (dev->wake_cycle < next) next = dev->wake_cycle;
+	}
+	bus->next_wake       = next;
+	bus->cpu->eventCycle = next;
+}
+
+// Number of bytes needed to save the state of all devices.
+size_t devbus_state_len(devbus_t *bus) {
+	size_t len = 0;
+	for (device_t *dev = bus->devices; dev; dev = dev->next) {
+		len += sizeof(dev_saved_t) + dev->state_len;
+	}
+	return len;
+}
+
+// Saves the state and coroutines of all devices.
+void devbus_save(devbus_t *bus, uint8_t *buf) {
+	for (device_t *dev = bus->devices; dev; dev = dev->next) {
+		// Cleared first so that the padding is the same every time.
+		dev_saved_t saved;
+		memset(&saved, 0, sizeof(dev_saved_t));
+		saved.resume       = dev->resume;
+		saved.wake_cycle   = dev->wake_cycle;
+		saved.wake_addr    = dev->wake_addr;
+		saved.wake_on_read = dev->wake_on_read;
+		saved.woke_addr    = dev->woke_addr;
+		saved.woke_value   = dev->woke_value;
+		memcpy(buf, &saved, sizeof(dev_saved_t));
+		buf += sizeof(dev_saved_t);
+		memcpy(buf, dev->state, dev->state_len);
+		buf += dev->state_len;
+	}
+}
+
+// Loads the state and coroutines of all devices.
+void devbus_load(devbus_t *bus, const uint8_t *buf) {
+	for (device_t *dev = bus->devices; dev; dev = dev->next) {
+		dev_saved_t saved;
+		memcpy(&saved, buf, sizeof(dev_saved_t));
+		buf += sizeof(dev_saved_t);
+		dev->resume       = saved.resume;
+		dev->wake_cycle   = saved.wake_cycle;
+		dev->wake_addr    = saved.wake_addr;
+		dev->wake_on_read = saved.wake_on_read;
+		dev->woke_addr    = saved.woke_addr;
+		dev->woke_value   = saved.woke_value;
+		memcpy(dev->state, buf, dev->state_len);
+		buf += dev->state_len;
+		if (dev->load) dev->load(dev);
+	}
+	devbus_schedule(bus);
+}
+
+// Restarts the coroutine of a device from the top.
+void device_restart(device_t *dev) {
+	dev->resume = DEV_START;
+	device_resume(dev);
+	devbus_schedule(dev->bus);
+}
+
+// Raises an IRQ on the CPU the device is attached to.
+// Goes through the interrupt controller if the device is one of its sources.
+void device_raise_irq(device_t *dev) {
+	if (dev->irq && dev->bus->intc) {
+		dev->bus->intc->route(dev->bus->intc, dev);
+	} else {
+		dev->bus->cpu->schduledIRQ = 0;
+	}
+}
+
+// Raises an IRQ on the CPU itself, for interrupt controllers.
+void device_raise_cpu_irq(device_t *dev) {
+	dev->bus->cpu->schduledIRQ = 0;
+}
+
+// Raises an NMI on the CPU the device is attached to.
+void device_raise_nmi(device_t *dev) {
+	dev->bus->cpu->schduledNMI = 0;
+}
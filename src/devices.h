@@ -0,0 +1,161 @@
+
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "common/GR8EMUr3_2.h"
+
+// All peripherals live in this page.
+#define MMIO_PAGE 0xFE00
+
+// Wake cycle of a device that is not waiting for time to pass.
+#define DEV_NEVER   UINT64_MAX
+// Wake address of a device that is not waiting for an access.
+#define DEV_NO_ADDR -1
+
+// Resume points of device coroutines.
+#define DEV_START 0
+#define DEV_DONE  -1
+
+/*
+
+Device coroutines are written as sequential code, which is suspended
+until the thing it waits for has happened:
+
+	static void blink_run(device_t *dev) {
+		DEV_BEGIN(dev);
+		while (1) {
+			DEV_WAIT_WRITE(dev, 0xFEF8);
+			DEV_WAIT_CYCLES(dev, 200);
+			device_raise_irq(dev);
+		}
+		DEV_END(dev);
+	}
+
+Local variables do not survive a wait, keep anything that must in dev->state.
+Only one wait is allowed per source line.
+
+*/
+
+// Starts the body of a device coroutine.
+#define DEV_BEGIN(dev) switch ((dev)->resume) { case DEV_START:
+// Ends the body of a device coroutine.
+#define DEV_END(dev) } (dev)->resume = DEV_DONE
+// Suspends the coroutine for a number of emulated cycles.
+#define DEV_WAIT_CYCLES(dev, n) do { \
+		(dev)->wake_cycle = (dev)->bus->cpu->numCycles + (n); \
+		(dev)->resume = __LINE__; return; case __LINE__:; \
+	} while (0)
+// Suspends the coroutine until the CPU writes to an address.
+// The written value is stored in dev->woke_value.
+#define DEV_WAIT_WRITE(dev, address) do { \
+		(dev)->wake_addr = (address); (dev)->wake_on_read = false; \
+		(dev)->resume = __LINE__; return; case __LINE__:; \
+	} while (0)
+// Suspends the coroutine until the CPU reads from an address.
+#define DEV_WAIT_READ(dev, address) do { \
+		(dev)->wake_addr = (address); (dev)->wake_on_read = true; \
+		(dev)->resume = __LINE__; return; case __LINE__:; \
+	} while (0)
+
+typedef struct device device_t;
+typedef struct devbus devbus_t;
+
+// Handler for reading a device register.
+// If notouchy is set, anything that activates on read must not be activated.
+typedef uint8_t (*dev_read_t)(device_t *dev, uint16_t address, bool notouchy);
+// Handler for writing a device register.
+typedef void (*dev_write_t)(device_t *dev, uint16_t address, uint8_t value);
+// Handler for resetting the device state.
+typedef void (*dev_reset_t)(device_t *dev);
+// Body of the device coroutine.
+typedef void (*dev_run_t)(device_t *dev);
+// Handler for state that was just loaded, to bring the host side in line.
+typedef void (*dev_load_t)(device_t *dev);
+// Handler for IRQs raised by other devices, for interrupt controllers.
+typedef void (*dev_route_t)(device_t *dev, device_t *from);
+
+struct device {
+	// ==== DESCRIPTION ====
+	char        *name;
+	uint16_t     base;          // First MMIO address.
+	uint16_t     len;           // Number of MMIO addresses.
+	dev_read_t   read;          // Optional.
+	dev_write_t  write;         // Optional.
+	dev_reset_t  reset;         // Optional.
+	dev_run_t    run;           // Optional.
+	dev_load_t   load;          // Optional.
+	dev_route_t  route;         // Optional, makes the device the bus's interrupt controller.
+	uint8_t      irq;           // Source bits on the interrupt controller, 0 to raise IRQs directly.
+	void        *ctx;           // Optional, for the handlers.
+	void        *state;         // Device-specific state.
+	size_t       state_len;     // Size of the state, for snapshots.
+	// ==== COROUTINE ====
+	int          resume;        // Where to resume the coroutine.
+	uint64_t     wake_cycle;    // Cycle to resume at, or DEV_NEVER.
+	int32_t      wake_addr;     // Address to resume on, or DEV_NO_ADDR.
+	bool         wake_on_read;  // Whether to resume on read instead of write.
+	uint16_t     woke_addr;     // Address of the access that resumed the coroutine.
+	uint8_t      woke_value;    // Value of the access that resumed the coroutine.
+	// ==== BUS ====
+	devbus_t    *bus;
+	device_t    *next;
+};
+
+// Saved coroutine of a device, followed by its state.
+typedef struct dev_saved {
+	int          resume;
+	uint64_t     wake_cycle;
+	int32_t      wake_addr;
+	bool         wake_on_read;
+	uint16_t     woke_addr;
+	uint8_t      woke_value;
+} dev_saved_t;
+
+struct devbus {
+	gr8cpurev3_t *cpu;
+	device_t     *devices;      // All attached devices.
+	device_t     *map[256];     // Device for every address in MMIO_PAGE.
+	device_t     *intc;         // Interrupt controller, if any.
+	uint64_t      next_wake;    // Earliest wake cycle of all devices.
+	// ==== STATISTICS ====
+	size_t        reads;        // Touchy reads by the CPU.
+	size_t        writes;       // Writes by the CPU.
+};
+
+// Initialises an empty bus and connects it to the CPU.
+void devbus_init(devbus_t *bus, gr8cpurev3_t *cpu);
+// Attaches a device to the bus.
+// Returns false if the device's registers are taken or outside MMIO_PAGE.
+bool devbus_attach(devbus_t *bus, device_t *dev);
+// Resets all devices and starts their coroutines.
+void devbus_reset(devbus_t *bus);
+// Handler for MMIO reading.
+uint8_t devbus_read(devbus_t *bus, uint16_t address, bool notouchy);
+// Handler for MMIO writing.
+void devbus_write(devbus_t *bus, uint16_t address, uint8_t value);
+// Resumes all devices that are due.
+void devbus_event(devbus_t *bus);
+// Finds the next cycle a device is due and tells the CPU.
+void devbus_schedule(devbus_t *bus);
+
+// Number of bytes needed to save the state of all devices.
+size_t devbus_state_len(devbus_t *bus);
+// Saves the state and coroutines of all devices.
+void devbus_save(devbus_t *bus, uint8_t *buf);
+// Loads the state and coroutines of all devices.
+void devbus_load(devbus_t *bus, const uint8_t *buf);
+
+// Restarts the coroutine of a device from the top.
+void device_restart(device_t *dev);
+// Raises an IRQ on the CPU the device is attached to.
+// Goes through the interrupt controller if the device is one of its sources.
+void device_raise_irq(device_t *dev);
+// Raises an IRQ on the CPU itself, for interrupt controllers.
+void device_raise_cpu_irq(device_t *dev);
+// Raises an NMI on the CPU the device is attached to.
+void device_raise_nmi(device_t *dev);
+
+#endif //DEVICES_H
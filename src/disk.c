@@ -0,0 +1,316 @@
+
+#define _GNU_SOURCE
+#include "disk.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const char *disk_error = "";
+
+#define HAS_SECTOR(disk, sector) ((disk)->present[(sector) >> 3] & (1 << ((sector) & 7)))
+
+// Maps a disk image, read-only if it can't be written.
+bool disk_open(disk_t *disk, const char *path) {
+	memset(disk, 0, sizeof(disk_t));
+	disk->overlay_fd = -1;
+	disk->fd = open(path, O_RDWR);
+	if (disk->fd < 0) {
+		disk->fd = open(path, O_RDONLY);
+		disk->read_only = true;
+	}
+	if (disk->fd < 0) {
+		disk_error = "could not open file";
+		return false;
+	}
+	struct stat st;
+	if (fstat(disk->fd, &st) || st.st_size < DISK_SECTOR) {
+		disk_error = "image is smaller than a sector";
+		close(disk->fd);
+		return false;
+	}
+	disk->len     = st.st_size;
+	disk->sectors = disk->len / DISK_SECTOR;
+	if (disk->sectors > 65536) disk->sectors = 65536;
+	int prot = disk->read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+	disk->map = mmap(NULL, disk->len, prot, MAP_SHARED, disk->fd, 0);
+	if (disk->map == MAP_FAILED) {
+		disk_error = "could not map file";
+		close(disk->fd);
+		return false;
+	}
+	return true;
+}
+
+// Uses an image someone else mapped, which is never written.
+void disk_from_map(disk_t *disk, uint8_t *map, size_t len) {
+	memset(disk, 0, sizeof(disk_t));
+	disk->fd         = -1;
+	disk->overlay_fd = -1;
+	disk->map        = map;
+	disk->len        = len;
+	disk->sectors    = len / DISK_SECTOR;
+	disk->read_only  = true;
+	if (disk->sectors > 65536) disk->sectors = 65536;
+}
+
+static void overlay_free(disk_t *disk) {
+	if (!disk->overlay) return;
+	munmap(disk->overlay, disk->len);
+	if (disk->overlay_fd >= 0) close(disk->overlay_fd);
+	free(disk->present);
+	disk->overlay    = NULL;
+	disk->overlay_fd = -1;
+	disk->present    = NULL;
+}
+
+// Writes back everything and unmaps the image, dropping the overlay.
+void disk_close(disk_t *disk) {
+	if (!disk->map) return;
+	overlay_free(disk);
+	free(disk->undo);
+	free(disk->undo_epoch);
+	disk->undo       = NULL;
+	disk->undo_epoch = NULL;
+	if (disk->fd >= 0) {
+		disk_flush(disk, true);
+		munmap(disk->map, disk->len);
+		close(disk->fd);
+	}
+	disk->map = NULL;
+}
+
+// Starts writing back changed sectors, and waits for it if wait is set.
+void disk_flush(disk_t *disk, bool wait) {
+	if (disk->overlay) {
+		if (disk->overlay_fd >= 0) msync(disk->overlay, disk->len, wait ? MS_SYNC : MS_ASYNC);
+	} else if (!disk->read_only) {
+		msync(disk->map, disk->len, wait ? MS_SYNC : MS_ASYNC);
+	}
+}
+
+// Finds the data of a sector like disk_sector, without keeping it for undo.
+static uint8_t *sector_data(disk_t *disk, uint16_t sector, bool write) {
+	if (!disk || sector >= disk->sectors) return NULL;
+	size_t offset = (size_t) sector * DISK_SECTOR;
+	if (!disk->overlay) {
+		return write && disk->read_only ? NULL : disk->map + offset;
+	}
+	if (HAS_SECTOR(disk, sector)) {
+		return disk->overlay + offset;
+	} else if (write) {
+		// Copied on the first write.
+		memcpy(disk->overlay + offset, disk->map + offset, DISK_SECTOR);
+		disk->present[sector >> 3] |= 1 << (sector & 7);
+		return disk->overlay + offset;
+	}
+	return disk->map + offset;
+}
+
+// Finds the data of a sector, for writing if write is set.
+// Returns NULL if there's no such sector, or it can't be written.
+uint8_t *disk_sector(disk_t *disk, uint16_t sector, bool write) {
+	uint8_t *data = sector_data(disk, sector, write);
+	if (!data || !write || !disk->undo_epoch || disk->undo_epoch[sector] == disk->epoch) return data;
+	// First write since the last mark, keep what it was.
+	if (disk->undo_len == disk->undo_cap) {
+		size_t cap = disk->undo_cap ? disk->undo_cap * 2 : 64;
+		disk_undo_t *mem = realloc(disk->undo, cap * sizeof(disk_undo_t));
+		if (!mem) return data;
+		disk->undo     = mem;
+		disk->undo_cap = cap;
+	}
+	disk_undo_t *undo = &disk->undo[disk->undo_len ++];
+	undo->sector = sector;
+	memcpy(undo->data, data, DISK_SECTOR);
+	disk->undo_epoch[sector] = disk->epoch;
+	return data;
+}
+
+// Tells whether writes to the disk will fail.
+bool disk_read_only(disk_t *disk) {
+	return disk->read_only && !disk->overlay;
+}
+
+// Sends writes to an overlay from now on, in a sparse file at path, or in memory if NULL.
+bool disk_overlay(disk_t *disk, const char *path) {
+	overlay_free(disk);
+	disk->present = calloc((disk->sectors + 7) / 8, 1);
+	if (!disk->present) {
+		disk_error = "out of memory";
+		return false;
+	}
+	if (path) {
+		disk->overlay_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (disk->overlay_fd < 0 || ftruncate(disk->overlay_fd, disk->len)) {
+			disk_error = "could not create overlay file";
+			overlay_free(disk);
+			return false;
+		}
+		disk->overlay = mmap(NULL, disk->len, PROT_READ | PROT_WRITE, MAP_SHARED, disk->overlay_fd, 0);
+	} else {
+		disk->overlay = mmap(NULL, disk->len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	if (disk->overlay == MAP_FAILED) {
+		disk->overlay = NULL;
+		disk_error = "could not map overlay";
+		overlay_free(disk);
+		return false;
+	}
+	return true;
+}
+
+// Forgets everything in the overlay.
+void disk_discard(disk_t *disk) {
+	if (!disk->overlay) return;
+	memset(disk->present, 0, (disk->sectors + 7) / 8);
+	// Give back the memory or the blocks.
+	if (disk->overlay_fd >= 0) {
+		fallocate(disk->overlay_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, disk->len);
+	} else {
+		madvise(disk->overlay, disk->len, MADV_DONTNEED);
+	}
+}
+
+// Keeps writes from now on to this process, in an overlay on top of the disk as it is now.
+// The image is never written after, and disk_discard goes back to how it was.
+bool disk_private(disk_t *disk) {
+	if (disk->fd < 0) {
+		disk_error = "image belongs to someone else";
+		return false;
+	}
+	// A copy of the image only this process sees, with what's in the overlay so far.
+	uint8_t *map = mmap(NULL, disk->len, PROT_READ | PROT_WRITE, MAP_PRIVATE, disk->fd, 0);
+	if (map == MAP_FAILED) {
+		disk_error = "could not map file";
+		return false;
+	}
+	for (size_t i = 0; disk->overlay && i < disk->sectors; i++) {
+		if (HAS_SECTOR(disk, i)) {
+			memcpy(map + i * DISK_SECTOR, disk->overlay + i * DISK_SECTOR, DISK_SECTOR);
+		}
+	}
+	munmap(disk->map, disk->len);
+	disk->map       = map;
+	disk->read_only = true;
+	return disk_overlay(disk, NULL);
+}
+
+// Writes everything in the overlay to the image, then forgets it.
+bool disk_commit(disk_t *disk) {
+	if (!disk->overlay) return true;
+	if (disk->read_only) {
+		disk_error = "image is read-only";
+		return false;
+	}
+	for (size_t i = 0; i < disk->sectors; i++) {
+		if (HAS_SECTOR(disk, i)) {
+			memcpy(disk->map + i * DISK_SECTOR, disk->overlay + i * DISK_SECTOR, DISK_SECTOR);
+		}
+	}
+	msync(disk->map, disk->len, MS_SYNC);
+	disk_discard(disk);
+	return true;
+}
+
+// Keeps the old contents of sectors from now on, so writes can be undone.
+bool disk_undoable(disk_t *disk) {
+	if (disk->undo_epoch) return true;
+	disk->undo_epoch = calloc(disk->sectors, sizeof(uint32_t));
+	if (!disk->undo_epoch) {
+		disk_error = "out of memory";
+		return false;
+	}
+	disk->epoch = 1;
+	return true;
+}
+
+// Returns the position to undo to later, writes after it are undone.
+size_t disk_mark(disk_t *disk) {
+	disk->epoch ++;
+	return disk->undo_base + disk->undo_len;
+}
+
+// Puts back what the disk was at a mark, and forgets everything after it.
+void disk_undo(disk_t *disk, size_t mark) {
+	if (mark < disk->undo_base) mark = disk->undo_base;
+	// Newest first, so a sector ends up as it was at the mark.
+	while (disk->undo_base + disk->undo_len > mark) {
+		disk_undo_t *undo = &disk->undo[-- disk->undo_len];
+		uint8_t *data = sector_data(disk, undo->sector, true);
+		if (data) memcpy(data, undo->data, DISK_SECTOR);
+	}
+	disk->epoch ++;
+}
+
+// Forgets everything before a mark, it can't be undone to any more.
+void disk_forget(disk_t *disk, size_t mark) {
+	if (mark <= disk->undo_base) return;
+	size_t drop = mark - disk->undo_base;
+	if (drop > disk->undo_len) drop = disk->undo_len;
+	memmove(disk->undo, disk->undo + drop, (disk->undo_len - drop) * sizeof(disk_undo_t));
+	disk->undo_len  -= drop;
+	disk->undo_base += drop;
+}
+
+// Writes the overlay to a file.
+bool disk_overlay_save(disk_t *disk, const char *path) {
+	FILE *fd = fopen(path, "wb");
+	if (!fd) {
+		disk_error = "could not open file";
+		return false;
+	}
+	size_t map_len = (disk->sectors + 7) / 8;
+	fprintf(fd, "%s %d %zu\n", OVERLAY_MAGIC, OVERLAY_VERSION, disk->sectors);
+	if (disk->overlay) {
+		fwrite(disk->present, 1, map_len, fd);
+		for (size_t i = 0; i < disk->sectors; i++) {
+			if (HAS_SECTOR(disk, i)) fwrite(disk->overlay + i * DISK_SECTOR, 1, DISK_SECTOR, fd);
+		}
+	} else {
+		for (size_t i = 0; i < map_len; i++) fputc(0, fd);
+	}
+	if (ferror(fd) | fclose(fd)) {
+		disk_error = "could not write file";
+		return false;
+	}
+	return true;
+}
+
+// Replaces the overlay with one from a file.
+bool disk_overlay_load(disk_t *disk, const char *path) {
+	FILE *fd = fopen(path, "rb");
+	if (!fd) {
+		disk_error = "could not open file";
+		return false;
+	}
+	char magic[8];
+	int version;
+	size_t sectors;
+	bool ok = fscanf(fd, "%7s %d %zu", magic, &version, &sectors) == 3 && fgetc(fd) == '\n'
+			&& !strcmp(magic, OVERLAY_MAGIC);
+	if (!ok || version != OVERLAY_VERSION || sectors != disk->sectors) {
+		disk_error = !ok ? "not an overlay" : version != OVERLAY_VERSION ? "unsupported version" : "overlay is of another image";
+		fclose(fd);
+		return false;
+	}
+	if (!disk->overlay && !disk_overlay(disk, NULL)) {
+		fclose(fd);
+		return false;
+	}
+	disk_discard(disk);
+	size_t map_len = (disk->sectors + 7) / 8;
+	ok = fread(disk->present, 1, map_len, fd) == map_len;
+	for (size_t i = 0; ok && i < disk->sectors; i++) {
+		if (HAS_SECTOR(disk, i)) ok = fread(disk->overlay + i * DISK_SECTOR, 1, DISK_SECTOR, fd) == DISK_SECTOR;
+	}
+	fclose(fd);
+	if (!ok) {
+		disk_error = "file is truncated";
+		disk_discard(disk);
+	}
+	return ok;
+}
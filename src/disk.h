@@ -0,0 +1,100 @@
+
+#ifndef DISK_H
+#define DISK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define DISK_SECTOR 256
+
+#define OVERLAY_MAGIC   "GR8OVL"
+#define OVERLAY_VERSION 1
+
+/*
+
+Without an overlay, writes go to the mapping and reach the file whenever the
+kernel gets to them, or on disk_flush.
+
+With an overlay, the image is never written. The first write to a sector copies
+it to the overlay, which has a bit per sector telling whether it has it; reads of
+the other sectors still come from the image, shared with anyone else mapping it.
+Overlays are anonymous memory or a sparse file, so only changed sectors take up
+space either way. They are saved to a file as:
+	GR8OVL <version> <sectors>
+	<a bit per sector, lowest first><every sector that has its bit set>
+
+An undoable disk keeps the old contents of every sector the first time it's
+written after a mark, so disk_undo can go back to how the disk was at any mark
+that wasn't forgotten. Marks are positions in that log and stay valid until the
+entries before them are forgotten.
+
+*/
+
+// Contents of a sector before it was written.
+typedef struct disk_undo {
+	uint16_t sector;
+	uint8_t  data[DISK_SECTOR];
+} disk_undo_t;
+
+// A disk image, mapped so reads come straight from the page cache.
+typedef struct disk {
+	int      fd;                    // -1 if someone else mapped the image.
+	uint8_t *map;
+	size_t   len;
+	size_t   sectors;               // Whole sectors in the image, at most 65536.
+	bool     read_only;             // The image can't be written, the overlay can.
+	uint64_t latency;               // Cycles a command takes, 0 to finish right away.
+	// ==== OVERLAY ====
+	uint8_t *overlay;               // Changed sectors, NULL to write the image.
+	int      overlay_fd;            // Sparse file behind the overlay, or -1.
+	uint8_t *present;               // A bit per sector, set if the overlay has it.
+	// ==== UNDO ====
+	disk_undo_t *undo;              // Oldest first, NULL if not undoable.
+	size_t       undo_len;
+	size_t       undo_cap;
+	size_t       undo_base;         // Entries forgotten before the first one.
+	uint32_t    *undo_epoch;        // Per sector, the mark it was last kept after.
+	uint32_t     epoch;
+} disk_t;
+
+// Why the last disk operation failed.
+extern const char *disk_error;
+
+// Maps a disk image, read-only if it can't be written.
+bool disk_open(disk_t *disk, const char *path);
+// Uses an image someone else mapped, which is never written.
+void disk_from_map(disk_t *disk, uint8_t *map, size_t len);
+// Writes back everything and unmaps the image, dropping the overlay.
+void disk_close(disk_t *disk);
+// Starts writing back changed sectors, and waits for it if wait is set.
+void disk_flush(disk_t *disk, bool wait);
+// Finds the data of a sector, for writing if write is set.
+// Returns NULL if there's no such sector, or it can't be written.
+uint8_t *disk_sector(disk_t *disk, uint16_t sector, bool write);
+// Tells whether writes to the disk will fail.
+bool disk_read_only(disk_t *disk);
+
+// Sends writes to an overlay from now on, in a sparse file at path, or in memory if NULL.
+bool disk_overlay(disk_t *disk, const char *path);
+// Forgets everything in the overlay.
+void disk_discard(disk_t *disk);
+// Keeps writes from now on to this process, in an overlay on top of the disk as it is now.
+// The image is never written after, and disk_discard goes back to how it was.
+bool disk_private(disk_t *disk);
+// Writes everything in the overlay to the image, then forgets it.
+bool disk_commit(disk_t *disk);
+// Keeps the old contents of sectors from now on, so writes can be undone.
+bool disk_undoable(disk_t *disk);
+// Returns the position to undo to later, writes after it are undone.
+size_t disk_mark(disk_t *disk);
+// Puts back what the disk was at a mark, and forgets everything after it.
+void disk_undo(disk_t *disk, size_t mark);
+// Forgets everything before a mark, it can't be undone to any more.
+void disk_forget(disk_t *disk, size_t mark);
+// Writes the overlay to a file.
+bool disk_overlay_save(disk_t *disk, const char *path);
+// Replaces the overlay with one from a file.
+bool disk_overlay_load(disk_t *disk, const char *path);
+
+#endif //DISK_H
@@ -0,0 +1,40 @@
+
+#include "engine.h"
+#include <limits.h>
+#include <string.h>
+
+// One cycle at a time, straight through pretick and posttick.
+static int engine_cycle(gr8cpurev3_t *cpu, uint64_t n) {
+	for (uint64_t i = 0; i < n; i++) {
+		int res = gr8cpurev3_pretick(cpu);
+		if (res != EXC_NORM) return res;
+		res = gr8cpurev3_posttick(cpu);
+		if (res != EXC_NORM) return res;
+	}
+	return EXC_NORM;
+}
+
+// As many cycles as possible per gr8cpurev3_tick, like the frontends do.
+static int engine_tick(gr8cpurev3_t *cpu, uint64_t n) {
+	while (n) {
+		int chunk = n < INT_MAX ? n : INT_MAX;
+		int res = gr8cpurev3_tick(cpu, chunk, TICK_NORMAL << 16);
+		if (res != EXC_NORM) return res;
+		n -= chunk;
+	}
+	return EXC_NORM;
+}
+
+const engine_t engines[] = {
+	{ "cycle", "Reference, one pretick and posttick per cycle.", engine_cycle },
+	{ "tick",  "gr8cpurev3_tick in chunks, as the frontends run.", engine_tick },
+	{ NULL, NULL, NULL }
+};
+
+// Finds an engine by name, or returns NULL.
+const engine_t *engine_find(const char *name) {
+	for (const engine_t *engine = engines; engine->name; engine++) {
+		if (!strcmp(engine->name, name)) return engine;
+	}
+	return NULL;
+}
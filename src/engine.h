@@ -0,0 +1,25 @@
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdint.h>
+#include "common/GR8EMUr3_2.h"
+
+// Runs a CPU for at most n cycles, stopping early on anything but EXC_NORM.
+// Returns the result like gr8cpurev3_tick.
+typedef int (*engine_run_t)(gr8cpurev3_t *cpu, uint64_t n);
+
+// A way to run the CPU, which must behave exactly like the reference.
+typedef struct engine {
+	const char   *name;
+	const char   *desc;
+	engine_run_t  run;
+} engine_t;
+
+// Every engine, the reference first, ending with an empty one.
+extern const engine_t engines[];
+
+// Finds an engine by name, or returns NULL.
+const engine_t *engine_find(const char *name);
+
+#endif //ENGINE_H
@@ -0,0 +1,32 @@
+
+#include "escape_utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Replaces C-style escapes in a string with what they stand for, in place.
+// Returns the new length, which may include NUL bytes from \x00.
+size_t unescape(char *str) {
+	char *in = str;
+	size_t len = 0;
+	while (*in) {
+		char c = *in++;
+		if (c == '\\' && *in) {
+			c = *in++;
+			switch (c) {
+				case 'n': c = '\n'; break;
+				case 'r': c = '\r'; break;
+				case 't': c = '\t'; break;
+				case 'b': c = '\b'; break;
+				case 'e': c = 0x1b; break;
+				case 's': c = ' ';  break;
+				case 'x': {
+					char hex[3] = { in[0], in[0] ? in[1] : 0, 0 };
+					c = strtol(hex, NULL, 16);
+					in += strlen(hex);
+				} break;
+			}
+		}
+		str[len ++] = c;
+	}
+	return len;
+}
@@ -0,0 +1,11 @@
+
+#ifndef ESCAPE_UTILS_H
+#define ESCAPE_UTILS_H
+
+#include <stddef.h>
+
+// Replaces C-style escapes in a string with what they stand for, in place.
+// Returns the new length, which may include NUL bytes from \x00.
+size_t unescape(char *str);
+
+#endif //ESCAPE_UTILS_H
@@ -0,0 +1,188 @@
+
+#include "explore.h"
+#include "main.h"
+#include "json_utils.h"
+#include "escape_utils.h"
+#include "disk.h"
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+static explore_input_t *inputs;
+static size_t inputs_len;
+static char *output;
+static size_t output_len;
+
+// Reads all inputs, one per line, an empty line being no keys at all.
+static bool load_inputs(char *path) {
+	uint8_t *buf;
+	size_t len;
+	if (!load_file(path, &buf, &len)) return false;
+	char *text = realloc(buf, len + 1);
+	if (!text) return false;
+	text[len] = 0;
+	size_t cap = 0;
+	char *pos = text;
+	while (pos < text + len) {
+		char *line = pos;
+		char *eol  = memchr(pos, '\n', text + len - pos);
+		if (!eol) eol = text + len;
+		*eol = 0;
+		pos  = eol + 1;
+		if (inputs_len == cap) {
+			cap = cap ? cap * 2 : 64;
+			inputs = realloc(inputs, cap * sizeof(explore_input_t));
+			if (!inputs) return false;
+		}
+		inputs[inputs_len].data = line;
+		inputs[inputs_len].len  = unescape(line);
+		inputs_len ++;
+	}
+	return true;
+}
+
+// Keeps the console output of the current input.
+static void capture(machine_t *m, uint8_t value) {
+	if (output_len < EXPLORE_OUTPUT_MAX) {
+		output[output_len ++] = value;
+	}
+}
+
+// Runs inputs from the boot snapshot until there are none left.
+static void worker(FILE *fd, snapshot_t *boot, size_t *next) {
+	// Disk writes are undone along with the rest, and never reach the image.
+	disk_t *disk = machine.disk_dev.ctx;
+	if (disk && !disk_private(disk)) {
+		fprintf(stderr, "Could not keep the disk to a worker: %s\n", disk_error);
+		fclose(fd);
+		_exit(1);
+	}
+	while (1) {
+		// Take the next input from the queue shared by all workers.
+		size_t index = __atomic_fetch_add(next, 1, __ATOMIC_RELAXED);
+		if (index >= inputs_len) break;
+		explore_input_t *input = &inputs[index];
+		snapshot_restore(&snapctx, boot);
+		if (disk) disk_discard(disk);
+		output_len = 0;
+		// Run it, feeding the keyboard as it empties.
+		uint64_t start = machine.cpu.numCycles;
+		size_t fed = 0;
+		int res = EXC_NORM;
+		while (res == EXC_NORM && machine.cpu.numCycles - start < options.max_cycles) {
+			while (fed < input->len && machine_key(&machine, input->data[fed])) fed ++;
+			uint64_t n = options.max_cycles - (machine.cpu.numCycles - start);
+			res = gr8cpurev3_tick(&machine.cpu, n < EXPLORE_CHUNK ? n : EXPLORE_CHUNK, TICK_MODE_NORMAL);
+		}
+		// Report the results.
+		fprintf(fd, "{\"input\":%zu,\"result\":\"%s\",\"cycles\":%lu,\"hash\":\"%016lx\",\"output\":",
+				index, res == EXC_NORM ? "limit" : exc_desc(res), machine.cpu.numCycles - start, state_hash(&machine.cpu));
+		json_write_string(fd, output, output_len);
+		fputs("}\n", fd);
+		fflush(fd);
+	}
+	fclose(fd);
+}
+
+// Boots the machine once, then runs every line of the inputs file from there,
+// shared between worker processes forked from the booted machine.
+// Results are written to stdout, one JSON object per line.
+int explore_run(char *inputs_path, int jobs) {
+	if (!load_inputs(inputs_path)) {
+		fprintf(stderr, "Could not read inputs from '%s'\n", inputs_path);
+		return 1;
+	}
+	// Keep the console off the TTY, boot output is dropped.
+	output = malloc(EXPLORE_OUTPUT_MAX);
+	if (!output) {
+		fputs("Out of memory\n", stderr);
+		return 1;
+	}
+	machine.console = capture;
+	// Boot until the firmware wants input.
+	machine.keyb_polled = false;
+	int res = EXC_NORM;
+	while (res == EXC_NORM && !machine.keyb_polled && machine.cpu.numCycles < options.boot_cycles) {
+		res = gr8cpurev3_tick(&machine.cpu, EXPLORE_CHUNK, TICK_MODE_NORMAL);
+	}
+	fprintf(stderr, "Booted in %lu cycles (%s)\n", machine.cpu.numCycles, machine.keyb_polled ? "keyboard" : exc_desc(res));
+	snapshot_t *boot = snapshot_take(&snapctx);
+	// The queue is just the index of the next input, shared by all workers.
+	size_t *next = mmap(NULL, sizeof(size_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (!boot || next == MAP_FAILED) {
+		fputs("Out of memory\n", stderr);
+		return 1;
+	}
+	*next = 0;
+	// Fork the workers, which share the booted machine until they write to it.
+	struct pollfd fds[jobs];
+	char *lines[jobs];
+	size_t lines_len[jobs];
+	fflush(stdout);
+	for (int i = 0; i < jobs; i++) {
+		int pipefd[2];
+		if (pipe(pipefd)) {
+			perror("pipe");
+			return 1;
+		}
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		} else if (pid == 0) {
+			for (int j = 0; j < i; j++) close(fds[j].fd);
+			close(pipefd[0]);
+			FILE *fd = fdopen(pipefd[1], "w");
+			if (!fd) {
+				perror("fdopen");
+				_exit(1);
+			}
+			worker(fd, boot, next);
+			_exit(0);
+		}
+		close(pipefd[1]);
+		fds[i].fd     = pipefd[0];
+		fds[i].events = POLLIN;
+		lines[i]      = NULL;
+		lines_len[i]  = 0;
+	}
+	// Pass on the results a whole line at a time.
+	int open = jobs;
+	while (open) {
+		if (poll(fds, jobs, -1) < 0) break;
+		for (int i = 0; i < jobs; i++) {
+			if (fds[i].fd < 0 || !fds[i].revents) continue;
+			char buf[4096];
+			ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+			if (n <= 0) {
+				close(fds[i].fd);
+				fds[i].fd = -1;
+				open --;
+				continue;
+			}
+			lines[i] = realloc(lines[i], lines_len[i] + n);
+			memcpy(lines[i] + lines_len[i], buf, n);
+			lines_len[i] += n;
+			size_t len = lines_len[i];
+			while (len && lines[i][len - 1] != '\n') len --;
+			if (len) {
+				fwrite(lines[i], 1, len, stdout);
+				memmove(lines[i], lines[i] + len, lines_len[i] - len);
+				lines_len[i] -= len;
+			}
+		}
+		fflush(stdout);
+	}
+	// Collect the workers.
+	int ret = 0;
+	int status;
+	while (wait(&status) > 0) {
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) ret = 1;
+	}
+	for (int i = 0; i < jobs; i++) free(lines[i]);
+	return ret;
+}
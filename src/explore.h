@@ -0,0 +1,25 @@
+
+#ifndef EXPLORE_H
+#define EXPLORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Cycles to run at a time, between feeding the keyboard.
+#define EXPLORE_CHUNK 256
+// Most console output kept per input.
+#define EXPLORE_OUTPUT_MAX 65536
+
+// An input script, one per line of the inputs file.
+typedef struct explore_input {
+	char   *data;
+	size_t  len;
+} explore_input_t;
+
+// Boots the machine once, then runs every line of the inputs file from there,
+// shared between worker processes forked from the booted machine.
+// Results are written to stdout, one JSON object per line.
+int explore_run(char *inputs_path, int jobs);
+
+#endif //EXPLORE_H
@@ -0,0 +1,406 @@
+
+#define _GNU_SOURCE
+#include "fuzz.h"
+#include <time.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+static const char *crash_names[] = {
+	"ok", "overflow", "no_insn", "rom_write", "timeout"
+};
+
+// Bytes firmware tends to treat specially.
+static const uint8_t interesting[] = {
+	0x00, '\n', '\r', '\b', 0x1b, ' ', '0', '9', 'A', 'z', 0x7f, 0x80, 0xff
+};
+
+static uint8_t *rom;
+static size_t   rom_len;
+static char    *corpus_dir;
+static char    *crash_dir;
+static uint64_t max_cycles = FUZZ_CYCLES;
+static uint64_t boot_cycles = FUZZ_BOOT;
+
+// Everything covered by any input so far.
+static uint64_t virgin[FUZZ_COV_WORDS];
+// Crashes found so far, by kind and address.
+static uint8_t  crash_seen[5][65536];
+
+static pthread_mutex_t corpus_lock = PTHREAD_MUTEX_INITIALIZER;
+static fuzz_input_t   *corpus;
+static size_t          corpus_len;
+static size_t          corpus_cap;
+static size_t          corpus_saved;
+static size_t          crashes;
+static bool            stop;
+
+static uint64_t millis() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// xorshift64*, one state per worker.
+static uint64_t rng_next(uint64_t *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1d;
+}
+
+static uint32_t rng_below(uint64_t *state, uint32_t max) {
+	return (rng_next(state) >> 32) % max;
+}
+
+// Loads a whole file into a buffer of at most len bytes.
+static bool read_file(const char *path, uint8_t *buf, size_t *len) {
+	FILE *fd = fopen(path, "rb");
+	if (!fd) return false;
+	*len = fread(buf, 1, *len, fd);
+	fclose(fd);
+	return true;
+}
+
+static void write_file(const char *path, const fuzz_input_t *input) {
+	FILE *fd = fopen(path, "wb");
+	if (!fd) {
+		fprintf(stderr, "Could not write '%s'\n", path);
+		return;
+	}
+	fwrite(input->data, 1, input->len, fd);
+	fclose(fd);
+}
+
+// Adds an input to the corpus, and to the corpus directory if save is set.
+static bool corpus_add(const fuzz_input_t *input, bool save) {
+	pthread_mutex_lock(&corpus_lock);
+	if (corpus_len == corpus_cap) {
+		size_t cap = corpus_cap ? corpus_cap * 2 : 64;
+		fuzz_input_t *mem = realloc(corpus, cap * sizeof(fuzz_input_t));
+		if (!mem) {
+			pthread_mutex_unlock(&corpus_lock);
+			return false;
+		}
+		corpus     = mem;
+		corpus_cap = cap;
+	}
+	corpus[corpus_len ++] = *input;
+	size_t id = corpus_saved;
+	if (save) corpus_saved ++;
+	pthread_mutex_unlock(&corpus_lock);
+	if (save) {
+		char path[strlen(corpus_dir) + 32];
+		sprintf(path, "%s/new-%06zu", corpus_dir, id);
+		write_file(path, input);
+	}
+	return true;
+}
+
+// Reads every file in the corpus directory.
+static bool corpus_load() {
+	DIR *dir = opendir(corpus_dir);
+	if (!dir) {
+		fprintf(stderr, "Could not open '%s'\n", corpus_dir);
+		return false;
+	}
+	struct dirent *ent;
+	while ((ent = readdir(dir))) {
+		if (*ent->d_name == '.') continue;
+		char path[strlen(corpus_dir) + strlen(ent->d_name) + 2];
+		sprintf(path, "%s/%s", corpus_dir, ent->d_name);
+		fuzz_input_t input;
+		input.len = FUZZ_INPUT_MAX;
+		if (read_file(path, input.data, &input.len) && !corpus_add(&input, false)) break;
+		if (!strncmp(ent->d_name, "new-", 4)) corpus_saved ++;
+	}
+	closedir(dir);
+	// Start from nothing at all if there is nothing.
+	if (!corpus_len) {
+		fuzz_input_t empty = { .len = 0 };
+		corpus_add(&empty, false);
+	}
+	return corpus_len;
+}
+
+// Changes an input in a few random ways, sometimes splicing in another input.
+static void mutate(fuzz_worker_t *self, fuzz_input_t *input) {
+	uint64_t *rng = &self->rng;
+	int count = 1 << rng_below(rng, 4);
+	for (int i = 0; i < count; i++) {
+		size_t len = input->len;
+		size_t pos = len ? rng_below(rng, len) : 0;
+		switch (rng_below(rng, 7)) {
+			case 0:
+				// Flip a bit.
+				if (len) input->data[pos] ^= 1 << rng_below(rng, 8);
+				break;
+			case 1:
+				// Random byte.
+				if (len) input->data[pos] = rng_next(rng);
+				break;
+			case 2:
+				// Interesting byte.
+				if (len) input->data[pos] = interesting[rng_below(rng, sizeof(interesting))];
+				break;
+			case 3:
+			case 4:
+				// Insert a byte, usually a printable one.
+				if (len < FUZZ_INPUT_MAX) {
+					pos = rng_below(rng, len + 1);
+					memmove(input->data + pos + 1, input->data + pos, len - pos);
+					input->data[pos] = rng_below(rng, 4)
+							? ' ' + rng_below(rng, 95)
+							: interesting[rng_below(rng, sizeof(interesting))];
+					input->len ++;
+				}
+				break;
+			case 5:
+				// Delete some bytes.
+				if (len) {
+					size_t n = 1 + rng_below(rng, len - pos);
+					memmove(input->data + pos, input->data + pos + n, len - pos - n);
+					input->len -= n;
+				}
+				break;
+			case 6: {
+				// Splice in the end of another input.
+				pthread_mutex_lock(&corpus_lock);
+				fuzz_input_t *other = &corpus[rng_below(rng, corpus_len)];
+				size_t from = other->len ? rng_below(rng, other->len) : 0;
+				size_t n = other->len - from;
+				if (pos + n > FUZZ_INPUT_MAX) n = FUZZ_INPUT_MAX - pos;
+				memcpy(input->data + pos, other->data + from, n);
+				pthread_mutex_unlock(&corpus_lock);
+				if (pos + n > input->len) input->len = pos + n;
+			} break;
+		}
+	}
+}
+
+// Runs an input from the boot snapshot.
+// Returns FUZZ_OK or how it crashed.
+static int execute(fuzz_worker_t *self, const fuzz_input_t *input) {
+	machine_t *m = &self->m;
+	gr8cpurev3_t *cpu = &m->cpu;
+	// Only the pages the last input changed are copied back.
+	snapshot_restore(&self->snapctx, self->boot);
+	cpu->covPrevPC = 0;
+	self->execs ++;
+	uint64_t start = cpu->numCycles;
+	size_t fed = 0;
+	bool waiting = false;
+	int res = EXC_NORM;
+	while (res == EXC_NORM) {
+		while (fed < input->len && machine_key(m, input->data[fed])) fed ++;
+		if (fed == input->len && m->keyb.start == m->keyb.end) {
+			// Done once it reads the keyboard with nothing left to take.
+			if (waiting && m->keyb_polled) break;
+			waiting = true;
+			m->keyb_polled = false;
+		}
+		if (cpu->numCycles - start >= max_cycles) {
+			// The loop it's stuck in starts wherever the PC is lowest.
+			self->crash_at = cpu->regPC;
+			for (int i = 0; i < FUZZ_CHUNK && res == EXC_NORM; i++) {
+				res = gr8cpurev3_tick(cpu, 1, TICK_NORMAL << 16);
+				if (cpu->regPC < self->crash_at) self->crash_at = cpu->regPC;
+			}
+			return FUZZ_TIMEOUT;
+		}
+		res = gr8cpurev3_tick(cpu, FUZZ_CHUNK, TICK_NORMAL << 16);
+	}
+	self->crash_at = cpu->regPC;
+	if (res == EXC_OVERFLOW) return FUZZ_OVERFLOW;
+	if (res == EXC_NOINSN)   return FUZZ_NOINSN;
+	// Writes to ROM go to the RAM under it, which the firmware can't see.
+	for (size_t i = 0; i * SNAP_PAGE_SIZE < rom_len; i++) {
+		if (!self->snapctx.dirty[i]) continue;
+		size_t len = rom_len - i * SNAP_PAGE_SIZE;
+		if (len > SNAP_PAGE_SIZE) len = SNAP_PAGE_SIZE;
+		uint8_t *page = m->ram + i * SNAP_PAGE_SIZE;
+		for (size_t j = 0; j < len; j++) {
+			if (page[j] != self->boot->pages[i]->data[j]) {
+				self->crash_at = i * SNAP_PAGE_SIZE + j;
+				return FUZZ_ROM_WRITE;
+			}
+		}
+	}
+	return FUZZ_OK;
+}
+
+// Adds what this worker covered to what everyone covered.
+// Returns true if any of it was new.
+static bool merge_coverage(fuzz_worker_t *self) {
+	const uint8_t *local = (const uint8_t *) &self->cov;
+	// Usually nothing changed, which memcmp finds out a lot faster.
+	if (!memcmp(local, self->seen, sizeof(self->seen))) return false;
+	memcpy(self->seen, local, sizeof(self->seen));
+	bool found = false;
+	for (size_t i = 0; i < FUZZ_COV_WORDS; i++) {
+		uint64_t word;
+		memcpy(&word, local + i * sizeof(uint64_t), sizeof(uint64_t));
+		if (word & ~__atomic_load_n(&virgin[i], __ATOMIC_RELAXED)) {
+			uint64_t old = __atomic_fetch_or(&virgin[i], word, __ATOMIC_RELAXED);
+			found |= (word & ~old) != 0;
+		}
+	}
+	return found;
+}
+
+// Keeps a crash if nothing crashed the same way at the same place before.
+static void keep_crash(fuzz_worker_t *self, const fuzz_input_t *input, int crash) {
+	uint16_t at = self->crash_at;
+	if (__atomic_exchange_n(&crash_seen[crash][at], 1, __ATOMIC_RELAXED)) return;
+	__atomic_fetch_add(&crashes, 1, __ATOMIC_RELAXED);
+	char path[strlen(crash_dir) + 32];
+	sprintf(path, "%s/%s-%04x", crash_dir, crash_names[crash], at);
+	write_file(path, input);
+}
+
+// Boots a machine to its first keyboard read.
+static bool worker_boot(fuzz_worker_t *self) {
+	machine_t *m = &self->m;
+	machine_init(m, rom, rom_len);
+	m->cpu.coverage = &self->cov;
+	snapctx_init(&self->snapctx, &m->cpu, &m->bus);
+	int res = EXC_NORM;
+	while (res == EXC_NORM && !m->keyb_polled && m->cpu.numCycles < boot_cycles) {
+		res = gr8cpurev3_tick(&m->cpu, 1, TICK_NORMAL << 16);
+	}
+	if (!m->keyb_polled) return false;
+	self->boot = snapshot_take(&self->snapctx);
+	return self->boot;
+}
+
+static void *worker(void *arg) {
+	fuzz_worker_t *self = arg;
+	fuzz_input_t input;
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&corpus_lock);
+		input = corpus[rng_below(&self->rng, corpus_len)];
+		pthread_mutex_unlock(&corpus_lock);
+		mutate(self, &input);
+		int crash = execute(self, &input);
+		bool found = merge_coverage(self);
+		if (crash) {
+			keep_crash(self, &input, crash);
+		} else if (found) {
+			corpus_add(&input, true);
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	// Parse the options.
+	int workers = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t seconds = 0;
+	uint64_t seed = time(NULL);
+	char *rom_path = NULL;
+	int i;
+	for (i = 1; i < argc; i++) {
+		char *end = NULL;
+		if (i == argc - 1 || *argv[i] != '-') {
+			break;
+		} else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+			workers = strtoul(argv[++ i], &end, 10);
+		} else if (!strcmp(argv[i], "--max-cycles")) {
+			max_cycles = strtoull(argv[++ i], &end, 10);
+		} else if (!strcmp(argv[i], "--boot-cycles")) {
+			boot_cycles = strtoull(argv[++ i], &end, 10);
+		} else if (!strcmp(argv[i], "--time")) {
+			seconds = strtoull(argv[++ i], &end, 10);
+		} else if (!strcmp(argv[i], "--seed")) {
+			seed = strtoull(argv[++ i], &end, 10);
+		} else {
+			break;
+		}
+		if (*end) break;
+	}
+	if (argc - i == 3) {
+		rom_path   = argv[i];
+		corpus_dir = argv[i + 1];
+		crash_dir  = argv[i + 2];
+	}
+	if (!rom_path || workers < 1 || !max_cycles) {
+		printf("%s [options] rom corpus crashes\n\n", *argv);
+		printf("    -j count\n");
+		printf("    --jobs count\n");
+		printf("                Number of worker threads, one per CPU by default.\n\n");
+		printf("    --max-cycles count\n");
+		printf("                Cycles an input may take, %d by default.\n\n", FUZZ_CYCLES);
+		printf("    --boot-cycles count\n");
+		printf("                Most cycles to boot for before the keyboard is read.\n\n");
+		printf("    --time seconds\n");
+		printf("                Stop after this long, runs until killed by default.\n\n");
+		printf("    --seed number\n");
+		printf("                Seed for the mutations, the time by default.\n\n");
+		printf("Types mutated inputs from the corpus directory on the keyboard, adding the\n");
+		printf("ones that find new coverage to it. Crashing inputs go to the crashes directory,\n");
+		printf("named after how and where they crashed. See src/fuzz/fuzz.h for what crashes.\n");
+		return 2;
+	}
+	// Load the ROM and the corpus.
+	size_t len = MMIO_PAGE;
+	rom = malloc(len);
+	if (!rom || !read_file(rom_path, rom, &len) || len >= MMIO_PAGE) {
+		fprintf(stderr, "Could not load '%s'\n", rom_path);
+		return 2;
+	}
+	rom_len = len;
+	if (!corpus_load()) return 2;
+	// The core reports errors on stdout, which would be a lot of noise here.
+	if (!freopen("/dev/null", "w", stdout)) return 2;
+	// Boot every worker.
+	fuzz_worker_t *pool = calloc(workers, sizeof(fuzz_worker_t));
+	if (!pool) {
+		fputs("Out of memory\n", stderr);
+		return 2;
+	}
+	for (i = 0; i < workers; i++) {
+		pool[i].rng = (seed + i) * 0x9e3779b97f4a7c15 | 1;
+		if (!worker_boot(&pool[i])) {
+			fprintf(stderr, "'%s' didn't read the keyboard within %lu cycles\n", rom_path, boot_cycles);
+			return 2;
+		}
+	}
+	// Run the existing corpus once so only new coverage counts.
+	for (size_t j = 0; j < corpus_len; j++) {
+		fuzz_input_t input = corpus[j];
+		int crash = execute(&pool[0], &input);
+		merge_coverage(&pool[0]);
+		if (crash) keep_crash(&pool[0], &input, crash);
+	}
+	pthread_t threads[workers];
+	for (i = 0; i < workers; i++) {
+		pthread_create(&threads[i], NULL, worker, &pool[i]);
+	}
+	// Report progress every second.
+	uint64_t start = millis();
+	uint64_t last_execs = 0;
+	while (!seconds || millis() - start < seconds * 1000) {
+		sleep(1);
+		uint64_t execs = 0;
+		for (i = 0; i < workers; i++) execs += __atomic_load_n(&pool[i].execs, __ATOMIC_RELAXED);
+		size_t covered = 0;
+		for (size_t j = 0; j < FUZZ_COV_WORDS; j++) {
+			covered += __builtin_popcountll(__atomic_load_n(&virgin[j], __ATOMIC_RELAXED));
+		}
+		pthread_mutex_lock(&corpus_lock);
+		size_t entries = corpus_len;
+		pthread_mutex_unlock(&corpus_lock);
+		fprintf(stderr, "%lus: %lu execs, %lu/s, corpus %zu, covered %zu, crashes %zu\n",
+				(millis() - start) / 1000, execs, execs - last_execs, entries, covered,
+				__atomic_load_n(&crashes, __ATOMIC_RELAXED));
+		last_execs = execs;
+	}
+	__atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+	for (i = 0; i < workers; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	return crashes != 0;
+}
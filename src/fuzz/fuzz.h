@@ -0,0 +1,61 @@
+
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "../machine.h"
+#include "../snapshot.h"
+
+// Longest input to try.
+#define FUZZ_INPUT_MAX 256
+// Cycles to run at a time, between feeding the keyboard.
+// Also how long a timed out input is watched to find its loop.
+#define FUZZ_CHUNK     256
+// Cycle limit of an input that doesn't set one, running longer is a crash.
+#define FUZZ_CYCLES    100000
+// Most cycles to boot for before the keyboard is first read.
+#define FUZZ_BOOT      10000000
+// Words of coverage compared after every input, all of gr8cpurev3_cov_t.
+#define FUZZ_COV_WORDS ((65536 * 2 + COV_ROWS) / sizeof(uint64_t))
+
+/*
+
+Inputs are typed on the keyboard of a machine booted to its first keyboard read.
+An input is done when the firmware reads the keyboard again after taking all of
+it, or halts. Inputs that find new coverage go to the corpus, and inputs that:
+	overflow     end in EXC_OVERFLOW,
+	no_insn      end in EXC_NOINSN,
+	rom_write    change the RAM hidden under the ROM,
+	timeout      aren't done within the cycle limit,
+are crashes. One input is kept per kind of crash and address: the PC for most,
+the address written for rom_write and the lowest PC of the loop for timeout.
+
+*/
+
+// Ways an input can crash the firmware.
+#define FUZZ_OK        0
+#define FUZZ_OVERFLOW  1
+#define FUZZ_NOINSN    2
+#define FUZZ_ROM_WRITE 3
+#define FUZZ_TIMEOUT   4
+
+typedef struct fuzz_input {
+	uint8_t data[FUZZ_INPUT_MAX];
+	size_t  len;
+} fuzz_input_t;
+
+// A worker, with its own machine booted from the ROM.
+typedef struct fuzz_worker {
+	machine_t        m;
+	snapctx_t        snapctx;
+	snapshot_t      *boot;
+	gr8cpurev3_cov_t cov;
+	uint8_t          seen[FUZZ_COV_WORDS * sizeof(uint64_t)]; // cov as of the last merge.
+	uint64_t         rng;
+	uint64_t         execs;
+	uint16_t         crash_at;          // Address of the last crash.
+} fuzz_worker_t;
+
+#endif //FUZZ_H
@@ -0,0 +1,122 @@
+
+#include "headless.h"
+#include "main.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static FILE *console;
+
+static void console_out(machine_t *m, uint8_t value) {
+	putc(value, console);
+}
+
+// Runs the machine without a TTY, as fast as possible, until it stops.
+// Console output goes to stdout or --console, keyboard input comes from --input.
+// A summary is written to stderr as JSON.
+int headless_run() {
+	gr8cpurev3_t *cpu = &machine.cpu;
+	// Console output, buffered a lot because it's often a lot.
+	console = options.console_file ? fopen(options.console_file, "wb") : stdout;
+	if (!console) {
+		fprintf(stderr, "Could not open '%s'\n", options.console_file);
+		return HEADLESS_ERROR;
+	}
+	setvbuf(console, NULL, _IOFBF, HEADLESS_BUFFER);
+	machine.console = console_out;
+	// Keyboard input, taken from the file as the guest reads it.
+	static input_stream_t input;
+	if (options.input_file) {
+		if (!input_stream_open(&input, options.input_file, options.input_pace)) {
+			fprintf(stderr, "Could not read '%s'\n", options.input_file);
+			return HEADLESS_ERROR;
+		}
+		machine.input = &input;
+	}
+	// Stopping at a PC is a breakpoint with a different name.
+	uint16_t breakpoints[options.breakpoints_len + 1];
+	memcpy(breakpoints, options.breakpoints, options.breakpoints_len * sizeof(uint16_t));
+	cpu->breakpoints    = breakpoints;
+	cpu->breakpointsLen = options.breakpoints_len;
+	if (options.has_until_pc) {
+		breakpoints[cpu->breakpointsLen ++] = options.until_pc;
+	}
+	// Run until something stops it.
+	uint64_t start   = nanos();
+	uint64_t timeout = options.timeout * 1000000000;
+	uint64_t cycles  = cpu->numCycles;
+	int res = EXC_NORM;
+	bool timed_out = false;
+	while (res == EXC_NORM && cpu->numCycles - cycles < options.max_cycles) {
+		if (machine.input && (machine.keyb_polled || cpu->sleeping) && machine.keyb.start == machine.keyb.end) {
+			// The guest is waiting for input, so wait for the pipe a bit instead of spinning.
+			input_stream_wait(machine.input, 1);
+			machine_feed(&machine);
+			machine.keyb_polled = false;
+		}
+		dev_uart_poll(&machine.uart_dev, true);
+		uint64_t n = options.max_cycles - (cpu->numCycles - cycles);
+		res = gr8cpurev3_tick(cpu, n < HEADLESS_CHUNK ? n : HEADLESS_CHUNK, TICK_MODE_NORMAL);
+		if (timeout && nanos() - start >= timeout) {
+			timed_out = res == EXC_NORM;
+			break;
+		}
+	}
+	double secs = (nanos() - start) / 1000000000.0;
+	fflush(console);
+	if (console != stdout) fclose(console);
+	machine.console = NULL;
+	if (machine.input) {
+		input_stream_close(machine.input);
+		machine.input = NULL;
+	}
+	cpu->breakpoints    = options.breakpoints;
+	cpu->breakpointsLen = options.breakpoints_len;
+	// Work out why it stopped.
+	const char *result;
+	int ret;
+	if (timed_out) {
+		result = "timeout";
+		ret    = HEADLESS_TIMEOUT;
+	} else if (res == EXC_NORM) {
+		result = "max_cycles";
+		ret    = HEADLESS_LIMIT;
+	} else if (res == EXC_HALT) {
+		result = "halt";
+		ret    = HEADLESS_OK;
+	} else if (res == EXC_BRK && options.has_until_pc && cpu->regPC == options.until_pc) {
+		result = "until_pc";
+		ret    = HEADLESS_OK;
+	} else if (res == EXC_BRK || res == EXC_WATCH) {
+		result = exc_desc(res);
+		ret    = HEADLESS_BREAK;
+	} else {
+		result = exc_desc(res);
+		ret    = HEADLESS_ERROR;
+	}
+	// Summarise.
+	cycles = cpu->numCycles - cycles;
+	fprintf(stderr, "{\"result\":\"%s\",\"cycles\":%lu,\"insns\":%lu,\"seconds\":%.6f,\"mhz\":%.3f,",
+			result, cpu->numCycles, cpu->numInsns, secs, secs > 0 ? cycles / secs / 1000000.0 : 0.0);
+	fprintf(stderr, "\"regs\":{\"pc\":%u,\"a\":%u,\"b\":%u,\"x\":%u,\"y\":%u,\"sp\":%u,\"flags\":%u}",
+			cpu->regPC, cpu->regA, cpu->regB, cpu->regX, cpu->regY, cpu->stackPtr, gr8cpurev3_readflags(cpu));
+	char label[ASM_NAME_LEN + 8];
+	if (asm_symbolize(&program.symbols, cpu->regPC, label, sizeof(label))) {
+		fprintf(stderr, ",\"label\":\"%s\"", label);
+	}
+	// Regions the guest measured, if any.
+	if (machine.perf_regions.used) {
+		const char *sep = "";
+		fputs(",\"regions\":[", stderr);
+		for (int i = 0; i < PERF_REGIONS; i++) {
+			perf_region_t *region = &machine.perf_regions.region[i];
+			if (!region->count) continue;
+			fprintf(stderr, "%s{\"id\":%d,\"count\":%lu,\"cycles\":%lu,\"insns\":%lu,\"seconds\":%.9f}",
+					sep, i, region->count, region->cycles, region->insns, region->nanos / 1000000000.0);
+			sep = ",";
+		}
+		fputc(']', stderr);
+	}
+	fputs("}\n", stderr);
+	return ret;
+}
@@ -0,0 +1,26 @@
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Cycles to run at a time, between feeding the keyboard and checking the clock.
+#define HEADLESS_CHUNK  4096
+// Size of the console output buffer.
+#define HEADLESS_BUFFER (1 << 20)
+
+// Why a headless run stopped, which is also its exit code.
+#define HEADLESS_OK      0  // Halted, or reached --until-pc.
+#define HEADLESS_ERROR   1
+#define HEADLESS_BREAK   2
+#define HEADLESS_LIMIT   3
+#define HEADLESS_TIMEOUT 4
+
+// Runs the machine without a TTY, as fast as possible, until it stops.
+// Console output goes to stdout or --console, keyboard input comes from --input.
+// A summary is written to stderr as JSON.
+int headless_run();
+
+#endif //HEADLESS_H
@@ -0,0 +1,64 @@
+
+#include "input_stream.h"
+#include "machine.h"
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+// Opens a file for keyboard input, - for stdin.
+// Returns false if it can't be opened.
+bool input_stream_open(input_stream_t *stream, const char *path, uint64_t pace) {
+	memset(stream, 0, sizeof(input_stream_t));
+	// FIFOs are opened blocking, or there would be no input until a writer shows up.
+	stream->fd   = strcmp(path, "-") ? open(path, O_RDONLY) : dup(STDIN_FILENO);
+	stream->pace = pace;
+	return stream->fd >= 0;
+}
+
+// Closes the file.
+void input_stream_close(input_stream_t *stream) {
+	if (stream->fd >= 0) close(stream->fd);
+	stream->fd  = -1;
+	stream->eof = true;
+}
+
+// Reads more if everything read was used up.
+static void input_stream_read(input_stream_t *stream) {
+	if (stream->start < stream->end || stream->eof) return;
+	// Don't wait for pipes in the middle of emulating. The file stays blocking,
+	// since stdin's flags would change for whoever else has it too.
+	struct pollfd pfd = { .fd = stream->fd, .events = POLLIN };
+	if (poll(&pfd, 1, 0) <= 0) return;
+	ssize_t len = read(stream->fd, stream->buf, INPUT_STREAM_BUF);
+	stream->start = 0;
+	stream->end   = len > 0 ? len : 0;
+	if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)) {
+		stream->eof = true;
+	}
+}
+
+// Moves as much input to the keyboard buffer as fits and the pacing allows.
+// Never waits for input that isn't there yet.
+void input_stream_feed(input_stream_t *stream, keybbuf_t *keyb, uint64_t cycle) {
+	while (cycle >= stream->next_cycle) {
+		input_stream_read(stream);
+		if (stream->start == stream->end || !keybbuf_add(keyb, stream->buf[stream->start])) return;
+		stream->start ++;
+		stream->fed ++;
+		if (stream->pace) stream->next_cycle = cycle + stream->pace;
+	}
+}
+
+// Waits at most timeout milliseconds for more input to read.
+void input_stream_wait(input_stream_t *stream, int timeout) {
+	if (stream->start < stream->end || stream->eof) return;
+	struct pollfd pfd = { .fd = stream->fd, .events = POLLIN };
+	poll(&pfd, 1, timeout);
+}
+
+// Tells whether all input was given to the keyboard.
+bool input_stream_done(input_stream_t *stream) {
+	return stream->eof && stream->start == stream->end;
+}
@@ -0,0 +1,41 @@
+
+#ifndef INPUT_STREAM_H
+#define INPUT_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Bytes read from the file at a time.
+#define INPUT_STREAM_BUF 65536
+
+typedef struct keybbuf keybbuf_t;
+
+// Keyboard input from a file, FIFO or pipe.
+// It is only read from when there's room, so writers to a pipe are held up
+// instead of having their input dropped.
+typedef struct input_stream {
+	int      fd;
+	bool     eof;
+	uint8_t  buf[INPUT_STREAM_BUF];
+	size_t   start;
+	size_t   end;
+	uint64_t pace;                      // Cycles between characters, 0 to not wait.
+	uint64_t next_cycle;                // Earliest cycle for the next character.
+	uint64_t fed;                       // Characters given to the keyboard so far.
+} input_stream_t;
+
+// Opens a file for keyboard input, - for stdin.
+// Returns false if it can't be opened.
+bool input_stream_open(input_stream_t *stream, const char *path, uint64_t pace);
+// Closes the file.
+void input_stream_close(input_stream_t *stream);
+// Moves as much input to the keyboard buffer as fits and the pacing allows.
+// Never waits for input that isn't there yet.
+void input_stream_feed(input_stream_t *stream, keybbuf_t *keyb, uint64_t cycle);
+// Waits at most timeout milliseconds for more input to read.
+void input_stream_wait(input_stream_t *stream, int timeout);
+// Tells whether all input was given to the keyboard.
+bool input_stream_done(input_stream_t *stream);
+
+#endif //INPUT_STREAM_H
@@ -0,0 +1,26 @@
+
+#include "json_utils.h"
+
+// Writes a quoted and escaped JSON string.
+void json_write_string(FILE *fd, const char *str, size_t len) {
+	fputc('"', fd);
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = str[i];
+		if (c == '"' || c == '\\') {
+			fputc('\\', fd);
+			fputc(c, fd);
+		} else if (c == '\n') {
+			fputs("\\n", fd);
+		} else if (c == '\r') {
+			fputs("\\r", fd);
+		} else if (c == '\t') {
+			fputs("\\t", fd);
+		} else if (c < ' ' || c >= 0x7f) {
+			// Keep the raw bytes, the guest isn't UTF-8.
+			fprintf(fd, "\\u%04x", c);
+		} else {
+			fputc(c, fd);
+		}
+	}
+	fputc('"', fd);
+}
@@ -0,0 +1,11 @@
+
+#ifndef JSON_UTILS_H
+#define JSON_UTILS_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Writes a quoted and escaped JSON string.
+void json_write_string(FILE *fd, const char *str, size_t len);
+
+#endif //JSON_UTILS_H
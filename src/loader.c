@@ -0,0 +1,333 @@
+#define _GNU_SOURCE
+#include "loader.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+char program_error[256];
+
+// Where a segment goes, and which part of its file.
+typedef struct load_seg {
+	uint16_t address;
+	bool     rom;
+	char    *path;
+	size_t   offset;
+	size_t   len;                       // SIZE_MAX for all of it.
+	int      type;
+} load_seg_t;
+
+// Guesses the type of an image from its name.
+static int guess_type(const char *path) {
+	const char *ext = strrchr(path, '.');
+	if (!ext) return EXEC_TYPE_RAW;
+	if (!strcasecmp(ext, ".lhf") || !strcasecmp(ext, ".hex")) return EXEC_TYPE_LHF;
+	if (!strcasecmp(ext, ".map")) return EXEC_TYPE_MAP;
+	if (!strcasecmp(ext, ".asm") || !strcasecmp(ext, ".s")) return EXEC_TYPE_ASM;
+	return EXEC_TYPE_RAW;
+}
+
+// Keeps a mapping to unmap when the program is freed.
+// Returns NULL, unmapping it, if the program has too many.
+static void *keep_map(program_t *prog, void *map, size_t len) {
+	if (prog->maps_len == LOAD_MAPS) {
+		if (map != MAP_FAILED) munmap(map, len);
+		snprintf(program_error, sizeof(program_error), "more than %d mappings", LOAD_MAPS);
+		return NULL;
+	}
+	prog->maps[prog->maps_len]     = map;
+	prog->map_lens[prog->maps_len] = len;
+	prog->maps_len ++;
+	return map;
+}
+
+// Maps a whole file read-only.
+static uint8_t *map_file(program_t *prog, const char *path, size_t *len) {
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st)) {
+		snprintf(program_error, sizeof(program_error), "%s: cannot open file", path);
+		if (fd >= 0) close(fd);
+		return NULL;
+	}
+	*len = st.st_size;
+	if (!*len) {
+		close(fd);
+		snprintf(program_error, sizeof(program_error), "%s: file is empty", path);
+		return NULL;
+	}
+	void *map = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		snprintf(program_error, sizeof(program_error), "%s: cannot map file", path);
+		return NULL;
+	}
+	return keep_map(prog, map, *len);
+}
+
+// Parses an LHF image into dest, which has room for max bytes.
+// Returns the number of bytes, or -1 on error.
+static ssize_t parse_lhf(const char *path, const uint8_t *text, size_t len, uint8_t *dest, size_t max) {
+	const uint8_t *end = text + len;
+	const uint8_t *pos = text;
+	int line = 1;
+	size_t out = 0;
+	// The header.
+	if (len < 8 || memcmp(text, "v2.0 raw", 8)) {
+		snprintf(program_error, sizeof(program_error), "%s:1: not an LHF file, expected \"v2.0 raw\"", path);
+		return -1;
+	}
+	pos += 8;
+	while (pos < end) {
+		uint8_t c = *pos;
+		if (c == '\n') {
+			line ++;
+			pos ++;
+		} else if (c == ' ' || c == '\t' || c == '\r') {
+			pos ++;
+		} else if (c == '#') {
+			while (pos < end && *pos != '\n') pos ++;
+		} else {
+			// A token: value, or count*value.
+			uint64_t count = 1;
+			uint64_t value = 0;
+			int digits = 0;
+			for (; pos < end && ((*pos >= '0' && *pos <= '9') || ((*pos | 0x20) >= 'a' && (*pos | 0x20) <= 'f')); pos++, digits++) {
+				value = value * 16 + (*pos <= '9' ? *pos - '0' : (*pos | 0x20) - 'a' + 10);
+				if (value > 0xffffffff) break;
+			}
+			if (pos < end && *pos == '*' && digits) {
+				// That was the count, which is decimal.
+				const uint8_t *start = pos - digits;
+				count = 0;
+				for (const uint8_t *p = start; p < pos; p++) {
+					if (*p > '9' || count > 0xffffff) {
+						snprintf(program_error, sizeof(program_error), "%s:%d: bad repeat count", path, line);
+						return -1;
+					}
+					count = count * 10 + (*p - '0');
+				}
+				pos ++;
+				value  = 0;
+				digits = 0;
+				for (; pos < end && ((*pos >= '0' && *pos <= '9') || ((*pos | 0x20) >= 'a' && (*pos | 0x20) <= 'f')); pos++, digits++) {
+					value = value * 16 + (*pos <= '9' ? *pos - '0' : (*pos | 0x20) - 'a' + 10);
+					if (value > 0xffffffff) break;
+				}
+			}
+			if (!digits || (pos < end && *pos != ' ' && *pos != '\t' && *pos != '\r' && *pos != '\n' && *pos != '#')) {
+				snprintf(program_error, sizeof(program_error), "%s:%d: expected a hex byte", path, line);
+				return -1;
+			}
+			if (value > 0xff) {
+				snprintf(program_error, sizeof(program_error), "%s:%d: %lx doesn't fit in a byte", path, line, (unsigned long) value);
+				return -1;
+			}
+			if (count > max - out) {
+				snprintf(program_error, sizeof(program_error), "%s:%d: image is over %zu bytes, it runs into the MMIO page", path, line, max);
+				return -1;
+			}
+			memset(dest + out, value, count);
+			out += count;
+		}
+	}
+	return out;
+}
+
+// Reads a load map into segments, count is how many were read even on errors.
+static bool parse_map(program_t *prog, const char *path, load_seg_t *segs, int *count) {
+	size_t len;
+	const char *text = (const char *) map_file(prog, path, &len);
+	if (!text) return false;
+	// Paths are relative to the map.
+	char *copy = strdup(path);
+	char *dir  = dirname(copy);
+	*count = 0;
+	int line_no = 0;
+	const char *pos = text;
+	while (pos < text + len) {
+		const char *eol = memchr(pos, '\n', text + len - pos);
+		if (!eol) eol = text + len;
+		line_no ++;
+		char line[512];
+		size_t line_len = eol - pos < (long) sizeof(line) - 1 ? eol - pos : sizeof(line) - 1;
+		memcpy(line, pos, line_len);
+		line[line_len] = 0;
+		pos = eol + 1;
+		char *hash = strchr(line, '#');
+		if (hash) *hash = 0;
+		char addr[16], kind[8], file[400];
+		unsigned long offset = 0, length = SIZE_MAX;
+		int n = sscanf(line, "%15s %7s %399s %lx %lx", addr, kind, file, &offset, &length);
+		if (n <= 0) continue;
+		char *end;
+		unsigned long address = strtoul(addr, &end, 16);
+		if (n < 3 || *end || address >= MMIO_PAGE || (strcmp(kind, "rom") && strcmp(kind, "ram"))) {
+			snprintf(program_error, sizeof(program_error), "%s:%d: expected address, rom or ram, and a path", path, line_no);
+			free(copy);
+			return false;
+		}
+		if (*count == LOAD_SEGMENTS) {
+			snprintf(program_error, sizeof(program_error), "%s:%d: more than %d segments", path, line_no, LOAD_SEGMENTS);
+			free(copy);
+			return false;
+		}
+		load_seg_t *seg = &segs[(*count) ++];
+		seg->address = address;
+		seg->rom     = !strcmp(kind, "rom");
+		seg->offset  = offset;
+		seg->len     = length;
+		if (*file == '/') {
+			seg->path = strdup(file);
+		} else {
+			seg->path = malloc(strlen(dir) + strlen(file) + 2);
+			sprintf(seg->path, "%s/%s", dir, file);
+		}
+		seg->type = guess_type(seg->path);
+		if (seg->type == EXEC_TYPE_MAP) {
+			snprintf(program_error, sizeof(program_error), "%s:%d: segments can't be load maps", path, line_no);
+			free(copy);
+			return false;
+		}
+	}
+	free(copy);
+	return true;
+}
+
+// Finds the data of a segment, parsing it into dest if it's LHF.
+// Returns NULL on error.
+static const uint8_t *load_seg(program_t *prog, load_seg_t *seg, uint8_t *dest, size_t max, size_t *len) {
+	size_t file_len;
+	const uint8_t *data = map_file(prog, seg->path, &file_len);
+	if (!data) return NULL;
+	if (seg->type == EXEC_TYPE_ASM || seg->type == EXEC_TYPE_ASMV) {
+		const asm_result_t *res = asm_cached(seg->path, (const char *) data, file_len, seg->address);
+		if (!res) {
+			snprintf(program_error, sizeof(program_error), "%s", asm_error);
+			return NULL;
+		}
+		if (res->len > max) {
+			snprintf(program_error, sizeof(program_error), "%s: %zu bytes at %04x run into the MMIO page", seg->path, res->len, seg->address);
+			return NULL;
+		}
+		for (size_t i = 0; i < res->symbols.len; i++) {
+			asm_symbols_add(&prog->symbols, res->symbols.symbol[i].name, res->symbols.symbol[i].address);
+		}
+		*len = res->len;
+		return res->data;
+	}
+	if (seg->type == EXEC_TYPE_LHF) {
+		ssize_t got = parse_lhf(seg->path, data, file_len, dest, max);
+		if (got < 0) return NULL;
+		*len = got;
+		return dest;
+	}
+	if (seg->offset > file_len) {
+		snprintf(program_error, sizeof(program_error), "%s: offset %zx is past the end", seg->path, seg->offset);
+		return NULL;
+	}
+	*len = seg->len < file_len - seg->offset ? seg->len : file_len - seg->offset;
+	if (*len > max) {
+		snprintf(program_error, sizeof(program_error), "%s: %zu bytes at %04x don't fit in %zu", seg->path, *len, seg->address, max);
+		return NULL;
+	}
+	return data + seg->offset;
+}
+
+// Loads a program image of a type, see EXEC_TYPE_*.
+bool program_load(program_t *prog, const char *path, int type) {
+	memset(prog, 0, sizeof(program_t));
+	if (type == EXEC_TYPE_AUTO) type = guess_type(path);
+	load_seg_t segs[LOAD_SEGMENTS];
+	int count = 0;
+	if (type == EXEC_TYPE_MAP) {
+		if (!parse_map(prog, path, segs, &count)) goto fail;
+		if (!count) {
+			snprintf(program_error, sizeof(program_error), "%s: no segments", path);
+			goto fail;
+		}
+	} else {
+		segs[0] = (load_seg_t) { 0, true, strdup(path), 0, SIZE_MAX, type };
+		count = 1;
+	}
+	// A single raw ROM image runs straight from its mapping, and assembly from the cache.
+	if (count == 1 && segs[0].rom && segs[0].address == 0 && segs[0].type != EXEC_TYPE_LHF) {
+		size_t len;
+		// Raw ones may be bigger than the address space, the MMU banks the rest.
+		size_t max = segs[0].type == EXEC_TYPE_RAW ? MMU_ROM_MAX : MMIO_PAGE;
+		const uint8_t *data = load_seg(prog, &segs[0], NULL, max, &len);
+		if (!data) goto fail;
+		prog->rom     = (uint8_t *) data;
+		prog->rom_len = len;
+	} else {
+		// Everything else is put together in memory, only pages written take up any.
+		uint8_t *rom = keep_map(prog, mmap(NULL, MMIO_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0), MMIO_PAGE);
+		uint8_t *ram = keep_map(prog, mmap(NULL, MMIO_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0), MMIO_PAGE);
+		if (!rom || !ram) goto fail;
+		if (rom == MAP_FAILED || ram == MAP_FAILED) {
+			snprintf(program_error, sizeof(program_error), "out of memory");
+			goto fail;
+		}
+		uint8_t used[MMIO_PAGE / 8] = {0};
+		for (int i = 0; i < count; i++) {
+			load_seg_t *seg = &segs[i];
+			uint8_t *dest = (seg->rom ? rom : ram) + seg->address;
+			size_t len;
+			const uint8_t *data = load_seg(prog, seg, dest, MMIO_PAGE - seg->address, &len);
+			if (!data) goto fail;
+			if (data != dest) memcpy(dest, data, len);
+			for (size_t j = seg->address; j < seg->address + len; j++) {
+				if (used[j / 8] & (1 << j % 8)) {
+					snprintf(program_error, sizeof(program_error), "%s: overlaps another segment at %04zx", seg->path, j);
+					goto fail;
+				}
+				used[j / 8] |= 1 << j % 8;
+			}
+			if (seg->rom) {
+				if (seg->address + len > prog->rom_len) prog->rom_len = seg->address + len;
+			} else if (len) {
+				prog->ram[prog->ram_len ++] = (program_segment_t) { seg->address, len, dest };
+			}
+		}
+		prog->rom = rom;
+		// RAM under the ROM can't be seen until it's written anyway.
+		for (size_t i = 0; i < prog->ram_len; i++) {
+			if (prog->ram[i].address < prog->rom_len) {
+				snprintf(program_error, sizeof(program_error), "%s: RAM segment at %04x is hidden by the ROM", path, prog->ram[i].address);
+				goto fail;
+			}
+		}
+	}
+	if (!prog->rom_len) {
+		snprintf(program_error, sizeof(program_error), "%s: there is no ROM", path);
+		goto fail;
+	}
+	for (int i = 0; i < count; i++) free(segs[i].path);
+	return true;
+	
+	fail:
+	for (int i = 0; i < count; i++) free(segs[i].path);
+	program_free(prog);
+	return false;
+}
+
+// Puts the program in a machine that was just reset.
+void program_place(program_t *prog, machine_t *m) {
+	machine_rom(m, prog->rom, prog->rom_len);
+	for (size_t i = 0; i < prog->ram_len; i++) {
+		memcpy(m->ram + prog->ram[i].address, prog->ram[i].data, prog->ram[i].len);
+	}
+}
+
+// Unmaps everything the program used.
+void program_free(program_t *prog) {
+	asm_symbols_free(&prog->symbols);
+	for (size_t i = 0; i < prog->maps_len; i++) {
+		if (prog->maps[i] != MAP_FAILED) munmap(prog->maps[i], prog->map_lens[i]);
+	}
+	memset(prog, 0, sizeof(program_t));
+}
@@ -0,0 +1,78 @@
+
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "machine.h"
+#include "asm.h"
+
+// Kinds of program images.
+#define EXEC_TYPE_RAW  0
+#define EXEC_TYPE_LHF  1
+#define EXEC_TYPE_ASM  2
+#define EXEC_TYPE_ASMV 3
+#define EXEC_TYPE_MAP  4
+#define EXEC_TYPE_AUTO 0xff // By file extension, raw if there's none known.
+
+// Most segments in a load map.
+#define LOAD_SEGMENTS 32
+// Most mappings a program keeps: the map file, ROM and RAM, and a file per segment.
+#define LOAD_MAPS (LOAD_SEGMENTS + 3)
+
+/*
+
+Raw images are mapped read-only and run from the mapping, so any number of
+machines loading one share its pages. A single raw image may be bigger than the
+address space, up to MMU_ROM_MAX, with the rest reached through the MMU.
+
+Assembly sources are assembled in-process, see asm.h. Each source is only
+assembled once, by hash, and the ROM runs from the result.
+
+LHF files are Logisim memory images: a "v2.0 raw" line, then bytes in hex
+separated by whitespace. A byte may be repeated with count*byte, and # starts a
+comment. They are parsed straight into place, without reading the file first.
+
+Load maps put several images at other addresses, in ROM or in RAM:
+	# address kind path [offset [length]]
+	0000 rom boot.bin
+	8000 ram tables.lhf
+	c000 ram fonts.bin 100 800
+Images may also be assembly, which is assembled for its address.
+Numbers are hex, paths are relative to the map. Offset and length select part of
+a raw image. ROM always starts at 0 and ends at its last segment, with zeroes in
+between. RAM segments are written into RAM after every reset.
+
+*/
+
+// Part of RAM set after reset.
+typedef struct program_segment {
+	uint16_t       address;
+	uint16_t       len;
+	const uint8_t *data;
+} program_segment_t;
+
+typedef struct program {
+	uint8_t          *rom;
+	size_t            rom_len;
+	program_segment_t ram[LOAD_SEGMENTS];
+	size_t            ram_len;
+	asm_symbols_t     symbols;          // Labels of assembly sources.
+	// ==== MAPPINGS ====
+	void             *maps[LOAD_MAPS];
+	size_t            map_lens[LOAD_MAPS];
+	size_t            maps_len;
+} program_t;
+
+// What went wrong with the last load, with the file and line.
+extern char program_error[256];
+
+// Loads a program image of a type, see EXEC_TYPE_*.
+bool program_load(program_t *prog, const char *path, int type);
+// Puts the program in a machine that was just reset.
+void program_place(program_t *prog, machine_t *m);
+// Unmaps everything the program used.
+void program_free(program_t *prog);
+
+#endif //LOADER_H
@@ -0,0 +1,236 @@
+
+#include "machine.h"
+#include "common/default_isa.h"
+#include <string.h>
+
+static uint8_t keyb_dev_read(device_t *dev, uint16_t address, bool notouchy) {
+	machine_t *m = dev->ctx;
+	if (!notouchy) {
+		m->keyb_polled = true;
+		machine_feed(m);
+	}
+	return keybbuf_read(&m->keyb, notouchy);
+}
+
+static void console_dev_write(device_t *dev, uint16_t address, uint8_t value) {
+	machine_t *m = dev->ctx;
+	if (m->console) m->console(m, value);
+	// Unless the host says when it's done, it takes everything at once.
+	m->console_held = 1;
+	if (!m->console_async) machine_console_drained(m);
+}
+
+// Initialises a machine running a ROM, and resets it.
+void machine_init(machine_t *m, uint8_t *rom, size_t rom_len) {
+	memset(m, 0, sizeof(machine_t));
+	devbus_init(&m->bus, &m->cpu);
+	m->keyb_dev = (device_t) {
+		.name      = "keyboard",
+		.base      = KEYB_ADDR,
+		.len       = 1,
+		.read      = keyb_dev_read,
+		.irq       = INTC_KEYB,
+		.ctx       = m,
+		.state     = &m->keyb,
+		.state_len = sizeof(keybbuf_t)
+	};
+	devbus_attach(&m->bus, &m->keyb_dev);
+	m->console_dev = (device_t) {
+		.name  = "console",
+		.base  = CONSOLE_ADDR,
+		.len   = 1,
+		.write = console_dev_write,
+		.irq       = INTC_CONSOLE,
+		.ctx       = m,
+		.state     = &m->console_held,
+		.state_len = sizeof(m->console_held)
+	};
+	devbus_attach(&m->bus, &m->console_dev);
+	dev_timer_init(&m->timer_dev, &m->timer);
+	m->timer_dev.irq = INTC_TIMER;
+	devbus_attach(&m->bus, &m->timer_dev);
+	dev_disk_init(&m->disk_dev, &m->disk);
+	m->disk_dev.irq = INTC_DISK;
+	devbus_attach(&m->bus, &m->disk_dev);
+	dev_video_init(&m->video_dev, &m->video);
+	devbus_attach(&m->bus, &m->video_dev);
+	dev_uart_init(&m->uart_dev, &m->uart);
+	m->uart_dev.irq = INTC_UART;
+	devbus_attach(&m->bus, &m->uart_dev);
+	dev_perf_init(&m->perf_dev, &m->perf, &m->perf_regions);
+	devbus_attach(&m->bus, &m->perf_dev);
+	dev_mmu_init(&m->mmu_dev, &m->mmu, &m->mmu_banks);
+	devbus_attach(&m->bus, &m->mmu_dev);
+	dev_intc_init(&m->intc_dev, &m->intc);
+	devbus_attach(&m->bus, &m->intc_dev);
+	machine_rom(m, rom, rom_len);
+	machine_reset(m);
+}
+
+// Resets the CPU, RAM and peripherals.
+void machine_reset(machine_t *m) {
+	gr8cpurev3_t *cpu = &m->cpu;
+	// Flags.
+	cpu->flagCout = false;
+	cpu->flagZero = false;
+	cpu->flagIRQ = false;
+	cpu->flagNMI = false;
+	cpu->flagHWI = false;
+	cpu->wasHWI = false;
+	// Busses.
+	cpu->bus = 0;
+	cpu->adrBus = 0;
+	cpu->alo = 0;
+	// Stage.
+	cpu->stage = 0;
+	cpu->mode = MODE_LOAD;
+	cpu->schduledIRQ = -1;
+	cpu->schduledNMI = -1;
+	cpu->sleeping = false;
+	// Registers.
+	cpu->regA = 0;
+	cpu->regB = 0;
+	cpu->regX = 0;
+	cpu->regY = 0;
+	cpu->regIR = 0;
+	cpu->regPC = 0;
+	cpu->regAR = 0;
+	cpu->stackPtr = 0;
+	cpu->regIRQ = 0;
+	cpu->regNMI = 0;
+	// Debugger.
+	cpu->skipping = 0;
+	cpu->skipDepth = 0;
+	cpu->watchHit = false;
+	cpu->debugIRQ = false;
+	cpu->debugNMI = false;
+	// Instruction set.
+	cpu->isaRom = default_isa_rom;
+	cpu->isaRomLen = DEFAULT_ISA_ROM_LEN;
+	// Memory.
+	cpu->ram = m->ram;
+	memset(m->ram, 0, sizeof(m->ram));
+	// Statistics.
+	cpu->numCycles = 0;
+	cpu->numInsns = 0;
+	cpu->numSubs = 0;
+	m->bus.reads = 0;
+	m->bus.writes = 0;
+	// Peripherals.
+	m->keyb_polled = false;
+	m->console_held = 0;
+	devbus_reset(&m->bus);
+}
+
+// Puts a ROM of up to MMU_ROM_MAX bytes in the machine.
+// Past the MMIO page, only the first MMU_ROM_FIXED bytes are in place and the rest is banked.
+void machine_rom(machine_t *m, uint8_t *rom, size_t rom_len) {
+	m->cpu.rom    = rom;
+	m->cpu.romLen = rom_len > MMIO_PAGE ? MMU_ROM_FIXED : rom_len;
+	dev_mmu_rom(&m->mmu_dev, rom, rom_len);
+}
+
+// Frees what the machine allocated, but not the machine itself.
+void machine_free(machine_t *m) {
+	dev_mmu_free(&m->mmu_dev);
+}
+
+// Types a character on the keyboard.
+// Returns false if the keyboard buffer is full.
+bool machine_key(machine_t *m, char c) {
+	if (!keybbuf_add(&m->keyb, c)) return false;
+	device_raise_irq(&m->keyb_dev);
+	return true;
+}
+
+// Types what the input stream has ready, if there is one.
+void machine_feed(machine_t *m) {
+	if (!m->input) return;
+	size_t end = m->keyb.end;
+	input_stream_feed(m->input, &m->keyb, m->cpu.numCycles);
+	if (m->keyb.end != end) device_raise_irq(&m->keyb_dev);
+}
+
+// Raises INTC_CONSOLE if there was output the host hadn't taken, now that it has.
+void machine_console_drained(machine_t *m) {
+	if (!m->console_held) return;
+	m->console_held = 0;
+	device_raise_irq(&m->console_dev);
+}
+
+// Adds a character to the keyboard buffer.
+// Returns false if the buffer is full.
+bool keybbuf_add(keybbuf_t *keyb, char c) {
+	int next = (keyb->end + 1) % KEYB_BUF_LEN;
+	if (next != keyb->start) {
+		keyb->buf[keyb->end] = c;
+		keyb->end = next;
+		return true;
+	}
+	return false;
+}
+
+// Takes a character from the keyboard buffer, or 0 if it is empty.
+// If notouchy is set, the character is left in the buffer.
+char keybbuf_read(keybbuf_t *keyb, bool notouchy) {
+	if (keyb->start != keyb->end) {
+		char c = keyb->buf[keyb->start];
+		if (!notouchy) {
+			keyb->start = (keyb->start + 1) % KEYB_BUF_LEN;
+		}
+		return c;
+	}
+	return 0;
+}
+
+// Creates a copy of the keyboard buffer of at most len characters.
+// Buffer must be at least len+1 characters.
+void keybbuf_copy(keybbuf_t *keyb, char *dest, size_t len) {
+	size_t start = keyb->start;
+	size_t index = 0;
+	while (start != keyb->end && index < len) {
+		dest[index] = keyb->buf[start];
+		start = (start + 1) % KEYB_BUF_LEN;
+		index ++;
+	}
+	dest[index] = 0;
+}
+
+// Describes the result of a tick.
+const char *exc_desc(int exc) {
+	switch (exc) {
+		case EXC_ERR:       return "error";
+		case EXC_NORM:      return "normal";
+		case EXC_HALT:      return "halt";
+		case EXC_BRK:       return "breakpoint";
+		case EXC_OVERFLOW:  return "overflow";
+		case EXC_NOINSN:    return "no_insn";
+		case EXC_WAIT_STEP: return "wait_step";
+		case EXC_RESET:     return "reset";
+		case EXC_TCON:      return "continue";
+		case EXC_WATCH:     return "watchpoint";
+	}
+	return "unknown";
+}
+
+// Handler for MMIO reading.
+uint8_t gr8cpu_mmio_read(gr8cpurev3_t *cpu, uint16_t address, bool notouchy) {
+	return devbus_read(cpu->mmioCtx, address, notouchy);
+}
+
+// Handler for MMIO writing.
+void gr8cpu_mmio_write(gr8cpurev3_t *cpu, uint16_t address, uint8_t value) {
+	devbus_write(cpu->mmioCtx, address, value);
+}
+
+// Handler for peripherals that are due.
+void gr8cpu_mmio_event(gr8cpurev3_t *cpu) {
+	devbus_event(cpu->mmioCtx);
+}
+
+// Handler for writes to banked windows that have nowhere to go yet.
+uint8_t *gr8cpu_mmio_bank(gr8cpurev3_t *cpu, uint16_t address) {
+	devbus_t *bus = cpu->mmioCtx;
+	device_t *mmu = bus->map[MMU_WINDOW & 0xFF];
+	return mmu ? dev_mmu_fault(mmu, address) : NULL;
+}
@@ -0,0 +1,103 @@
+
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "common/GR8EMUr3_2.h"
+#include "devices.h"
+#include "dev_timer.h"
+#include "dev_disk.h"
+#include "dev_video.h"
+#include "dev_uart.h"
+#include "dev_perf.h"
+#include "dev_mmu.h"
+#include "dev_intc.h"
+#include "input_stream.h"
+
+// Peripheral addresses.
+// The keyboard raises INTC_KEYB for every character typed, and the console
+// raises INTC_CONSOLE once the host has taken all output. That is right away,
+// unless the host sets console_async and calls machine_console_drained itself.
+#define KEYB_ADDR    0xFEFC
+#define CONSOLE_ADDR 0xFEFD
+
+#define KEYB_BUF_LEN 32
+typedef struct keybbuf {
+	char   buf[KEYB_BUF_LEN];
+	size_t start;
+	size_t end;
+} keybbuf_t;
+
+typedef struct machine machine_t;
+
+// Receives console output.
+typedef void (*console_t)(machine_t *m, uint8_t value);
+
+// A CPU with its RAM and peripherals, independent of any other machine.
+struct machine {
+	gr8cpurev3_t  cpu;
+	devbus_t      bus;
+	// ==== PERIPHERALS ====
+	device_t      keyb_dev;
+	device_t      console_dev;
+	device_t      timer_dev;
+	device_t      disk_dev;
+	device_t      video_dev;
+	device_t      uart_dev;
+	device_t      perf_dev;
+	device_t      mmu_dev;
+	device_t      intc_dev;
+	keybbuf_t     keyb;
+	dev_timer_t   timer;
+	dev_disk_t    disk;             // Put a disk in with dev_disk_insert.
+	dev_video_t   video;
+	dev_uart_t    uart;             // Connect the host end with dev_uart_connect.
+	dev_perf_t    perf;
+	perf_regions_t perf_regions;    // Measured by the host, not part of the state.
+	dev_mmu_t     mmu;
+	mmu_banks_t   mmu_banks;        // Allocated as written.
+	dev_intc_t    intc;
+	bool          keyb_polled;      // Set when the guest reads from the keyboard.
+	uint8_t       console_held;     // Set while the host hasn't taken all console output.
+	bool          console_async;    // The host calls machine_console_drained.
+	input_stream_t *input;          // Optional, refills the keyboard as the guest reads it.
+	console_t     console;          // Console output is dropped if NULL.
+	void         *ctx;              // For the console.
+	// ==== MEMORY ====
+	uint8_t       ram[65536];
+};
+
+// Initialises a machine running a ROM, and resets it.
+void machine_init(machine_t *m, uint8_t *rom, size_t rom_len);
+// Resets the CPU, RAM and peripherals.
+void machine_reset(machine_t *m);
+// Puts a ROM of up to MMU_ROM_MAX bytes in the machine.
+// Past the MMIO page, only the first MMU_ROM_FIXED bytes are in place and the rest is banked.
+void machine_rom(machine_t *m, uint8_t *rom, size_t rom_len);
+// Frees what the machine allocated, but not the machine itself.
+void machine_free(machine_t *m);
+
+// Types a character on the keyboard.
+// Returns false if the keyboard buffer is full.
+bool machine_key(machine_t *m, char c);
+// Types what the input stream has ready, if there is one.
+void machine_feed(machine_t *m);
+// Raises INTC_CONSOLE if there was output the host hadn't taken, now that it has.
+void machine_console_drained(machine_t *m);
+
+// Adds a character to the keyboard buffer.
+// Returns false if the buffer is full.
+bool keybbuf_add(keybbuf_t *keyb, char c);
+// Takes a character from the keyboard buffer, or 0 if it is empty.
+// If notouchy is set, the character is left in the buffer.
+char keybbuf_read(keybbuf_t *keyb, bool notouchy);
+// Creates a copy of the keyboard buffer of at most len characters.
+// Buffer must be at least len+1 characters.
+void keybbuf_copy(keybbuf_t *keyb, char *dest, size_t len);
+
+// Describes the result of a tick.
+const char *exc_desc(int exc);
+
+#endif //MACHINE_H
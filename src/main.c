@@ -2,27 +2,108 @@
 #include "main.h"
 #include <time.h>
 #include <stdio.h>
-#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include "tty_utils.h"
 #include "utf_utils.h"
-#include "common/default_isa.h"
 #include "ibm437.h"
+#include "explore.h"
+#include "savestate.h"
+#include "record.h"
+#include "headless.h"
+#include "coverage.h"
+#include "tty_video.h"
+#include "disk.h"
+#include "tty_input.h"
+#include "spsc.h"
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
 
 int state = STATE_STOP;
+// Digits typed at the go to cycle prompt.
+static char goto_buf[21];
+static size_t goto_len;
 
-// Current state.
+// Current state, as far as the terminal knows.
 bool gr8cpu_running = false;
-static uint8_t ram_reserve[65536];
-gr8cpurev3_t cpu;
-size_t stats_mmio_r;
-size_t stats_mmio_w;
+machine_t machine;
+core_status_t core_status;
 
-// Keyboard buffer.
-char keyb_buf[KEYB_BUF_LEN];
-size_t keyb_buf_start = 0;
-size_t keyb_buf_end = 0;
+// The emulation thread owns the machine and everything that follows it, the
+// terminal only sends it commands and shows what it sends back.
+static pthread_t core;
+static bool core_running;
+static double core_hertz;
+// Commands, from the terminal.
+static spsc_t commands;
+static uint64_t commands_sent;
+// Console output and statuses, from the emulation thread.
+static spsc_t console_out;
+static spsc_t statuses;
+// Console output that didn't fit yet, from backlog_start on, and how much there was no memory for.
+static uint8_t *backlog;
+static size_t backlog_start;
+static size_t backlog_len;
+static size_t backlog_cap;
+static uint64_t dropped;
+
+// Commands.
+#define CMD_QUIT  0
+#define CMD_INPUT 1 // arg is the type, value the key.
+#define CMD_RUN   2 // arg is whether to.
+#define CMD_STEP  3 // arg is the tick mode, value the most cycles.
+#define CMD_CBACK 4
+#define CMD_IBACK 5
+#define CMD_RCONT 6
+#define CMD_GOTO  7 // value is the cycle.
+#define CMD_RESET 8 // arg is whether to say so on the console, as for the next two.
+#define CMD_SAVE  9
+#define CMD_LOAD  10
+#define CMD_FREQ  11 // arg is the frequency option.
+
+typedef struct core_cmd {
+	int      type;
+	int      arg;
+	uint64_t value;
+} core_cmd_t;
+
+// Commands the emulation thread had no room for yet, sent by core_retry.
+static core_cmd_t *unsent;
+static size_t unsent_len;
+static size_t unsent_cap;
+
+// Queue sizes.
+#define COMMANDS_LEN    256
+#define CONSOLE_OUT_LEN 65536
+#define STATUSES_LEN    4
+// Console output shown at once.
+#define CONSOLE_CHUNK   4096
+// Microseconds between statuses while running.
+#define STATUS_US       20000
+
+// Snapshots.
+snapctx_t snapctx;
+
+// Reverse execution.
+reverse_t rev;
+
+// Recording and replaying.
+static recorder_t recorder;
+static replay_t replay;
+static uint64_t replay_start;
+
+// The exec-file, placed again on every reset.
+program_t program;
+// Disk image behind -d.
+static disk_t disk;
+// The host end of the UART, if there is one.
+static serial_t serial;
+
+// Coverage, shared with --explore workers.
+static gr8cpurev3_cov_t *coverage;
 
 // Frequencies.
 static uint64_t delay;
@@ -78,13 +159,30 @@ uint32_t freq_cycles[N_FREQS] = {
 	1,      // 0.5Hz
 };
 
-static void set_blocking();
-static void set_nonblocking();
-static void handle_keyb(char c);
+static bool handle_key(int key);
+static void handle_keyb(int key);
 static void handle_run(char c);
 static void handle_stop(char c);
 static void handle_show(char c);
+static void handle_goto(int key);
 static void change_freq(char c);
+static void devices_init();
+static bool machine_input(int type, char c);
+static bool user_input(int type, char c);
+static void user_reset();
+static void user_went_back();
+static void replay_catch_up();
+static uint64_t replay_budget(uint64_t n);
+static bool parse_address(char *str, uint16_t *out);
+static bool parse_number(char *str, uint64_t *out);
+static void timer_arm(int timer, uint64_t when);
+static void *core_run(void *arg);
+static void core_send(int type, int arg, uint64_t value);
+static void core_retry();
+static void core_puts(char *str);
+static void core_capture(core_status_t *status);
+static void console_vtty(uint8_t value);
+static void status_sync();
 
 uint8_t helloworld_rom[] = {
 	//entry:
@@ -114,6 +212,7 @@ uint8_t helloworld_rom[] = {
 
 options_t options;
 static bool dirty;
+static bool tty_setup;
 
 int main(int argc, char **argv) {
 	// Add the exit handler.
@@ -122,13 +221,35 @@ int main(int argc, char **argv) {
 		return -1;
 	}
 	
-	// Set TTY mode to disable line buffering and echoing.
-	system("stty cbreak -echo -isig");
-	
 	// Parse the options.
 	options.disk_file = NULL;
 	options.exec_file = NULL;
+	options.explore_file = NULL;
+	options.state_file = "gr8emu.state";
+	options.load_state = NULL;
+	options.save_state = NULL;
+	options.record_file = NULL;
+	options.replay_file = NULL;
+	options.console_file = NULL;
+	options.input_file = NULL;
+	options.coverage_file = NULL;
+	options.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	options.max_cycles = 10000000;
+	options.boot_cycles = 10000000;
+	options.timeout = 0;
+	options.input_pace = 0;
+	options.disk_latency = 0;
+	options.disk_overlay = NULL;
+	options.disk_commit = false;
+	options.uart_link = NULL;
+	options.exec_type = EXEC_TYPE_AUTO;
+	options.has_until_pc = false;
+	options.headless = false;
 	options.run_immediately = false;
+	options.breakpoints = NULL;
+	options.breakpoints_len = 0;
+	options.watchpoints = NULL;
+	options.watchpoints_len = 0;
 	int i;
 	for (i = 1; i < argc; i++) {
 		if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--disk-file")) {
@@ -139,6 +260,93 @@ int main(int argc, char **argv) {
 				fprintf(stderr, "No path provided for '%s'", argv[i]);
 				return 1;
 			}
+		} else if (!strcmp(argv[i], "-b") || !strcmp(argv[i], "--break")
+				|| !strcmp(argv[i], "-w") || !strcmp(argv[i], "--watch")) {
+			bool watch = argv[i][1] == 'w' || argv[i][2] == 'w';
+			uint16_t **list = watch ? &options.watchpoints : &options.breakpoints;
+			uint32_t *len   = watch ? &options.watchpoints_len : &options.breakpoints_len;
+			uint16_t address;
+			if (i < argc - 1 && parse_address(argv[i + 1], &address)) {
+				i ++;
+				*list = realloc(*list, (*len + 1) * sizeof(uint16_t));
+				(*list)[(*len) ++] = address;
+			} else {
+				fprintf(stderr, "No address provided for '%s'", argv[i]);
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "--explore") || !strcmp(argv[i], "--state-file")
+				|| !strcmp(argv[i], "--load-state") || !strcmp(argv[i], "--save-state")
+				|| !strcmp(argv[i], "--record") || !strcmp(argv[i], "--replay")
+				|| !strcmp(argv[i], "--console") || !strcmp(argv[i], "--input")
+				|| !strcmp(argv[i], "--coverage") || !strcmp(argv[i], "--disk-overlay")
+				|| !strcmp(argv[i], "--uart")) {
+			if (i < argc - 1) {
+				char **opt = !strcmp(argv[i], "--explore")    ? &options.explore_file
+						   : !strcmp(argv[i], "--state-file") ? &options.state_file
+						   : !strcmp(argv[i], "--load-state") ? &options.load_state
+						   : !strcmp(argv[i], "--record")     ? &options.record_file
+						   : !strcmp(argv[i], "--replay")     ? &options.replay_file
+						   : !strcmp(argv[i], "--console")    ? &options.console_file
+						   : !strcmp(argv[i], "--input")      ? &options.input_file
+						   : !strcmp(argv[i], "--coverage")   ? &options.coverage_file
+						   : !strcmp(argv[i], "--disk-overlay") ? &options.disk_overlay
+						   : !strcmp(argv[i], "--uart")       ? &options.uart_link
+						   : &options.save_state;
+				i ++;
+				*opt = argv[i];
+			} else {
+				fprintf(stderr, "No path provided for '%s'", argv[i]);
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")
+				|| !strcmp(argv[i], "--max-cycles") || !strcmp(argv[i], "--boot-cycles")
+				|| !strcmp(argv[i], "--timeout") || !strcmp(argv[i], "--input-pace")
+				|| !strcmp(argv[i], "--disk-latency")) {
+			uint64_t value;
+			if (i < argc - 1 && parse_number(argv[i + 1], &value) && value) {
+				if (argv[i][1] == 'j' || argv[i][2] == 'j') {
+					options.jobs = value;
+				} else if (argv[i][2] == 'm') {
+					options.max_cycles = value;
+				} else if (argv[i][2] == 't') {
+					options.timeout = value;
+				} else if (argv[i][2] == 'i') {
+					options.input_pace = value;
+				} else if (argv[i][2] == 'd') {
+					options.disk_latency = value;
+				} else {
+					options.boot_cycles = value;
+				}
+				i ++;
+			} else {
+				fprintf(stderr, "No number provided for '%s'", argv[i]);
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "--until-pc")) {
+			if (i < argc - 1 && parse_address(argv[i + 1], &options.until_pc)) {
+				i ++;
+				options.has_until_pc = true;
+			} else {
+				fprintf(stderr, "No address provided for '%s'", argv[i]);
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "--type")) {
+			const char *types[] = { "raw", "lhf", "asm", "asmv", "map" };
+			int type = EXEC_TYPE_AUTO;
+			for (int j = 0; i < argc - 1 && j < 5; j++) {
+				if (!strcmp(argv[i + 1], types[j])) type = j;
+			}
+			if (type != EXEC_TYPE_AUTO) {
+				i ++;
+				options.exec_type = type;
+			} else {
+				fprintf(stderr, "No type (raw, lhf, asm, asmv or map) provided for '%s'", argv[i]);
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "--headless")) {
+			options.headless = true;
+		} else if (!strcmp(argv[i], "--disk-commit")) {
+			options.disk_commit = true;
 		} else if (!strcmp(argv[i], "-x") || !strcmp(argv[i], "--exec")) {
 			options.run_immediately = true;
 		} else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
@@ -154,11 +362,78 @@ int main(int argc, char **argv) {
 		printf("%s [options] exec-file\n\n", *argv);
 		printf("    -h  --help\n");
 		printf("                Show this options list.\n\n");
+		printf("    --type raw|lhf|asm|asmv|map\n");
+		printf("                Kind of exec-file, guessed from its extension by default.\n");
+		printf("                Raw images run mapped in place, LHF is a Logisim memory\n");
+		printf("                image, asm is assembled first, asmv also prints the labels\n");
+		printf("                and a map places several images in ROM and RAM.\n");
+		printf("                See src/loader.h and src/asm.h for the formats.\n\n");
 		printf("    -x  --exec\n");
 		printf("                Start running the program immediately.\n\n");
+		printf("    -b address\n");
+		printf("    --break address\n");
+		printf("                Add a breakpoint, may be repeated.\n\n");
+		printf("    -w address\n");
+		printf("    --watch address\n");
+		printf("                Add a watchpoint, hit when the address is written.\n\n");
+		printf("    --explore file\n");
+		printf("                Boot once, then run every line of file as keyboard input\n");
+		printf("                from the booted machine and print the results as JSON.\n\n");
+		printf("    -j count\n");
+		printf("    --jobs count\n");
+		printf("                Number of worker processes for --explore.\n\n");
+		printf("    --headless\n");
+		printf("                Run without the TUI as fast as possible, then print a JSON\n");
+		printf("                summary to stderr. Exits with 0 on halt or --until-pc,\n");
+		printf("                1 on errors, 2 on breakpoints, 3 on --max-cycles and\n");
+		printf("                4 on --timeout.\n\n");
+		printf("    --console file\n");
+		printf("                Write console output to file instead of stdout with --headless.\n\n");
+		printf("    --input file\n");
+		printf("                Type the contents of file on the keyboard with --headless,\n");
+		printf("                as fast as the program reads it. May be a FIFO, or - for\n");
+		printf("                stdin, which is only read from as the program takes input.\n\n");
+		printf("    --input-pace cycles\n");
+		printf("                Wait at least this many cycles between characters of --input.\n\n");
+		printf("    --until-pc address\n");
+		printf("                Stop before the instruction at address with --headless.\n\n");
+		printf("    --timeout seconds\n");
+		printf("                Most wall-clock time to run for with --headless.\n\n");
+		printf("    --max-cycles count\n");
+		printf("                Cycles to run every input for with --explore, or to run for\n");
+		printf("                with --headless.\n\n");
+		printf("    --boot-cycles count\n");
+		printf("                Most cycles to boot for before the keyboard is read.\n\n");
+		printf("    --state-file file\n");
+		printf("                Save state file for ^S and ^O, gr8emu.state by default.\n\n");
+		printf("    --load-state file\n");
+		printf("                Load a save state after loading the program.\n\n");
+		printf("    --save-state file\n");
+		printf("                Save the state on exit.\n\n");
+		printf("    --record file\n");
+		printf("                Record keyboard input, interrupts and resets with the\n");
+		printf("                cycle they happened at.\n\n");
+		printf("    --replay file\n");
+		printf("                Replay a recording at the cycles it was made at, as fast\n");
+		printf("                as possible. Keyboard input is ignored while replaying.\n\n");
+		printf("    --coverage file\n");
+		printf("                Write which instructions, jumps and microcode rows ran to\n");
+		printf("                file on exit, see gr8emu-cov for what to do with it.\n\n");
 		printf("    -d file\n");
 		printf("    --disk-file file\n");
-		printf("                Select the disk image file.\n\n");
+		printf("                Select the disk image file, mapped into memory and written\n");
+		printf("                back as the kernel sees fit, or when the program flushes it.\n\n");
+		printf("    --disk-latency cycles\n");
+		printf("                Cycles a disk command takes, 0 by default.\n\n");
+		printf("    --disk-overlay file\n");
+		printf("                Leave the disk image alone and keep changed sectors in a\n");
+		printf("                sparse file, or in memory for -. Save states take the\n");
+		printf("                overlay along in state-file.overlay.\n\n");
+		printf("    --disk-commit\n");
+		printf("                Write the overlay to the disk image on exit.\n\n");
+		printf("    --uart file\n");
+		printf("                Connect the UART to a new pseudo-terminal, with a symlink\n");
+		printf("                to it at file. For -, its name is only printed.\n\n");
 		return 0;
 	}
 	if (i < argc - 1) {
@@ -168,130 +443,264 @@ int main(int argc, char **argv) {
 		options.exec_file = argv[i];
 	}
 	
-	// Print some lines.
-	fputs("\n\n\n\n\n\n", stdout);
-	
+	// Load the file, the machine runs the hello world ROM without one.
+	if (options.exec_file && !program_load(&program, options.exec_file, options.exec_type)) {
+		fprintf(stderr, "Could not load '%s': %s\n", options.exec_file, program_error);
+		return 1;
+	}
+	if (options.exec_type == EXEC_TYPE_ASMV) {
+		asm_symbols_print(&program.symbols, stderr);
+	}
 	// Reset the CPU.
+	devices_init();
 	cpu_reset();
-	cpu.rom = helloworld_rom;
-	cpu.romLen = sizeof(helloworld_rom);
-	// Load the file if possible.
-	if (options.exec_file) {
-		uint8_t *buf;
-		size_t len;
-		if (load_file(options.exec_file, &buf, &len)) {
-			if (len > 0xfdff) {
-				free(buf);
-			} else {
-				cpu.rom = buf;
-				cpu.romLen = len;
-			}
+	
+	if (options.disk_file) {
+		if (!disk_open(&disk, options.disk_file)) {
+			fprintf(stderr, "Could not open '%s': %s\n", options.disk_file, disk_error);
+			return 1;
+		}
+		disk.latency = options.disk_latency;
+		char *overlay = options.disk_overlay;
+		if (overlay && !disk_overlay(&disk, strcmp(overlay, "-") ? overlay : NULL)) {
+			fprintf(stderr, "Could not make overlay '%s': %s\n", overlay, disk_error);
+			return 1;
+		}
+		dev_disk_insert(&machine.disk_dev, &disk);
+	}
+	
+	if (options.uart_link) {
+		char *link = strcmp(options.uart_link, "-") ? options.uart_link : NULL;
+		if (!serial_open(&serial, link)) {
+			fprintf(stderr, "Could not open the UART: %s\n", serial_error);
+			return 1;
 		}
+		fprintf(stderr, "UART on %s\n", serial.name);
+		// Re-executing sends the same bytes again.
+		serial.mute = &rev.replaying;
+		dev_uart_connect(&machine.uart_dev, &serial);
+	}
+	
+	if (options.coverage_file) {
+		coverage = mmap(NULL, sizeof(gr8cpurev3_cov_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (coverage == MAP_FAILED) {
+			coverage = NULL;
+			fputs("Out of memory\n", stderr);
+			return 1;
+		}
+		machine.cpu.coverage = coverage;
+	}
+	
+	if (options.load_state && !cpu_loadstate(options.load_state)) {
+		fprintf(stderr, "Could not load '%s': %s\n", options.load_state, savestate_error);
+		return 1;
+	}
+	
+	if (options.explore_file) {
+		return explore_run(options.explore_file, options.jobs);
+	}
+	
+	if (options.headless) {
+		return headless_run();
+	}
+	
+	if (options.replay_file && !replay_load(&replay, options.replay_file, &machine.cpu)) {
+		fprintf(stderr, "Could not replay '%s': %s\n", options.replay_file, record_error);
+		return 1;
+	}
+	if (options.record_file && !record_open(&recorder, options.record_file, &machine.cpu)) {
+		fprintf(stderr, "Could not record '%s': %s\n", options.record_file, record_error);
+		return 1;
 	}
 	
-	if (options.run_immediately) {
-		// Set stdin mode to non-blocking so we can read and get EOF instead of waiting.
-		set_nonblocking();
+	// Going back undoes what the machine wrote to the disk since.
+	if (options.disk_file) {
+		if (!disk_undoable(&disk)) {
+			fprintf(stderr, "Could not keep disk history: %s\n", disk_error);
+			return 1;
+		}
+		rev.disk = &disk;
 	}
+	
+	// Set TTY mode to disable line buffering and echoing.
+	system("stty cbreak -echo -isig");
+	tty_setup = true;
+	
+	// Print some lines.
+	fputs("\n\n\n\n\n\n", stdout);
+	
+	// Keys are read straight from the file descriptor, stdio mustn't read ahead of them.
+	setvbuf(stdin, NULL, _IONBF, 0);
+	// The terminal takes console output on its own thread, and says when it has.
+	machine.console_async = true;
+	core_capture(&core_status);
 	redraw();
 	vtty_puts("\n" ANSI_BOLD_INV "GR8EMU v1.0" ANSI_RESET "\n");
 	// Some loop.
 	uint64_t last_redraw = millis();
-	uint64_t last_time   = micros();
+	uint64_t last_frame  = last_redraw;
+	bool     fresh       = true;
 	delay                = freq_delays[freq_sel];
 	cycles               = freq_cycles[freq_sel];
 	dirty                = false;
 	gr8cpu_running       = options.run_immediately;
-	while (1) {
+	core_running         = gr8cpu_running;
+	state                = gr8cpu_running ? STATE_RUN : STATE_STOP;
+	replay_start         = micros();
+	replay_catch_up();
+	// Wait for keys, for the emulation thread and for the next thing due, nothing runs in between.
+	tty_input_t input = {0};
+	int timer = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+	if (timer < 0) {
+		printf("\033[65535;65535H\nCould not make a timer\n");
+		return 1;
+	}
+	if (!spsc_init(&commands, sizeof(core_cmd_t), COMMANDS_LEN)
+			|| !spsc_init(&console_out, 1, CONSOLE_OUT_LEN)
+			|| !spsc_init(&statuses, sizeof(core_status_t), STATUSES_LEN)
+			|| pthread_create(&core, NULL, core_run, NULL)) {
+		printf("\033[65535;65535H\nCould not start the emulation thread\n");
+		return 1;
+	}
+	struct pollfd fds[4] = {
+		{ .fd = STDIN_FILENO,   .events = POLLIN },
+		{ .fd = timer,          .events = POLLIN },
+		{ .fd = console_out.fd, .events = POLLIN },
+		{ .fd = statuses.fd,    .events = POLLIN },
+	};
+	bool quit = false;
+	while (!quit) {
 		uint64_t now = micros();
-		char c = getc(stdin);
-		if (state != STATE_KEYB && c == CTRL_C) {
-			printf("\033[65535;65535H\nStopping...\n");
-			break;
-		} else {
-			switch (state) {
-				case STATE_KEYB:
-					handle_keyb(c);
-					break;
-				case STATE_RUN:
-					handle_run(c);
-					break;
-				case STATE_STOP:
-					handle_stop(c);
-					break;
-				case STATE_SHOW:
-					handle_show(c);
-					break;
+		// Keys, each escape sequence as one.
+		int keys[64 * TTY_INPUT_MAX];
+		size_t n_keys = tty_input_expire(&input, now / 1000, keys);
+		if (fds[0].revents & POLLIN) {
+			uint8_t buf[64];
+			ssize_t len = read(STDIN_FILENO, buf, sizeof(buf));
+			for (ssize_t i = 0; i < len; i++) {
+				n_keys += tty_input_feed(&input, buf[i], now / 1000, keys + n_keys);
 			}
-			change_freq(c);
+			if (len == 0) fds[0].fd = -1;
+		} else if (fds[0].revents & (POLLHUP | POLLERR)) {
+			fds[0].fd = -1;
 		}
-		if (last_time + delay <= now && gr8cpu_running) {
-			// Tick it.
-			int res = gr8cpurev3_tick(&cpu, cycles, TICK_MODE_NORMAL);
-			
-			// Find real hertz frequency.
-			uint64_t spent = now - last_time;
-			double real_freq = 1000000.0 / (double) spent * (double) cycles;
-			desc_freq(freq_real_desc, real_freq);
-			
-			// Some housekeeping.
-			if (res) gr8cpu_running = false;
-			last_time = now;
+		for (size_t i = 0; i < n_keys && !quit; i++) {
+			quit = !handle_key(keys[i]);
+		}
+		if (quit) break;
+		core_retry();
+		if (fds[1].revents & POLLIN) {
+			uint64_t expired;
+			read(timer, &expired, sizeof(expired));
+		}
+		// What the emulation thread sent, only the latest status matters.
+		if (fds[2].revents & POLLIN) spsc_clear(&console_out);
+		if (fds[3].revents & POLLIN) spsc_clear(&statuses);
+		// Some of the console at a time, so keys still get a look in when there's lots of it.
+		uint8_t out[CONSOLE_CHUNK];
+		size_t n_out = spsc_pop(&console_out, out, sizeof(out));
+		for (size_t i = 0; i < n_out; i++) console_vtty(out[i]);
+		if (spsc_pop(&statuses, &core_status, 1)) {
+			while (spsc_pop(&statuses, &core_status, 1));
+			status_sync();
+			fresh = true;
 			dirty = true;
 		}
-		if (last_redraw + 50 < now && dirty) {
+		if (fresh && last_frame + VIDEO_FRAME_MS <= now / 1000) {
+			last_frame = now / 1000;
+			fresh = false;
+			video_frame(&core_status.video);
+		}
+		if (last_redraw + 50 < now / 1000 && dirty) {
+			last_redraw = now / 1000;
 			dirty = false;
 			redraw();
 		}
+		fflush(stdout);
+		// Find the next thing due: a frame or redraw once something changed, or the end of an escape.
+		uint64_t next = n_out == sizeof(out) ? now : UINT64_MAX;
+		if (fresh) {
+			uint64_t frame = (last_frame + VIDEO_FRAME_MS) * 1000;
+			if (frame < next) next = frame;
+		}
+		if (dirty) {
+			uint64_t draw = (last_redraw + 51) * 1000;
+			if (draw < next) next = draw;
+		}
+		uint64_t esc = tty_input_deadline(&input);
+		if (esc != UINT64_MAX && esc * 1000 < next) next = esc * 1000;
+		// Statuses say when the emulation thread took commands, but don't count on one.
+		if (unsent_len && now + STATUS_US < next) next = now + STATUS_US;
+		if (next <= now) {
+			// Already due, only look for what's there.
+			poll(fds, 4, 0);
+		} else {
+			if (next != UINT64_MAX) timer_arm(timer, next);
+			poll(fds, 4, -1);
+		}
 	}
+	// The machine is this thread's again once the emulation thread is gone.
+	core_send(CMD_QUIT, 0, 0);
+	while (unsent_len) {
+		usleep(1000);
+		core_retry();
+	}
+	pthread_join(core, NULL);
+	spsc_free(&commands);
+	spsc_free(&console_out);
+	spsc_free(&statuses);
+	printf("\033[65535;65535H\nStopping...\n");
+	close(timer);
+	return 0;
 }
 
-static void set_blocking() {
-	// Set stdin mode to blocking so we wait when paused.
-	int flags = fcntl(stdin->_fileno, F_GETFL, 0);
-	fcntl(stdin->_fileno, F_SETFL, flags & ~O_NONBLOCK);
-}
-
-static void set_nonblocking() {
-	// Set stdin mode to non-blocking so we can read and get EOF instead of waiting.
-	int flags = fcntl(stdin->_fileno, F_GETFL, 0);
-	fcntl(stdin->_fileno, F_SETFL, flags | O_NONBLOCK);
+// Handles a key, depending on the state.
+// Returns false if the emulator should stop.
+static bool handle_key(int key) {
+	if (state != STATE_KEYB && state != STATE_GOTO && key == CTRL_C) {
+		return false;
+	}
+	switch (state) {
+		case STATE_KEYB:
+			handle_keyb(key);
+			return true;
+		case STATE_GOTO:
+			handle_goto(key);
+			return true;
+		case STATE_RUN:
+			if (key < 0x100) handle_run(key);
+			break;
+		case STATE_STOP:
+			if (key < 0x100) handle_stop(key);
+			break;
+		case STATE_SHOW:
+			if (key < 0x100) handle_show(key);
+			break;
+	}
+	if (key < 0x100) change_freq(key);
+	return true;
 }
 
-static void handle_keyb(char c) {
+static void handle_keyb(int key) {
 	bool q = 1;
-	// Set to nonblock temporarily.
-	int flags = fcntl(stdin->_fileno, F_GETFL, 0);
-	fcntl(stdin->_fileno, F_SETFL, flags | O_NONBLOCK);
-	if (c == 0x1B && getc(stdin) == '[') {
-		// Yes, two consecutive reads from STDIN.
-		// And yes, D is left and C is right.
-		switch (getc(stdin)) {
-			case 'A':
-				keybbuf_add(GR8CPU_UP);
-				break;
-			case 'B':
-				keybbuf_add(GR8CPU_DOWN);
-				break;
-			case 'D':
-				keybbuf_add(GR8CPU_LEFT);
-				break;
-			case 'C':
-				keybbuf_add(GR8CPU_RIGHT);
-				break;
-		}
-	} else if (c == MAP_UNKEYB) {
+	if (key == KEY_UP) {
+		core_send(CMD_INPUT, INPUT_KEY, GR8CPU_UP);
+	} else if (key == KEY_DOWN) {
+		core_send(CMD_INPUT, INPUT_KEY, GR8CPU_DOWN);
+	} else if (key == KEY_LEFT) {
+		core_send(CMD_INPUT, INPUT_KEY, GR8CPU_LEFT);
+	} else if (key == KEY_RIGHT) {
+		core_send(CMD_INPUT, INPUT_KEY, GR8CPU_RIGHT);
+	} else if (key == MAP_UNKEYB) {
 		state = gr8cpu_running ? STATE_RUN : STATE_STOP;
-	} else if (c == 0x7F) {
+	} else if (key == 0x7F) {
 		// Translate expectation of backspace.
-		keybbuf_add('\b');
-	} else if (c > 0) {
-		keybbuf_add(c);
+		core_send(CMD_INPUT, INPUT_KEY, '\b');
+	} else if (key > 0 && key < 0x80) {
+		core_send(CMD_INPUT, INPUT_KEY, key);
 	} else {
 		q = 0;
 	}
-	// Revert changes.
-	fcntl(stdin->_fileno, F_SETFL, flags);
 	dirty |= q;
 }
 
@@ -299,16 +708,22 @@ static void handle_run(char c) {
 	bool q = 1;
 	if (c == MAP_PAUSE) {
 		gr8cpu_running = false;
-		set_blocking();
+		core_send(CMD_RUN, false, 0);
 		strcpy(freq_real_desc, "0.0 Hz");
 	} else if (c == MAP_KEYB) {
 		state = STATE_KEYB;
 	} else if (c == MAP_RESET) {
 		gr8cpu_running = false;
-		set_blocking();
 		strcpy(freq_real_desc, "0.0 Hz");
-		cpu_reset();
-		redraw();
+		core_send(CMD_RESET, false, 0);
+	} else if (c == MAP_SAVEST) {
+		core_send(CMD_SAVE, false, 0);
+	} else if (c == MAP_LOADST) {
+		core_send(CMD_LOAD, false, 0);
+	} else if (c == MAP_IRQ) {
+		core_send(CMD_INPUT, INPUT_IRQ, 0);
+	} else if (c == MAP_NMI) {
+		core_send(CMD_INPUT, INPUT_NMI, 0);
 	} else if (c == MAP_SHOW) {
 		state = STATE_SHOW;
 	} else {
@@ -316,7 +731,6 @@ static void handle_run(char c) {
 	}
 	if (!gr8cpu_running) {
 		state = STATE_STOP;
-		set_blocking();
 		strcpy(freq_real_desc, "0.0 Hz");
 		dirty = 1;
 	} else {
@@ -327,27 +741,36 @@ static void handle_run(char c) {
 static void handle_stop(char c) {
 	bool q = 1;
 	if (c == MAP_UNPAUSE) {
-		set_nonblocking();
 		gr8cpu_running = true;
+		core_send(CMD_RUN, true, 0);
 	} else if (c == MAP_KEYB) {
 		state = STATE_KEYB;
 	} else if (c == MAP_CSTEP) {
-		int res = gr8cpurev3_tick(&cpu, 1, TICK_MODE_NORMAL);
-		redraw();
+		core_send(CMD_STEP, TICK_MODE_NORMAL, 1);
 	} else if (c == MAP_ISTEP) {
-		int res = gr8cpurev3_tick(&cpu, 1, TICK_MODE_STEP_IN);
-		redraw();
+		core_send(CMD_STEP, TICK_MODE_STEP_IN, 1);
 	} else if (c == MAP_MSTEP) {
-		int res = gr8cpurev3_tick(&cpu, 8192, TICK_MODE_STEP_OVER);
-		redraw();
+		core_send(CMD_STEP, TICK_MODE_STEP_OVER, 8192);
 	} else if (c == MAP_XSTEP) {
-		int res = gr8cpurev3_tick(&cpu, 8192, TICK_MODE_STEP_OUT);
-		redraw();
+		core_send(CMD_STEP, TICK_MODE_STEP_OUT, 8192);
+	} else if (c == MAP_CBACK) {
+		core_send(CMD_CBACK, 0, 0);
+	} else if (c == MAP_IBACK) {
+		core_send(CMD_IBACK, 0, 0);
+	} else if (c == MAP_RCONT) {
+		core_send(CMD_RCONT, 0, 0);
+	} else if (c == MAP_GOTO) {
+		goto_len = 0;
+		vtty_putc('\n');
+		vtty_puts("Go to cycle: ");
+		state = STATE_GOTO;
 	} else if (c == MAP_RESET) {
 		gr8cpu_running = false;
-		cpu_reset();
-		redraw();
-		vtty_puts("\n" ANSI_BOLD_INV "RESET" ANSI_RESET "\n");
+		core_send(CMD_RESET, true, 0);
+	} else if (c == MAP_SAVEST) {
+		core_send(CMD_SAVE, true, 0);
+	} else if (c == MAP_LOADST) {
+		core_send(CMD_LOAD, true, 0);
 	} else if (c == MAP_SHOW) {
 		state = STATE_SHOW;
 	} else {
@@ -379,25 +802,46 @@ static void handle_show(char c) {
 	dirty |= q;
 }
 
+// Types a key at the go to cycle prompt, which the keys loop feeds like any other state.
+static void handle_goto(int key) {
+	uint64_t cycle;
+	if (key == MAP_GOTO_OK || key == '\n') {
+		goto_buf[goto_len] = 0;
+		if (parse_number(goto_buf, &cycle)) core_send(CMD_GOTO, 0, cycle);
+		vtty_putc('\n');
+		state = gr8cpu_running ? STATE_RUN : STATE_STOP;
+	} else if (key == MAP_BACK || key == CTRL_C) {
+		vtty_putc('\n');
+		state = gr8cpu_running ? STATE_RUN : STATE_STOP;
+	} else if ((key == 0x7f || key == '\b') && goto_len) {
+		goto_len --;
+		vtty_putc('\b');
+	} else if (key >= '0' && key <= '9' && goto_len < sizeof(goto_buf) - 1) {
+		goto_buf[goto_len ++] = key;
+		vtty_putc(key);
+	} else {
+		return;
+	}
+	dirty = true;
+}
+
 static void change_freq(char c) {
 	if (c == '-' || c == '_') {
 		// Decrease freq.
 		if (freq_sel < N_FREQS - 1) {
 			freq_sel ++;
-			delay    = freq_delays[freq_sel];
-			cycles   = freq_cycles[freq_sel];
+			core_send(CMD_FREQ, freq_sel, 0);
 			dirty = true;
 		}
 	} else if (c == '=' || c == '+') {
 		// Increase freq.
 		if (freq_sel > 0) {
 			freq_sel --;
-			delay    = freq_delays[freq_sel];
-			cycles   = freq_cycles[freq_sel];
+			core_send(CMD_FREQ, freq_sel, 0);
 			dirty = true;
 		}
 	}
-	target_hertz = 1000000.0 / delay * cycles;
+	target_hertz = 1000000.0 / freq_delays[freq_sel] * freq_cycles[freq_sel];
 	desc_freq(freq_sel_desc, target_hertz);
 }
 
@@ -452,113 +896,481 @@ uint64_t nanos() {
 	return res.tv_sec * 1000000000 + res.tv_nsec;
 }
 
-// Called when a character is added to the keyboard buffer.
-bool keybbuf_add(char c) {
-	int next = (keyb_buf_end + 1) % KEYB_BUF_LEN;
-	if (next != keyb_buf_start) {
-		keyb_buf[keyb_buf_end] = c;
-		keyb_buf_end = next;
-		return true;
+// Resets the CPU.
+void cpu_reset() {
+	machine_reset(&machine);
+	if (options.exec_file) program_place(&program, &machine);
+	snapctx_invalidate(&snapctx);
+	// Debugger.
+	machine.cpu.breakpoints = options.breakpoints;
+	machine.cpu.breakpointsLen = options.breakpoints_len;
+	machine.cpu.watchpoints = options.watchpoints;
+	machine.cpu.watchpointsLen = options.watchpoints_len;
+	// History.
+	rev_reset(&rev);
+}
+
+// Saves the machine to the state file.
+bool cpu_savestate(char *path) {
+	if (!savestate_write(path, &machine.cpu, &machine.bus)) return false;
+	// The disk overlay goes next to it, the image itself doesn't change.
+	if (disk.overlay) {
+		char overlay[strlen(path) + 9];
+		sprintf(overlay, "%s.overlay", path);
+		if (!disk_overlay_save(&disk, overlay)) {
+			savestate_error = "Cannot write disk overlay";
+			return false;
+		}
 	}
-	return false;
+	return true;
 }
 
-// Called when a character is read from the keyboard buffer.
-char keybbuf_read(bool notouchy) {
-	if (keyb_buf_start != keyb_buf_end) {
-		char c = keyb_buf[keyb_buf_start];
-		if (!notouchy) {
-			keyb_buf_start = (keyb_buf_start + 1) % KEYB_BUF_LEN;
+// Loads the machine from the state file.
+bool cpu_loadstate(char *path) {
+	uint64_t cycle = machine.cpu.numCycles;
+	if (!savestate_read(path, &machine.cpu, &machine.bus)) return false;
+	if (disk.overlay) {
+		char overlay[strlen(path) + 9];
+		sprintf(overlay, "%s.overlay", path);
+		if (!access(overlay, F_OK) && !disk_overlay_load(&disk, overlay)) {
+			savestate_error = "Cannot read disk overlay";
+			return false;
 		}
-		return c;
 	}
-	return 0;
+	snapctx_invalidate(&snapctx);
+	rev_reset(&rev);
+	// Recordings can't follow the machine to another state.
+	record_close(&recorder, cycle);
+	replay_free(&replay);
+	return true;
 }
 
-// Creates a copy of the keyboard buffer of at most len characters.
-// Buffer must be at least len+1 characters.
-void keybbuf_copy(char *dest, size_t len) {
-	size_t start = keyb_buf_start;
-	size_t index = 0;
-	while (start != keyb_buf_end && index < len) {
-		dest[index] = keyb_buf[start];
-		start = (start + 1) % KEYB_BUF_LEN;
-		index ++;
+// Passes console output on to the terminal.
+static void console_core(machine_t *m, uint8_t value) {
+	// Don't repeat output while re-executing.
+	if (rev.replaying) return;
+	// The machine doesn't wait for a terminal that can't keep up, it's kept until it does.
+	if (backlog_len == backlog_cap && backlog_start && backlog_start >= backlog_cap / 2) {
+		memmove(backlog, backlog + backlog_start, backlog_len - backlog_start);
+		backlog_len  -= backlog_start;
+		backlog_start = 0;
+	} else if (backlog_len == backlog_cap) {
+		size_t cap = backlog_cap ? backlog_cap * 2 : 4096;
+		uint8_t *grown = realloc(backlog, cap);
+		if (!grown) {
+			dropped ++;
+			return;
+		}
+		backlog     = grown;
+		backlog_cap = cap;
 	}
-	dest[index] = 0;
+	backlog[backlog_len ++] = value;
 }
 
-// Resets the CPU.
-void cpu_reset() {
-	// Flags.
-	cpu.flagCout = false;
-	cpu.flagZero = false;
-	cpu.flagIRQ = false;
-	cpu.flagNMI = false;
-	cpu.flagHWI = false;
-	cpu.wasHWI = false;
-	// Busses.
-	cpu.bus = 0;
-	cpu.adrBus = 0;
-	cpu.alo = 0;
-	// Stage.
-	cpu.stage = 0;
-	cpu.mode = MODE_LOAD;
-	cpu.schduledIRQ = 0;
-	cpu.schduledNMI = 0;
-	// Registers.
-	cpu.regA = 0;
-	cpu.regB = 0;
-	cpu.regX = 0;
-	cpu.regY = 0;
-	cpu.regIR = 0;
-	cpu.regPC = 0;
-	cpu.regAR = 0;
-	cpu.stackPtr = 0;
-	cpu.regIRQ = 0;
-	cpu.regNMI = 0;
-	// Debugger.
-	cpu.skipping = 0;
-	cpu.skipDepth = 0;
-	cpu.breakpoints = NULL;
-	cpu.breakpointsLen = 0;
-	cpu.debugIRQ = false;
-	cpu.debugNMI = false;
-	// Instruction set.
-	cpu.isaRom = default_isa_rom;
-	cpu.isaRomLen = DEFAULT_ISA_ROM_LEN;
-	// Memory.
-	cpu.ram = ram_reserve;
-	memset(ram_reserve, 0, 65536);
-	// Statistics.
-	cpu.numCycles = 0;
-	cpu.numInsns = 0;
-	cpu.numSubs = 0;
-}
-
-// Handler for MMIO reading.
-uint8_t gr8cpu_mmio_read(uint16_t address, bool notouchy) {
-	if (address == 0xFEFC) {
-		return keybbuf_read(notouchy);
+// Shows console output on the virtual TTY.
+static void console_vtty(uint8_t value) {
+	if (value & 0x80) {
+		char buf[6] = {0};
+		utf_cat(buf, ibm437_table[value & 0x7f]);
+		vtty_puts(buf);
+	} else {
+		vtty_putc(value);
 	}
-	return 0;
 }
 
-// Handler for MMIO writing.
-void gr8cpu_mmio_write(uint16_t address, uint8_t value) {
-	if (address == 0xFEFD) {
-		if (value & 0x80) {
-			char buf[6] = {0};
-			utf_cat(buf, ibm437_table[value & 0x7f]);
-			vtty_puts(buf);
+// Sets up the machine and its history.
+static void devices_init() {
+	machine_init(&machine, helloworld_rom, sizeof(helloworld_rom));
+	machine.console = console_core;
+	snapctx_init(&snapctx, &machine.cpu, &machine.bus);
+	rev_init(&rev, &snapctx, machine_input);
+	// Re-executing runs the same regions again.
+	machine.perf_regions.mute = &rev.replaying;
+}
+
+// Gives an input to the machine.
+static bool machine_input(int type, char c) {
+	switch (type) {
+		case INPUT_KEY: return machine_key(&machine, c);
+		case INPUT_IRQ: machine.cpu.debugIRQ = true; return true;
+		case INPUT_NMI: machine.cpu.debugNMI = true; return true;
+		case INPUT_UART: return dev_uart_rx(&machine.uart_dev, c);
+		case INPUT_CONSOLE: machine_console_drained(&machine); return true;
+	}
+	return false;
+}
+
+// Gives an input from the user to the machine, unless a recording is playing.
+static bool user_input(int type, char c) {
+	if (replay.events) return false;
+	record_event(&recorder, machine.cpu.numCycles, type, c);
+	return rev_input(&rev, type, c);
+}
+
+// Resets the CPU on request of the user.
+static void user_reset() {
+	record_event(&recorder, machine.cpu.numCycles, REC_RESET, 0);
+	// A replay can't know what happens after a reset it didn't make.
+	replay_free(&replay);
+	cpu_reset();
+}
+
+// Follows the user going back in time.
+static void user_went_back() {
+	record_event(&recorder, machine.cpu.numCycles, REC_REWIND, 0);
+	replay_seek(&replay, machine.cpu.numCycles);
+}
+
+// Gives the machine all replayed events due by now.
+static void replay_catch_up() {
+	rec_event_t *event;
+	while ((event = replay_due(&replay, machine.cpu.numCycles))) {
+		if (event->type == REC_RESET) {
+			record_event(&recorder, machine.cpu.numCycles, REC_RESET, 0);
+			cpu_reset();
+		} else if (event->type == REC_END) {
+			// Done, stop where the recording did.
+			double secs = (micros() - replay_start) / 1000000.0;
+			char buf[80];
+			core_running = false;
+			core_hertz   = 0;
+			snprintf(buf, sizeof(buf), " %lu cycles in %.2fs\n", machine.cpu.numCycles, secs);
+			core_puts("\n" ANSI_BOLD_INV "REPLAY DONE" ANSI_RESET);
+			core_puts(buf);
+			replay_free(&replay);
+			return;
 		} else {
-			vtty_putc(value);
+			record_event(&recorder, machine.cpu.numCycles, event->type, event->value);
+			rev_input(&rev, event->type, event->value);
 		}
 	}
 }
 
+// Moves serial bytes along, receiving them as inputs so they're recorded and re-executed.
+static void uart_poll() {
+	if (!machine.uart_dev.ctx) return;
+	dev_uart_poll(&machine.uart_dev, false);
+	// A replay brings its own, so these wait until it's done.
+	uint8_t value;
+	while (!replay.events && dev_uart_rx_room(&machine.uart_dev) && serial_rx_get(&serial, &value)) {
+		user_input(INPUT_UART, value);
+	}
+}
+
+// Limits a number of cycles to run so it stops at the next replayed event.
+static uint64_t replay_budget(uint64_t n) {
+	uint64_t next = replay_next_cycle(&replay);
+	if (next > machine.cpu.numCycles && next - machine.cpu.numCycles < n) {
+		return next - machine.cpu.numCycles;
+	}
+	return n;
+}
+
+// Does what the terminal asked for.
+static void core_command(core_cmd_t *cmd) {
+	switch (cmd->type) {
+		case CMD_INPUT:
+			user_input(cmd->arg, cmd->value);
+			break;
+		case CMD_RUN:
+			core_running = cmd->arg;
+			core_hertz   = 0;
+			break;
+		case CMD_STEP:
+			gr8cpurev3_tick(&machine.cpu, replay_budget(cmd->value), cmd->arg);
+			rev_update(&rev);
+			replay_catch_up();
+			break;
+		case CMD_CBACK:
+			rev_step_back(&rev);
+			user_went_back();
+			break;
+		case CMD_IBACK:
+			rev_step_back_insn(&rev);
+			user_went_back();
+			break;
+		case CMD_RCONT:
+			rev_continue(&rev);
+			user_went_back();
+			break;
+		case CMD_GOTO:
+			rev_goto(&rev, cmd->value);
+			user_went_back();
+			break;
+		case CMD_RESET:
+			core_running = false;
+			core_hertz   = 0;
+			user_reset();
+			if (cmd->arg) core_puts("\n" ANSI_BOLD_INV "RESET" ANSI_RESET "\n");
+			break;
+		case CMD_SAVE:
+			if (cpu_savestate(options.state_file)) {
+				if (cmd->arg) core_puts("\n" ANSI_BOLD_INV "SAVED" ANSI_RESET "\n");
+			} else if (cmd->arg) {
+				core_puts("\n" ANSI_BOLD_INV "SAVE FAILED" ANSI_RESET " ");
+				core_puts(savestate_error);
+				core_puts("\n");
+			}
+			break;
+		case CMD_LOAD:
+			if (cpu_loadstate(options.state_file)) {
+				if (cmd->arg) core_puts("\n" ANSI_BOLD_INV "LOADED" ANSI_RESET "\n");
+			} else if (cmd->arg) {
+				core_puts("\n" ANSI_BOLD_INV "LOAD FAILED" ANSI_RESET " ");
+				core_puts(savestate_error);
+				core_puts("\n");
+			}
+			break;
+		case CMD_FREQ:
+			delay  = freq_delays[cmd->arg];
+			cycles = freq_cycles[cmd->arg];
+			break;
+	}
+}
+
+// Writes text to the terminal's console, as if the machine did.
+static void core_puts(char *str) {
+	while (*str) console_core(&machine, *str++);
+}
+
+// Sends as much of the console output to the terminal as fits.
+static void core_flush() {
+	if (backlog_start == backlog_len) return;
+	size_t n = spsc_push(&console_out, backlog + backlog_start, backlog_len - backlog_start);
+	if (!n) return;
+	backlog_start += n;
+	if (backlog_start == backlog_len) backlog_start = backlog_len = 0;
+	spsc_notify(&console_out);
+	// Own up to what was lost once there's room to.
+	if (dropped && !backlog_len) {
+		char buf[48];
+		snprintf(buf, sizeof(buf), "\n" ANSI_BOLD_INV "DROPPED %lu" ANSI_RESET "\n", dropped);
+		dropped = 0;
+		core_puts(buf);
+	}
+}
+
+// Tells the machine once the terminal took all of its console output.
+// This is an input, so it's recorded and comes back when re-executing.
+static void core_drained() {
+	if (machine.console_held && !backlog_len && !spsc_used(&console_out)) {
+		user_input(INPUT_CONSOLE, 0);
+	}
+}
+
+// Describes the machine for the status line.
+static void core_capture(core_status_t *status) {
+	status->running = core_running;
+	status->hertz   = core_hertz;
+	status->cpu     = machine.cpu;
+	status->reads   = machine.bus.reads;
+	status->writes  = machine.bus.writes;
+	keybbuf_copy(&machine.keyb, status->keyb, KEYB_BUF_LEN);
+	status->regions = 0;
+	for (int i = 0; i < PERF_REGIONS && status->regions < STATUS_REGIONS; i++) {
+		perf_region_t *region = &machine.perf_regions.region[i];
+		if (!region->count) continue;
+		status->region[status->regions ++] = (status_region_t) {
+			.id     = i,
+			.count  = region->count,
+			.cycles = region->cycles,
+		};
+	}
+	video_capture(&machine, &status->video);
+}
+
+// Sends the terminal a status, unless it has too many it hasn't looked at.
+static bool core_publish(uint64_t handled) {
+	static core_status_t status;
+	core_capture(&status);
+	status.handled = handled;
+	if (!spsc_push(&statuses, &status, 1)) return false;
+	spsc_notify(&statuses);
+	return true;
+}
+
+// Runs the machine, paced, until told to quit.
+// Nothing here waits for the terminal: output it hasn't taken yet is kept until it has room.
+static void *core_run(void *arg) {
+	int timer = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+	struct pollfd fds[3] = {
+		{ .fd = commands.fd, .events = POLLIN },
+		{ .fd = timer,       .events = POLLIN },
+		{ .fd = -1 },
+	};
+	uint64_t handled     = 0;
+	uint64_t last_time   = micros();
+	uint64_t last_status = 0;
+	bool     status_due  = true;
+	while (true) {
+		if (fds[0].revents & POLLIN) spsc_clear(&commands);
+		if (fds[1].revents & POLLIN) {
+			uint64_t expired;
+			read(timer, &expired, sizeof(expired));
+		}
+		fds[0].revents = fds[1].revents = fds[2].revents = 0;
+		// Before anything runs, see if the terminal has caught up.
+		core_drained();
+		// Commands first, they're answered with a status right away.
+		core_cmd_t cmd;
+		while (spsc_pop(&commands, &cmd, 1)) {
+			handled ++;
+			if (cmd.type == CMD_QUIT) {
+				close(timer);
+				return NULL;
+			}
+			core_command(&cmd);
+			status_due  = true;
+			last_status = 0;
+		}
+		uint64_t now = micros();
+		// Replays aren't paced, their only clock is the cycle count.
+		bool due = replay.events ? true : last_time + delay <= now;
+		if (due && core_running) {
+			// Tick it, stopping at the next event to replay.
+			uint64_t before = machine.cpu.numCycles;
+			int res = rev_run(&rev, replay_budget(replay.events ? REPLAY_CHUNK : cycles));
+			replay_catch_up();
+			
+			// Find real hertz frequency.
+			uint64_t spent = now > last_time ? now - last_time : 1;
+			core_hertz = 1000000.0 / (double) spent * (double) (machine.cpu.numCycles - before);
+			
+			// Some housekeeping.
+			if (res) {
+				core_running = false;
+				core_hertz   = 0;
+			}
+			last_time  = now;
+			status_due = true;
+		}
+		uart_poll();
+		core_flush();
+		if (status_due && last_status + STATUS_US <= now && core_publish(handled)) {
+			last_status = now;
+			status_due  = false;
+		}
+		// Find the next thing due: a tick, or another go at what the terminal had no room for.
+		uint64_t next = UINT64_MAX;
+		if (core_running) {
+			next = replay.events ? now : last_time + delay;
+		}
+		if (status_due || backlog_len || machine.console_held) {
+			uint64_t retry = last_status + STATUS_US;
+			if (retry <= now) retry = now + STATUS_US;
+			if (retry < next) next = retry;
+		}
+		if (next > now) {
+			timer_arm(timer, next);
+			fds[1].fd = next == UINT64_MAX ? -1 : timer;
+			// The UART receives while paused too.
+			if (machine.uart_dev.ctx) {
+				fds[2].fd     = serial.master;
+				fds[2].events = serial_events(&serial);
+			}
+			poll(fds, 3, -1);
+		}
+	}
+}
+
+// Sends a command to the emulation thread.
+// If it has too many it hasn't got to yet, the command waits here for core_retry.
+static void core_send(int type, int arg, uint64_t value) {
+	core_cmd_t cmd = {
+		.type  = type,
+		.arg   = arg,
+		.value = value,
+	};
+	commands_sent ++;
+	// Commands that are already waiting go first.
+	if (!unsent_len && spsc_push(&commands, &cmd, 1)) {
+		spsc_notify(&commands);
+		return;
+	}
+	if (unsent_len == unsent_cap) {
+		size_t cap = unsent_cap ? unsent_cap * 2 : 64;
+		core_cmd_t *grown = realloc(unsent, cap * sizeof(core_cmd_t));
+		if (!grown) {
+			commands_sent --;
+			return;
+		}
+		unsent     = grown;
+		unsent_cap = cap;
+	}
+	unsent[unsent_len ++] = cmd;
+}
+
+// Sends the commands that didn't fit before, as far as they fit now.
+static void core_retry() {
+	size_t n = spsc_push(&commands, unsent, unsent_len);
+	if (!n) return;
+	memmove(unsent, unsent + n, (unsent_len - n) * sizeof(core_cmd_t));
+	unsent_len -= n;
+	spsc_notify(&commands);
+}
+
+// Follows the emulation thread stopping by itself, once it's caught up with what it was told.
+static void status_sync() {
+	if (core_status.handled == commands_sent && !core_status.running && gr8cpu_running) {
+		gr8cpu_running = false;
+		if (state == STATE_RUN) state = STATE_STOP;
+	}
+	desc_freq(freq_real_desc, gr8cpu_running ? core_status.hertz : 0);
+}
+
+// Parses a hexadecimal address.
+static bool parse_address(char *str, uint16_t *out) {
+	char *end;
+	unsigned long value = strtoul(str, &end, 16);
+	if (!*str || *end || value > 0xffff) return false;
+	*out = value;
+	return true;
+}
+
+// Parses a decimal number.
+static bool parse_number(char *str, uint64_t *out) {
+	char *end;
+	*out = strtoull(str, &end, 10);
+	return *str && !*end;
+}
+
+// Makes a timer go off at a time in microseconds, in the clock of micros.
+static void timer_arm(int timer, uint64_t when) {
+	struct itimerspec spec = {
+		.it_value = { .tv_sec = when / 1000000, .tv_nsec = when % 1000000 * 1000 }
+	};
+	timerfd_settime(timer, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
 // Handler for program exit.
 void exithandler() {
 	// Restore TTY to sane.
-	system("stty sane");
+	if (tty_setup) {
+		video_close();
+		fflush(stdout);
+		system("stty sane");
+	}
+	// Finish the recording where the machine stopped.
+	record_close(&recorder, machine.cpu.numCycles);
+	// Write the coverage of everything that ran.
+	if (coverage) {
+		uint64_t rom_hash = hash_bytes(0xcbf29ce484222325, machine.cpu.rom, machine.cpu.romLen);
+		if (!coverage_save(coverage, options.coverage_file, rom_hash)) {
+			fprintf(stderr, "Could not save '%s': %s\n", options.coverage_file, coverage_error);
+		}
+	}
+	// Save the state if asked to, with the overlay before it's committed.
+	if (options.save_state && !cpu_savestate(options.save_state)) {
+		fprintf(stderr, "Could not save '%s': %s\n", options.save_state, savestate_error);
+	}
+	// Send what's left for the UART, if it goes without waiting.
+	if (machine.uart_dev.ctx) {
+		serial_poll(&serial);
+		serial_close(&serial);
+	}
+	// Make sure what was written to the disk is in the image.
+	if (options.disk_commit && disk.overlay && !disk_commit(&disk)) {
+		fprintf(stderr, "Could not commit the disk overlay: %s\n", disk_error);
+	}
+	disk_close(&disk);
 }
@@ -6,6 +6,11 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include "common/GR8EMUr3_2.h"
+#include "machine.h"
+#include "snapshot.h"
+#include "reverse.h"
+#include "loader.h"
+#include "tty_video.h"
 
 #define INSN_JSR 0x02
 #define INSN_RET 0x03
@@ -16,30 +21,71 @@
 #define TICK_MODE_STEP_OUT ((TICK_STEP_OUT << 16) | (INSN_JSR << 8) | INSN_RET)
 
 extern bool gr8cpu_running;
-extern gr8cpurev3_t cpu;
-extern size_t stats_mmio_r;
-extern size_t stats_mmio_w;
-
-#define KEYB_BUF_LEN 32
-extern char keyb_buf[KEYB_BUF_LEN];
-extern size_t keyb_buf_start;
-extern size_t keyb_buf_end;
+extern machine_t machine;
+extern snapctx_t snapctx;
+extern reverse_t rev;
+extern program_t program;
 
 // Options.
-#define EXEC_TYPE_RAW 0
-#define EXEC_TYPE_LHF 1
-#define EXEC_TYPE_ASM 2
-#define EXEC_TYPE_ASMV 3
-
 typedef struct options {
 	char    *disk_file;
 	char    *exec_file;
+	char    *explore_file;
+	char    *state_file;
+	char    *load_state;
+	char    *save_state;
+	char    *record_file;
+	char    *replay_file;
+	char    *console_file;
+	char    *input_file;
+	char    *coverage_file;
+	char    *disk_overlay;
+	char    *uart_link;
+	int      jobs;
+	uint64_t max_cycles;
+	uint64_t boot_cycles;
+	uint64_t timeout;
+	uint64_t input_pace;
+	uint64_t disk_latency;
+	uint16_t until_pc;
+	bool     has_until_pc;
+	bool     headless;
+	bool     disk_commit;
 	uint8_t  exec_type;
 	bool     run_immediately;
 	bool     show_help;
+	uint16_t *breakpoints;
+	uint32_t  breakpoints_len;
+	uint16_t *watchpoints;
+	uint32_t  watchpoints_len;
 } options_t;
 extern options_t options;
 
+// Most regions measured by the guest to show on the status line.
+#define STATUS_REGIONS 16
+
+// A region measured by the guest, as shown on the status line.
+typedef struct status_region {
+	int      id;
+	uint64_t count;
+	uint64_t cycles;
+} status_region_t;
+
+// What the emulation thread last told the terminal about the machine.
+typedef struct core_status {
+	uint64_t        handled;                // Commands handled so far.
+	bool            running;
+	double          hertz;                  // Real frequency of the last tick.
+	gr8cpurev3_t    cpu;                    // Registers and counts, its pointers aren't to be followed.
+	uint64_t        reads;
+	uint64_t        writes;
+	char            keyb[KEYB_BUF_LEN + 1];
+	status_region_t region[STATUS_REGIONS];
+	size_t          regions;
+	video_view_t    video;
+} core_status_t;
+extern core_status_t core_status;
+
 // Frequency options.
 #define N_FREQS 14
 
@@ -61,20 +107,12 @@ uint64_t nanos();
 // Describes a frequency as text.
 void desc_freq(char *buf, double freq);
 
-// Called when a character is added to the keyboard buffer.
-bool keybbuf_add(char c);
-// Called when a character is read from the keyboard buffer.
-char keybbuf_read(bool notouchy);
-// Creates a copy of the keyboard buffer of at most len characters.
-// Buffer must be at least len+1 characters.
-void keybbuf_copy(char *dest, size_t len);
-
 // Resets the CPU.
 void cpu_reset();
-// Handler for MMIO reading.
-uint8_t gr8cpu_mmio_read(uint16_t address, bool notouchy);
-// Handler for MMIO writing.
-void gr8cpu_mmio_write(uint16_t address, uint8_t value);
+// Saves the machine to a save state file.
+bool cpu_savestate(char *path);
+// Loads the machine from a save state file.
+bool cpu_loadstate(char *path);
 
 // Handler for program exit.
 void exithandler();
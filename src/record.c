@@ -0,0 +1,147 @@
+
+#include "record.h"
+#include "snapshot.h"
+#include <stdlib.h>
+#include <string.h>
+
+char *record_error = "";
+
+static const char *event_names[] = {
+	"key", "irq", "nmi", "uart", "console", "reset", "rewind", "end"
+};
+#define N_EVENT_NAMES (sizeof(event_names) / sizeof(char *))
+
+static uint64_t rom_hash(gr8cpurev3_t *cpu) {
+	return hash_bytes(0xcbf29ce484222325, cpu->rom, cpu->romLen);
+}
+
+// Starts recording the machine into a file.
+bool record_open(recorder_t *rec, char *path, gr8cpurev3_t *cpu) {
+	rec->fd = fopen(path, "w");
+	if (!rec->fd) {
+		record_error = "Cannot open file";
+		return false;
+	}
+	fprintf(rec->fd, "%s %d %016lx %lu\n", RECORD_MAGIC, RECORD_VERSION, rom_hash(cpu), cpu->numCycles);
+	fflush(rec->fd);
+	return true;
+}
+
+// Adds an event to the recording, if there is one.
+void record_event(recorder_t *rec, uint64_t cycle, int type, uint8_t value) {
+	if (!rec->fd) return;
+	if (type == REC_KEY || type == REC_UART) {
+		fprintf(rec->fd, "%lu %s %02x\n", cycle, event_names[type], value);
+	} else {
+		fprintf(rec->fd, "%lu %s\n", cycle, event_names[type]);
+	}
+	// Flushed right away, so that a crash still leaves the events leading up to it.
+	fflush(rec->fd);
+}
+
+// Ends the recording at a cycle.
+void record_close(recorder_t *rec, uint64_t cycle) {
+	if (!rec->fd) return;
+	record_event(rec, cycle, REC_END, 0);
+	fclose(rec->fd);
+	rec->fd = NULL;
+}
+
+static bool replay_push(replay_t *rep, size_t *cap, rec_event_t event) {
+	if (rep->len == *cap) {
+		*cap = *cap ? *cap * 2 : 64;
+		rec_event_t *mem = realloc(rep->events, *cap * sizeof(rec_event_t));
+		if (!mem) return false;
+		rep->events = mem;
+	}
+	rep->events[rep->len ++] = event;
+	return true;
+}
+
+// Loads a recording made from the current state of the machine.
+bool replay_load(replay_t *rep, char *path, gr8cpurev3_t *cpu) {
+	memset(rep, 0, sizeof(replay_t));
+	FILE *fd = fopen(path, "r");
+	if (!fd) {
+		record_error = "Cannot open file";
+		return false;
+	}
+	char line[64];
+	char magic[8];
+	int version;
+	uint64_t hash, start;
+	char *err = NULL;
+	if (!fgets(line, sizeof(line), fd) || sscanf(line, "%7s %d %lx %lu", magic, &version, &hash, &start) != 4
+			|| strcmp(magic, RECORD_MAGIC)) {
+		err = "Not a recording";
+	} else if (version != RECORD_VERSION) {
+		err = "Unsupported recording version";
+	} else if (hash != rom_hash(cpu)) {
+		err = "Recording is for a different ROM";
+	} else if (start != cpu->numCycles) {
+		err = "Recording starts at a different cycle";
+	}
+	// Events since the last reset, which a rewind can throw away.
+	size_t epoch = 0;
+	size_t cap = 0;
+	while (!err && fgets(line, sizeof(line), fd)) {
+		rec_event_t event = {0};
+		char name[8];
+		unsigned value = 0;
+		int n = sscanf(line, "%lu %7s %x", &event.cycle, name, &value);
+		event.type = N_EVENT_NAMES;
+		for (size_t i = 0; n >= 2 && i < N_EVENT_NAMES; i++) {
+			if (!strcmp(name, event_names[i])) event.type = i;
+		}
+		event.value = value;
+		if (event.type == N_EVENT_NAMES || ((event.type == REC_KEY || event.type == REC_UART) && n != 3)) {
+			err = "Recording is corrupt";
+		} else if (event.type == REC_REWIND) {
+			while (rep->len > epoch && rep->events[rep->len - 1].cycle > event.cycle) rep->len --;
+		} else if (!replay_push(rep, &cap, event)) {
+			err = "Out of memory";
+		} else if (event.type == REC_RESET) {
+			epoch = rep->len;
+		} else if (event.type == REC_END) {
+			break;
+		}
+	}
+	fclose(fd);
+	if (err) {
+		record_error = err;
+		replay_free(rep);
+		return false;
+	}
+	return true;
+}
+
+// Forgets the recording.
+void replay_free(replay_t *rep) {
+	free(rep->events);
+	memset(rep, 0, sizeof(replay_t));
+}
+
+// Cycle of the next event, or UINT64_MAX if there is none.
+uint64_t replay_next_cycle(replay_t *rep) {
+	return rep->next < rep->len ? rep->events[rep->next].cycle : UINT64_MAX;
+}
+
+// Takes the next event if it is due by a cycle.
+rec_event_t *replay_due(replay_t *rep, uint64_t cycle) {
+	if (rep->next < rep->len && rep->events[rep->next].cycle <= cycle) {
+		return &rep->events[rep->next ++];
+	}
+	return NULL;
+}
+
+// Moves back to the first event after a cycle, after the machine went back.
+void replay_seek(replay_t *rep, uint64_t cycle) {
+	// Only events since the last reset are in the machine's history.
+	size_t epoch = rep->next;
+	while (epoch && rep->events[epoch - 1].type != REC_RESET) epoch --;
+	rep->next = epoch;
+	while (rep->next < rep->len && rep->events[rep->next].cycle <= cycle
+			&& rep->events[rep->next].type != REC_RESET) {
+		rep->next ++;
+	}
+}
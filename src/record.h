@@ -0,0 +1,83 @@
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "common/GR8EMUr3_2.h"
+#include "reverse.h"
+
+#define RECORD_MAGIC   "GR8REC"
+#define RECORD_VERSION 1
+// Cycles to run at a time while replaying, between looking at the keyboard.
+#define REPLAY_CHUNK   100000
+
+// Kinds of recorded events, the first are the same as INPUT_*.
+#define REC_KEY     INPUT_KEY
+#define REC_IRQ     INPUT_IRQ
+#define REC_NMI     INPUT_NMI
+#define REC_UART    INPUT_UART
+#define REC_CONSOLE INPUT_CONSOLE
+#define REC_RESET   5
+#define REC_REWIND  6
+#define REC_END     7
+
+/*
+
+Recordings are text, one event per line:
+	GR8REC <version> <ROM hash> <first cycle>
+	<cycle> key <hex value>
+	<cycle> irq
+	<cycle> nmi
+	<cycle> uart <hex value>
+	<cycle> console
+	<cycle> reset
+	<cycle> rewind
+	<cycle> end
+
+Cycles are the value of numCycles when the event happened, which is the only clock
+a replay uses. After a reset, cycles count from 0 again. A rewind means the history
+after its cycle was thrown away, including the events in it.
+
+*/
+
+typedef struct rec_event {
+	uint64_t cycle;
+	uint8_t  type;
+	uint8_t  value;
+} rec_event_t;
+
+typedef struct recorder {
+	FILE *fd;
+} recorder_t;
+
+typedef struct replay {
+	rec_event_t *events;
+	size_t       len;
+	size_t       next;
+} replay_t;
+
+// Describes why the last recording or replay failed.
+extern char *record_error;
+
+// Starts recording the machine into a file.
+bool record_open(recorder_t *rec, char *path, gr8cpurev3_t *cpu);
+// Adds an event to the recording, if there is one.
+void record_event(recorder_t *rec, uint64_t cycle, int type, uint8_t value);
+// Ends the recording at a cycle.
+void record_close(recorder_t *rec, uint64_t cycle);
+
+// Loads a recording made from the current state of the machine.
+bool replay_load(replay_t *rep, char *path, gr8cpurev3_t *cpu);
+// Forgets the recording.
+void replay_free(replay_t *rep);
+// Cycle of the next event, or UINT64_MAX if there is none.
+uint64_t replay_next_cycle(replay_t *rep);
+// Takes the next event if it is due by a cycle.
+rec_event_t *replay_due(replay_t *rep, uint64_t cycle);
+// Moves back to the first event after a cycle, after the machine went back.
+void replay_seek(replay_t *rep, uint64_t cycle);
+
+#endif //RECORD_H
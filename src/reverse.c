@@ -0,0 +1,231 @@
+
+#include "reverse.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// What to look for while re-executing.
+#define REV_MATCH_NONE  0
+#define REV_MATCH_INSN  1
+#define REV_MATCH_BREAK 2
+
+// No cycle matched.
+#define REV_NONE UINT64_MAX
+
+static snapshot_t *rev_checkpoint(reverse_t *rev, size_t index) {
+	return rev->ring[(rev->ring_start + index) % REV_RING_LEN];
+}
+
+static uint64_t rev_checkpoint_cycle(reverse_t *rev, size_t index) {
+	return rev_checkpoint(rev, index)->cpu.numCycles;
+}
+
+// Goes back to a checkpoint, and the disk with it.
+static void rev_restore(reverse_t *rev, size_t index) {
+	snapshot_restore(rev->snapctx, rev_checkpoint(rev, index));
+	if (rev->disk) disk_undo(rev->disk, rev->disk_marks[(rev->ring_start + index) % REV_RING_LEN]);
+}
+
+// Takes a new checkpoint, dropping the oldest if the ring is full.
+static void rev_push(reverse_t *rev) {
+	snapshot_t *snap = snapshot_take(rev->snapctx);
+	if (!snap) return;
+	if (rev->ring_count == REV_RING_LEN) {
+		snapshot_free(rev->ring[rev->ring_start]);
+		rev->ring_start = (rev->ring_start + 1) % REV_RING_LEN;
+		rev->ring_count --;
+		if (rev->disk) disk_forget(rev->disk, rev->disk_marks[rev->ring_start]);
+		// Inputs up to the oldest checkpoint are part of it.
+		uint64_t oldest = rev_checkpoint_cycle(rev, 0);
+		size_t drop = 0;
+		while (drop < rev->inputs_len && rev->inputs[drop].cycle <= oldest) drop ++;
+		memmove(rev->inputs, rev->inputs + drop, (rev->inputs_len - drop) * sizeof(rev_input_t));
+		rev->inputs_len -= drop;
+	}
+	size_t index = (rev->ring_start + rev->ring_count) % REV_RING_LEN;
+	rev->ring[index]       = snap;
+	rev->disk_marks[index] = rev->disk ? disk_mark(rev->disk) : 0;
+	rev->ring_count ++;
+}
+
+// Forgets everything after a cycle.
+static void rev_truncate(reverse_t *rev, uint64_t cycle) {
+	while (rev->ring_count > 1 && rev_checkpoint_cycle(rev, rev->ring_count - 1) > cycle) {
+		rev->ring_count --;
+		snapshot_free(rev_checkpoint(rev, rev->ring_count));
+	}
+	while (rev->inputs_len && rev->inputs[rev->inputs_len - 1].cycle > cycle) {
+		rev->inputs_len --;
+	}
+}
+
+// Executes from the current state up to a cycle, feeding back inputs on the way.
+// Cycles that never ran before are checkpointed like any other run, unless replaying.
+// Returns the last cycle before limit that matched, or REV_NONE.
+static uint64_t rev_exec(reverse_t *rev, uint64_t target, int match, uint64_t limit) {
+	gr8cpurev3_t *cpu = rev->cpu;
+	uint64_t last = REV_NONE;
+	// Inputs up to now are already part of the state.
+	size_t next = 0;
+	while (next < rev->inputs_len && rev->inputs[next].cycle <= cpu->numCycles) next ++;
+	if (match == REV_MATCH_INSN && cpu->mode == MODE_LOAD && cpu->stage == 0 && cpu->numCycles < limit) {
+		last = cpu->numCycles;
+	}
+	while (cpu->numCycles < target) {
+		// Run until the next input or the next cycle to inspect.
+		uint64_t until = target;
+		if (match != REV_MATCH_NONE) {
+			until = cpu->numCycles + 1;
+		} else if (next < rev->inputs_len && rev->inputs[next].cycle < until) {
+			until = rev->inputs[next].cycle;
+		}
+		uint64_t n = until - cpu->numCycles;
+		if (n > INT_MAX) n = INT_MAX;
+		int exc = rev->replaying ? gr8cpurev3_tick(cpu, n, TICK_NORMAL << 16) : rev_run(rev, n);
+		if (exc != EXC_NORM && exc != EXC_BRK && exc != EXC_WATCH) break;
+		if (cpu->numCycles < limit) {
+			if (match == REV_MATCH_INSN && cpu->mode == MODE_LOAD && cpu->stage == 0) {
+				last = cpu->numCycles;
+			} else if (match == REV_MATCH_BREAK && exc != EXC_NORM) {
+				last = cpu->numCycles;
+			}
+		}
+		// Feed back inputs that arrived at this cycle.
+		while (next < rev->inputs_len && rev->inputs[next].cycle <= cpu->numCycles) {
+			rev->feed(rev->inputs[next].type, rev->inputs[next].c);
+			next ++;
+		}
+	}
+	return last;
+}
+
+// Looks back for the last cycle that matches, checkpoint by checkpoint.
+static bool rev_scan(reverse_t *rev, int match) {
+	uint64_t before = rev->cpu->numCycles;
+	for (size_t i = rev->ring_count; i > 0; i--) {
+		uint64_t start = rev_checkpoint_cycle(rev, i - 1);
+		if (start >= before) continue;
+		uint64_t end = before;
+		if (i < rev->ring_count && rev_checkpoint_cycle(rev, i) < end) {
+			end = rev_checkpoint_cycle(rev, i);
+		}
+		rev_restore(rev, i - 1);
+		rev->replaying = true;
+		uint64_t found = rev_exec(rev, end, match, before);
+		rev->replaying = false;
+		if (found != REV_NONE) {
+			return rev_goto(rev, found);
+		}
+	}
+	// Nothing found, go back as far as we can.
+	if (rev->ring_count) rev_goto(rev, rev_checkpoint_cycle(rev, 0));
+	return false;
+}
+
+// Initialises reverse execution for the machine snapctx tracks.
+void rev_init(reverse_t *rev, snapctx_t *snapctx, bool (*feed)(int type, char c)) {
+	memset(rev, 0, sizeof(reverse_t));
+	rev->snapctx = snapctx;
+	rev->cpu     = snapctx->cpu;
+	rev->feed    = feed;
+}
+
+// Forgets all history, after the machine was reset or loaded.
+void rev_reset(reverse_t *rev) {
+	while (rev->ring_count) {
+		rev->ring_count --;
+		snapshot_free(rev_checkpoint(rev, rev->ring_count));
+	}
+	rev->ring_start = 0;
+	rev->inputs_len = 0;
+	if (rev->disk) disk_forget(rev->disk, disk_mark(rev->disk));
+	rev_push(rev);
+}
+
+// Takes a checkpoint if one is due.
+void rev_update(reverse_t *rev) {
+	if (!rev->ring_count || rev->cpu->numCycles >= rev_checkpoint_cycle(rev, rev->ring_count - 1) + REV_INTERVAL) {
+		rev_push(rev);
+	}
+}
+
+// Runs the CPU normally, taking checkpoints as needed.
+int rev_run(reverse_t *rev, int max_ticks) {
+	int res = EXC_NORM;
+	while (max_ticks > 0 && res == EXC_NORM) {
+		// Stop for the next checkpoint on the way.
+		int n = max_ticks;
+		if (rev->ring_count) {
+			uint64_t due = rev_checkpoint_cycle(rev, rev->ring_count - 1) + REV_INTERVAL;
+			if (due > rev->cpu->numCycles && due - rev->cpu->numCycles < n) {
+				n = due - rev->cpu->numCycles;
+			}
+		}
+		res = gr8cpurev3_tick(rev->cpu, n, TICK_NORMAL << 16);
+		max_ticks -= n;
+		rev_update(rev);
+	}
+	return res;
+}
+
+// Gives an input to the machine and remembers it for re-execution.
+bool rev_input(reverse_t *rev, int type, char c) {
+	uint64_t now = rev->cpu->numCycles;
+	if (rev->inputs_len == rev->inputs_cap) {
+		size_t cap = rev->inputs_cap ? rev->inputs_cap * 2 : 64;
+		rev_input_t *mem = realloc(rev->inputs, cap * sizeof(rev_input_t));
+		if (!mem) return rev->feed(type, c);
+		rev->inputs     = mem;
+		rev->inputs_cap = cap;
+	}
+	rev->inputs[rev->inputs_len ++] = (rev_input_t) { .cycle = now, .type = type, .c = c };
+	bool res = rev->feed(type, c);
+	if (rev->ring_count && rev_checkpoint_cycle(rev, rev->ring_count - 1) == now) {
+		// Checkpoints include the inputs of their cycle.
+		rev->ring_count --;
+		snapshot_free(rev_checkpoint(rev, rev->ring_count));
+		rev_push(rev);
+	}
+	return res;
+}
+
+// Goes to a cycle, forwards or backwards.
+// Going backwards forgets the history after that cycle.
+bool rev_goto(reverse_t *rev, uint64_t cycle) {
+	if (cycle >= rev->cpu->numCycles) {
+		// Nothing after now is kept, so this is new execution.
+		rev_exec(rev, cycle, REV_MATCH_NONE, 0);
+		return rev->cpu->numCycles == cycle;
+	}
+	if (!rev->ring_count) return false;
+	// Find the last checkpoint before it.
+	size_t i = rev->ring_count;
+	while (i > 1 && rev_checkpoint_cycle(rev, i - 1) > cycle) i--;
+	if (rev_checkpoint_cycle(rev, i - 1) > cycle) {
+		// It's older than our history.
+		cycle = rev_checkpoint_cycle(rev, 0);
+	}
+	rev_truncate(rev, cycle);
+	rev_restore(rev, i - 1);
+	rev->replaying = true;
+	rev_exec(rev, cycle, REV_MATCH_NONE, 0);
+	rev->replaying = false;
+	return rev->cpu->numCycles == cycle;
+}
+
+// Goes back one cycle.
+bool rev_step_back(reverse_t *rev) {
+	if (!rev->cpu->numCycles) return false;
+	return rev_goto(rev, rev->cpu->numCycles - 1);
+}
+
+// Goes back to the start of the previous instruction.
+bool rev_step_back_insn(reverse_t *rev) {
+	return rev_scan(rev, REV_MATCH_INSN);
+}
+
+// Goes back to the previous breakpoint or watchpoint hit.
+// Stops at the oldest checkpoint if there is none.
+bool rev_continue(reverse_t *rev) {
+	return rev_scan(rev, REV_MATCH_BREAK);
+}
@@ -0,0 +1,71 @@
+
+#ifndef REVERSE_H
+#define REVERSE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "common/GR8EMUr3_2.h"
+#include "snapshot.h"
+#include "disk.h"
+
+// Cycles between checkpoints, this bounds the cost of going back.
+#define REV_INTERVAL 20000
+// Number of checkpoints kept, this bounds the memory used.
+#define REV_RING_LEN 256
+
+// Kinds of input from outside the machine.
+#define INPUT_KEY     0
+#define INPUT_IRQ     1
+#define INPUT_NMI     2
+#define INPUT_UART    3
+#define INPUT_CONSOLE 4 // The host took all console output.
+
+// An input that arrived at a certain cycle.
+typedef struct rev_input {
+	uint64_t cycle;
+	uint8_t  type;
+	char     c;
+} rev_input_t;
+
+typedef struct reverse {
+	snapctx_t    *snapctx;
+	gr8cpurev3_t *cpu;
+	bool        (*feed)(int type, char c);  // Gives an input to the machine.
+	disk_t       *disk;                     // Optional and undoable, its writes are undone when going back.
+	// Checkpoints, which only store the pages changed since the one before.
+	snapshot_t   *ring[REV_RING_LEN];
+	size_t        ring_start;
+	size_t        ring_count;
+	size_t        disk_marks[REV_RING_LEN]; // Where the disk was at each checkpoint, by ring index.
+	// Inputs since the oldest checkpoint, to re-execute deterministically.
+	rev_input_t  *inputs;
+	size_t        inputs_len;
+	size_t        inputs_cap;
+	// Set while re-executing cycles that already ran, so that output is not repeated.
+	bool          replaying;
+} reverse_t;
+
+// Initialises reverse execution for the machine snapctx tracks.
+void rev_init(reverse_t *rev, snapctx_t *snapctx, bool (*feed)(int type, char c));
+// Forgets all history, after the machine was reset or loaded.
+void rev_reset(reverse_t *rev);
+// Takes a checkpoint if one is due.
+void rev_update(reverse_t *rev);
+// Runs the CPU normally, taking checkpoints as needed.
+int rev_run(reverse_t *rev, int max_ticks);
+// Gives an input to the machine and remembers it for re-execution.
+bool rev_input(reverse_t *rev, int type, char c);
+
+// Goes to a cycle, forwards or backwards.
+// Going backwards forgets the history after that cycle.
+bool rev_goto(reverse_t *rev, uint64_t cycle);
+// Goes back one cycle.
+bool rev_step_back(reverse_t *rev);
+// Goes back to the start of the previous instruction.
+bool rev_step_back_insn(reverse_t *rev);
+// Goes back to the previous breakpoint or watchpoint hit.
+// Stops at the oldest checkpoint if there is none.
+bool rev_continue(reverse_t *rev);
+
+#endif //REVERSE_H
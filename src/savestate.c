@@ -0,0 +1,234 @@
+
+#include "savestate.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+char *savestate_error = "";
+
+// Describes what the state of the devices looks like.
+static uint64_t dev_hash(devbus_t *bus) {
+	uint64_t hash = 0xcbf29ce484222325;
+	for (device_t *dev = bus->devices; dev; dev = dev->next) {
+		hash = hash_bytes(hash, dev->name, strlen(dev->name));
+		hash = hash_bytes(hash, &dev->state_len, sizeof(dev->state_len));
+	}
+	return hash;
+}
+
+static void fill_hashes(savestate_header_t *head, gr8cpurev3_t *cpu, devbus_t *bus) {
+	head->rom_hash = hash_bytes(0xcbf29ce484222325, cpu->rom, cpu->romLen);
+	head->isa_hash = hash_bytes(0xcbf29ce484222325, cpu->isaRom, cpu->isaRomLen * sizeof(uint32_t));
+	head->dev_hash = dev_hash(bus);
+}
+
+static bool page_is_zero(const uint8_t *page) {
+	for (int i = 0; i < 256; i++) {
+		if (page[i]) return false;
+	}
+	return true;
+}
+
+// Writes the machine to a save state file.
+bool savestate_write(char *path, gr8cpurev3_t *cpu, devbus_t *bus) {
+	savestate_header_t head;
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, SAVESTATE_MAGIC, sizeof(head.magic));
+	head.version       = SAVESTATE_VERSION;
+	head.header_len    = sizeof(head);
+	fill_hashes(&head, cpu, bus);
+	// CPU.
+	head.flags         = gr8cpurev3_readflags(cpu);
+	head.was_hwi       = cpu->wasHWI;
+	head.bus           = cpu->bus;
+	head.stage         = cpu->stage;
+	head.mode          = cpu->mode;
+	head.reg_a         = cpu->regA;
+	head.reg_b         = cpu->regB;
+	head.reg_x         = cpu->regX;
+	head.reg_y         = cpu->regY;
+	head.reg_ir        = cpu->regIR;
+	head.reg_pc        = cpu->regPC;
+	head.reg_ar        = cpu->regAR;
+	head.stack_ptr     = cpu->stackPtr;
+	head.reg_irq       = cpu->regIRQ;
+	head.reg_nmi       = cpu->regNMI;
+	head.adr_bus       = cpu->adrBus;
+	head.alo           = cpu->alo;
+	head.scheduled_irq = cpu->schduledIRQ;
+	head.scheduled_nmi = cpu->schduledNMI;
+	head.skipping      = cpu->skipping;
+	head.skip_depth    = cpu->skipDepth;
+	head.debug_irq     = cpu->debugIRQ;
+	head.debug_nmi     = cpu->debugNMI;
+	head.sleeping      = cpu->sleeping;
+	head.num_cycles    = cpu->numCycles;
+	head.num_insns     = cpu->numInsns;
+	head.num_subs      = cpu->numSubs;
+	// Devices.
+	head.dev_state_len = devbus_state_len(bus);
+	uint8_t *dev_state = malloc(head.dev_state_len + 1);
+	if (!dev_state) {
+		savestate_error = "Out of memory";
+		return false;
+	}
+	devbus_save(bus, dev_state);
+	// RAM, leaving out the pages that are all zeroes.
+	size_t offset = sizeof(head) + head.dev_state_len;
+	head.pages_offset = (offset + SAVESTATE_ALIGN - 1) / SAVESTATE_ALIGN * SAVESTATE_ALIGN;
+	for (int i = 0; i < 256; i++) {
+		head.page_map[i] = !page_is_zero(cpu->ram + i * 256);
+	}
+	// RAM banks, the ones the MMU allocated.
+	mmu_banks_t *banks = dev_mmu_banks(bus);
+	for (int i = 1; banks && i <= MMU_RAM_BANKS; i++) {
+		head.bank_map[i] = !!banks->ram[i];
+	}
+	// Write it all out.
+	FILE *fd = fopen(path, "wb");
+	if (!fd) {
+		free(dev_state);
+		savestate_error = "Cannot open file";
+		return false;
+	}
+	bool ok = fwrite(&head, sizeof(head), 1, fd) == 1;
+	ok &= fwrite(dev_state, 1, head.dev_state_len, fd) == head.dev_state_len;
+	for (; ok && offset < head.pages_offset; offset++) {
+		ok &= fputc(0, fd) != EOF;
+	}
+	for (int i = 0; ok && i < 256; i++) {
+		if (head.page_map[i]) {
+			ok &= fwrite(cpu->ram + i * 256, 256, 1, fd) == 1;
+		}
+	}
+	for (int i = 1; ok && i <= MMU_RAM_BANKS; i++) {
+		if (head.bank_map[i]) {
+			ok &= fwrite(banks->ram[i], BANK_SIZE, 1, fd) == 1;
+		}
+	}
+	ok &= fclose(fd) == 0;
+	free(dev_state);
+	if (!ok) savestate_error = "Cannot write file";
+	return ok;
+}
+
+// Loads the machine from a save state file, made with the same ROM and ISA.
+bool savestate_read(char *path, gr8cpurev3_t *cpu, devbus_t *bus) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		savestate_error = "Cannot open file";
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size < sizeof(savestate_header_t)) {
+		close(fd);
+		savestate_error = "Not a save state";
+		return false;
+	}
+	size_t size = st.st_size;
+	uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		savestate_error = "Cannot map file";
+		return false;
+	}
+	// Check that it fits this machine.
+	const savestate_header_t *head = (const savestate_header_t *) map;
+	savestate_header_t expect;
+	fill_hashes(&expect, cpu, bus);
+	mmu_banks_t *banks = dev_mmu_banks(bus);
+	size_t n_pages = 0;
+	size_t n_banks = 0;
+	for (int i = 0; i < 256; i++) n_pages += !!head->page_map[i];
+	for (int i = 1; i <= MMU_RAM_BANKS; i++) n_banks += !!head->bank_map[i];
+	char *err = NULL;
+	if (memcmp(head->magic, SAVESTATE_MAGIC, sizeof(head->magic)) || head->header_len != sizeof(savestate_header_t)) {
+		err = "Not a save state";
+	} else if (head->version != SAVESTATE_VERSION) {
+		err = "Unsupported save state version";
+	} else if (head->rom_hash != expect.rom_hash || head->isa_hash != expect.isa_hash) {
+		err = "Save state is for a different ROM or ISA";
+	} else if (head->dev_hash != expect.dev_hash || head->dev_state_len != devbus_state_len(bus)) {
+		err = "Save state is for different devices";
+	} else if (head->pages_offset < sizeof(savestate_header_t) + head->dev_state_len
+			|| head->pages_offset + n_pages * 256 + n_banks * BANK_SIZE > size) {
+		err = "Save state is truncated";
+	} else if (n_banks && !banks) {
+		err = "Save state is for different devices";
+	}
+	// Allocate the banks first, so running out of memory leaves the machine as it was.
+	for (int i = 1; !err && i <= MMU_RAM_BANKS; i++) {
+		if (head->bank_map[i] && !banks->ram[i]) {
+			banks->ram[i] = calloc(1, BANK_SIZE);
+			if (!banks->ram[i]) err = "Out of memory";
+		}
+	}
+	if (err) {
+		savestate_error = err;
+		munmap(map, size);
+		return false;
+	}
+	// CPU.
+	cpu->flagHWI     = head->flags & 0x01;
+	cpu->flagNMI     = head->flags & 0x10;
+	cpu->flagIRQ     = head->flags & 0x20;
+	cpu->flagZero    = head->flags & 0x40;
+	cpu->flagCout    = head->flags & 0x80;
+	cpu->wasHWI      = head->was_hwi;
+	cpu->bus         = head->bus;
+	cpu->stage       = head->stage;
+	cpu->mode        = head->mode;
+	cpu->regA        = head->reg_a;
+	cpu->regB        = head->reg_b;
+	cpu->regX        = head->reg_x;
+	cpu->regY        = head->reg_y;
+	cpu->regIR       = head->reg_ir;
+	cpu->regPC       = head->reg_pc;
+	cpu->regAR       = head->reg_ar;
+	cpu->stackPtr    = head->stack_ptr;
+	cpu->regIRQ      = head->reg_irq;
+	cpu->regNMI      = head->reg_nmi;
+	cpu->adrBus      = head->adr_bus;
+	cpu->alo         = head->alo;
+	cpu->schduledIRQ = head->scheduled_irq;
+	cpu->schduledNMI = head->scheduled_nmi;
+	cpu->skipping    = head->skipping;
+	cpu->skipDepth   = head->skip_depth;
+	cpu->debugIRQ    = head->debug_irq;
+	cpu->debugNMI    = head->debug_nmi;
+	cpu->sleeping    = head->sleeping;
+	cpu->numCycles   = head->num_cycles;
+	cpu->numInsns    = head->num_insns;
+	cpu->numSubs     = head->num_subs;
+	cpu->watchHit    = false;
+	// RAM, straight from the mapping.
+	const uint8_t *page = map + head->pages_offset;
+	for (int i = 0; i < 256; i++) {
+		if (head->page_map[i]) {
+			memcpy(cpu->ram + i * 256, page, 256);
+			page += 256;
+		} else {
+			memset(cpu->ram + i * 256, 0, 256);
+		}
+	}
+	if (cpu->ramDirty) memset(cpu->ramDirty, 1, 256);
+	// RAM banks, the ones not stored weren't written yet.
+	for (int i = 1; banks && i <= MMU_RAM_BANKS; i++) {
+		if (head->bank_map[i]) {
+			memcpy(banks->ram[i], page, BANK_SIZE);
+			page += BANK_SIZE;
+		} else {
+			free(banks->ram[i]);
+			banks->ram[i] = NULL;
+		}
+	}
+	if (banks) memset(banks->dirty, 1, sizeof(banks->dirty));
+	// Devices, after the banks so the windows point at them.
+	devbus_load(bus, map + sizeof(savestate_header_t));
+	munmap(map, size);
+	return true;
+}
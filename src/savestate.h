@@ -0,0 +1,75 @@
+
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "common/GR8EMUr3_2.h"
+#include "devices.h"
+#include "snapshot.h"
+#include "dev_mmu.h"
+
+#define SAVESTATE_MAGIC   "GR8STATE"
+#define SAVESTATE_VERSION 2
+// RAM pages are stored from an offset aligned to this.
+#define SAVESTATE_ALIGN   4096
+
+/*
+
+Save state files are laid out as:
+	savestate_header_t
+	device states, as saved by devbus_save
+	padding up to SAVESTATE_ALIGN
+	every RAM page that isn't all zeroes, in order, as listed in page_map
+	every RAM bank the MMU allocated, BANK_SIZE bytes each, as listed in bank_map
+
+Numbers are stored in host byte order.
+Device coroutines are saved by where they resume, which can move between builds.
+
+*/
+
+typedef struct savestate_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t header_len;
+	// ==== COMPATIBILITY ====
+	uint64_t rom_hash;
+	uint64_t isa_hash;
+	uint64_t dev_hash;          // Names and state sizes of the devices.
+	// ==== CPU ====
+	uint8_t  flags;             // As read by gr8cpurev3_readflags.
+	uint8_t  was_hwi;
+	uint8_t  bus;
+	uint8_t  stage, mode;
+	uint8_t  reg_a, reg_b, reg_x, reg_y, reg_ir;
+	uint16_t reg_pc, reg_ar, stack_ptr;
+	uint16_t reg_irq, reg_nmi;
+	uint16_t adr_bus, alo;
+	int64_t  scheduled_irq;
+	int64_t  scheduled_nmi;
+	uint8_t  skipping;
+	uint8_t  debug_irq, debug_nmi;
+	uint8_t  sleeping;
+	uint16_t skip_depth;
+	uint64_t num_cycles;
+	uint64_t num_insns;
+	uint64_t num_subs;
+	// ==== DEVICES ====
+	uint32_t dev_state_len;
+	// ==== RAM ====
+	uint32_t pages_offset;
+	uint8_t  page_map[256];     // Non-zero if the page is stored.
+	// ==== BANKS ====
+	uint8_t  bank_map[MMU_RAM_BANKS + 1];   // Non-zero if the bank is stored.
+} savestate_header_t;
+
+// Describes why the last save state failed.
+extern char *savestate_error;
+
+// Writes the machine to a save state file.
+bool savestate_write(char *path, gr8cpurev3_t *cpu, devbus_t *bus);
+// Loads the machine from a save state file, made with the same ROM and ISA.
+bool savestate_read(char *path, gr8cpurev3_t *cpu, devbus_t *bus);
+
+#endif //SAVESTATE_H
@@ -0,0 +1,117 @@
+#define _GNU_SOURCE
+#include "serial.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <termios.h>
+#include <poll.h>
+
+const char *serial_error = "";
+
+static uint32_t ring_used(serial_ring_t *ring) {
+	return ring->tail - ring->head;
+}
+
+// Creates a pseudo-terminal in raw mode, with a symlink to it at link if not NULL.
+bool serial_open(serial_t *serial, const char *link) {
+	memset(serial, 0, sizeof(serial_t));
+	serial->slave  = -1;
+	serial->master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (serial->master < 0 || grantpt(serial->master) || unlockpt(serial->master)) {
+		serial_error = "could not create a pseudo-terminal";
+		goto fail;
+	}
+	serial->name  = strdup(ptsname(serial->master));
+	serial->slave = open(serial->name, O_RDWR | O_NOCTTY);
+	if (serial->slave < 0) {
+		serial_error = "could not open the pseudo-terminal";
+		goto fail;
+	}
+	// Bytes go through as they are, no echo or line editing.
+	struct termios attr;
+	tcgetattr(serial->slave, &attr);
+	cfmakeraw(&attr);
+	tcsetattr(serial->slave, TCSANOW, &attr);
+	fcntl(serial->master, F_SETFL, fcntl(serial->master, F_GETFL) | O_NONBLOCK);
+	if (link) {
+		unlink(link);
+		if (symlink(serial->name, link)) {
+			serial_error = "could not create the link";
+			goto fail;
+		}
+		serial->link = strdup(link);
+	}
+	return true;
+	
+	fail:
+	serial_close(serial);
+	return false;
+}
+
+// Closes the terminal and removes the symlink.
+void serial_close(serial_t *serial) {
+	if (serial->link) unlink(serial->link);
+	if (serial->slave >= 0) close(serial->slave);
+	if (serial->master >= 0) close(serial->master);
+	free(serial->link);
+	free(serial->name);
+	serial->link   = NULL;
+	serial->name   = NULL;
+	serial->slave  = -1;
+	serial->master = -1;
+}
+
+// Moves bytes between the terminal and the rings, as far as that goes without waiting.
+void serial_poll(serial_t *serial) {
+	if (serial->master < 0) return;
+	// Read into the free space, which may wrap around.
+	serial_ring_t *rx = &serial->rx;
+	while (ring_used(rx) < SERIAL_RING) {
+		uint32_t at  = rx->tail % SERIAL_RING;
+		uint32_t len = SERIAL_RING - ring_used(rx);
+		if (len > SERIAL_RING - at) len = SERIAL_RING - at;
+		ssize_t got = read(serial->master, rx->buf + at, len);
+		if (got <= 0) break;
+		rx->tail += got;
+	}
+	// Write what the guest sent, until the terminal is full.
+	serial_ring_t *tx = &serial->tx;
+	while (ring_used(tx)) {
+		uint32_t at  = tx->head % SERIAL_RING;
+		uint32_t len = ring_used(tx);
+		if (len > SERIAL_RING - at) len = SERIAL_RING - at;
+		ssize_t put = write(serial->master, tx->buf + at, len);
+		if (put <= 0) break;
+		tx->head += put;
+	}
+}
+
+// Tells what to poll the terminal for, for serial_poll to have something to do.
+short serial_events(serial_t *serial) {
+	return (ring_used(&serial->rx) < SERIAL_RING ? POLLIN : 0) | (ring_used(&serial->tx) ? POLLOUT : 0);
+}
+
+// Tells whether there's a byte for the guest.
+bool serial_rx_ready(serial_t *serial) {
+	return ring_used(&serial->rx) > 0;
+}
+
+// Takes a byte for the guest, returns false if there is none.
+bool serial_rx_get(serial_t *serial, uint8_t *value) {
+	serial_ring_t *rx = &serial->rx;
+	if (!ring_used(rx)) return false;
+	*value = rx->buf[rx->head ++ % SERIAL_RING];
+	return true;
+}
+
+// Adds a byte from the guest, returns false if the ring is full.
+// Muted bytes are taken and dropped.
+bool serial_tx_put(serial_t *serial, uint8_t value) {
+	serial_ring_t *tx = &serial->tx;
+	if (serial->mute && *serial->mute) return true;
+	if (ring_used(tx) == SERIAL_RING) return false;
+	tx->buf[tx->tail ++ % SERIAL_RING] = value;
+	return true;
+}
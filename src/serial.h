@@ -0,0 +1,51 @@
+
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Bytes buffered in each direction, a power of two.
+#define SERIAL_RING 4096
+
+// Bytes waiting to go one way.
+typedef struct serial_ring {
+	uint8_t  buf[SERIAL_RING];
+	uint32_t head;                      // Taken from here.
+	uint32_t tail;                      // Added here.
+} serial_ring_t;
+
+// The host end of a serial port: a pseudo-terminal anyone can open.
+// Only serial_poll touches the terminal, and it never waits for it.
+typedef struct serial {
+	int           master;
+	int           slave;                // Kept open so the master works with nobody connected.
+	char         *name;                 // Path of the terminal to connect to.
+	char         *link;                 // Symlink to name, optional.
+	serial_ring_t rx;                   // From the host to the guest.
+	serial_ring_t tx;                   // From the guest to the host.
+	const bool   *mute;                 // Optional, bytes from the guest are dropped while it's true.
+} serial_t;
+
+// Why the last serial operation failed.
+extern const char *serial_error;
+
+// Creates a pseudo-terminal in raw mode, with a symlink to it at link if not NULL.
+bool serial_open(serial_t *serial, const char *link);
+// Closes the terminal and removes the symlink.
+void serial_close(serial_t *serial);
+// Moves bytes between the terminal and the rings, as far as that goes without waiting.
+void serial_poll(serial_t *serial);
+// Tells what to poll the terminal for, for serial_poll to have something to do.
+short serial_events(serial_t *serial);
+
+// Tells whether there's a byte for the guest.
+bool serial_rx_ready(serial_t *serial);
+// Takes a byte for the guest, returns false if there is none.
+bool serial_rx_get(serial_t *serial, uint8_t *value);
+// Adds a byte from the guest, returns false if the ring is full.
+// Muted bytes are taken and dropped.
+bool serial_tx_put(serial_t *serial, uint8_t value);
+
+#endif //SERIAL_H
@@ -0,0 +1,113 @@
+
+#include "mailbox.h"
+#include <string.h>
+
+static uint8_t mailbox_read(device_t *dev, uint16_t address, bool notouchy) {
+	mailbox_t *box = dev->state;
+	switch (address) {
+		case MBOX_ID:
+			return box->id;
+		case MBOX_CORES:
+			return box->cores;
+		case MBOX_TARGET:
+			return box->target;
+		case MBOX_RECV: {
+			if (!box->in_len) return 0;
+			uint8_t value = box->inbox[box->in_start];
+			if (!notouchy) {
+				box->in_start = (box->in_start + 1) % MBOX_QUEUE;
+				box->in_len --;
+			}
+			return value;
+		}
+		case MBOX_STATUS: {
+			uint8_t status = box->status | (box->in_len ? MBOX_STATUS_RECV : 0);
+			if (!notouchy) box->status &= ~MBOX_STATUS_LOST;
+			return status;
+		}
+		case MBOX_CTRL:
+			return box->ctrl;
+	}
+	return 0;
+}
+
+static void mailbox_write(device_t *dev, uint16_t address, uint8_t value) {
+	mailbox_t *box = dev->state;
+	switch (address) {
+		case MBOX_TARGET:
+			box->target = value;
+			break;
+		case MBOX_SEND:
+			if (box->out_len == MBOX_QUEUE) {
+				box->status |= MBOX_STATUS_LOST;
+			} else {
+				box->outbox[box->out_len ++] = (mbox_msg_t) { box->target, value };
+			}
+			break;
+		case MBOX_CTRL:
+			box->ctrl = value;
+			break;
+	}
+}
+
+static void mailbox_reset(device_t *dev) {
+	mailbox_t *box = dev->state;
+	uint8_t id    = box->id;
+	uint8_t cores = box->cores;
+	memset(box, 0, sizeof(mailbox_t));
+	box->id    = id;
+	box->cores = cores;
+}
+
+// Puts a byte in the inbox of a core, returns false if it's full.
+static bool mailbox_put(device_t *dev, uint8_t value) {
+	mailbox_t *box = dev->state;
+	if (box->in_len == MBOX_QUEUE) {
+		box->status |= MBOX_STATUS_LOST;
+		return false;
+	}
+	box->inbox[(box->in_start + box->in_len ++) % MBOX_QUEUE] = value;
+	return true;
+}
+
+// Initialises the mailbox of a core.
+void mailbox_init(device_t *dev, mailbox_t *box, uint8_t id, uint8_t cores) {
+	memset(dev, 0, sizeof(device_t));
+	memset(box, 0, sizeof(mailbox_t));
+	box->id        = id;
+	box->cores     = cores;
+	dev->name      = "mailbox";
+	dev->base      = MBOX_BASE;
+	dev->len       = MBOX_LEN;
+	dev->read      = mailbox_read;
+	dev->write     = mailbox_write;
+	dev->reset     = mailbox_reset;
+	dev->state     = box;
+	dev->state_len = sizeof(mailbox_t);
+}
+
+// Delivers everything sent since the last barrier, by the lowest numbered core first.
+// No core may be running.
+void mailbox_deliver(device_t **devs, int cores) {
+	bool rang[cores];
+	memset(rang, 0, sizeof(rang));
+	for (int i = 0; i < cores; i++) {
+		mailbox_t *box = devs[i]->state;
+		for (int j = 0; j < box->out_len; j++) {
+			mbox_msg_t msg = box->outbox[j];
+			for (int k = 0; k < cores; k++) {
+				if (msg.target == MBOX_ALL ? k != i : msg.target == k) {
+					rang[k] |= mailbox_put(devs[k], msg.value);
+				}
+			}
+		}
+		box->out_len = 0;
+	}
+	// Ring the doorbells.
+	for (int k = 0; k < cores; k++) {
+		mailbox_t *box = devs[k]->state;
+		if (rang[k] && (box->ctrl & MBOX_CTRL_IRQ)) {
+			device_raise_irq(devs[k]);
+		}
+	}
+}
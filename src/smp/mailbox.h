@@ -0,0 +1,56 @@
+
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../devices.h"
+
+// Registers.
+#define MBOX_BASE   0xFEB0
+#define MBOX_LEN    7
+#define MBOX_ID     0xFEB0 // Number of this core, from 0.
+#define MBOX_CORES  0xFEB1 // Number of cores.
+#define MBOX_TARGET 0xFEB2 // Core to send to, MBOX_ALL for all others.
+#define MBOX_SEND   0xFEB3 // Sends a byte to the target.
+#define MBOX_RECV   0xFEB4 // Takes the next byte received, 0 if there is none.
+#define MBOX_STATUS 0xFEB5
+#define MBOX_CTRL   0xFEB6
+
+#define MBOX_ALL 0xff
+
+// Control bits.
+#define MBOX_CTRL_IRQ 0x01 // Ring the doorbell: raise an IRQ when bytes arrive.
+
+// Status bits.
+#define MBOX_STATUS_RECV 0x01 // There are bytes to take.
+#define MBOX_STATUS_LOST 0x02 // Bytes were lost to a full queue, cleared by reading.
+
+// Bytes queued per core, either way.
+#define MBOX_QUEUE 16
+
+typedef struct mbox_msg {
+	uint8_t target;
+	uint8_t value;
+} mbox_msg_t;
+
+typedef struct mailbox {
+	uint8_t    id;
+	uint8_t    cores;
+	uint8_t    target;
+	uint8_t    ctrl;
+	uint8_t    status;
+	uint8_t    inbox[MBOX_QUEUE];
+	uint8_t    in_start;
+	uint8_t    in_len;
+	mbox_msg_t outbox[MBOX_QUEUE];      // Sent since the last barrier.
+	uint8_t    out_len;
+} mailbox_t;
+
+// Initialises the mailbox of a core.
+void mailbox_init(device_t *dev, mailbox_t *box, uint8_t id, uint8_t cores);
+// Delivers everything sent since the last barrier, by the lowest numbered core first.
+// No core may be running.
+void mailbox_deliver(device_t **devs, int cores);
+
+#endif //MAILBOX_H
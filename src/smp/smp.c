@@ -0,0 +1,233 @@
+#define _GNU_SOURCE
+#include "smp.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+static smp_core_t       *cores;
+static device_t         *mboxes[SMP_MAX_CORES];
+static int               cores_len;
+static uint64_t          quantum = SMP_QUANTUM;
+static uint64_t          max_cycles = SMP_CYCLES;
+static uint16_t          shared_page;
+static uint16_t          shared_pages;
+static pthread_barrier_t barrier;
+static bool              done;
+static uint64_t          quanta;
+
+// Shared memory as of the last barrier, and the pages that changed at it.
+static uint8_t           shared[65536];
+static uint8_t           changed[256];
+
+static uint64_t nanos() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void console_out(machine_t *m, uint8_t value) {
+	smp_core_t *core = m->ctx;
+	if (core->out_len == core->out_cap) {
+		core->out_cap = core->out_cap ? core->out_cap * 2 : 256;
+		core->out     = realloc(core->out, core->out_cap);
+	}
+	core->out[core->out_len ++] = value;
+}
+
+// Writes the whole lines of console output of a core, and the rest too if all is set.
+static void flush_output(smp_core_t *core, int id, bool all) {
+	size_t start = 0;
+	for (size_t i = 0; i < core->out_len; i++) {
+		if (core->out[i] == '\n') {
+			printf("%d: %.*s", id, (int) (i + 1 - start), core->out + start);
+			start = i + 1;
+		}
+	}
+	if (all && start < core->out_len) {
+		printf("%d: %.*s\n", id, (int) (core->out_len - start), core->out + start);
+		start = core->out_len;
+	}
+	memmove(core->out, core->out + start, core->out_len - start);
+	core->out_len -= start;
+}
+
+// Makes shared memory the same for all cores, the highest numbered writer wins.
+static void merge_shared() {
+	for (int page = shared_page; page < shared_page + shared_pages; page++) {
+		uint8_t *base = shared + page * 256;
+		uint8_t before[256];
+		changed[page] = 0;
+		for (int i = 0; i < cores_len; i++) {
+			if (!cores[i].dirty[page]) continue;
+			cores[i].dirty[page] = 0;
+			if (!changed[page]) memcpy(before, base, 256);
+			changed[page] = 1;
+			// Only take the bytes this core changed during the quantum.
+			uint8_t *mine = cores[i].m.ram + page * 256;
+			for (int j = 0; j < 256; j++) {
+				if (mine[j] != before[j]) base[j] = mine[j];
+			}
+		}
+	}
+}
+
+// Starts shared memory as what the cores were loaded with, merged like a quantum's writes.
+static void seed_shared() {
+	for (int page = shared_page; page < shared_page + shared_pages; page++) {
+		for (int i = 0; i < cores_len; i++) cores[i].dirty[page] = 1;
+	}
+	merge_shared();
+	for (int i = 0; i < cores_len; i++) {
+		for (int page = shared_page; page < shared_page + shared_pages; page++) {
+			if (changed[page]) memcpy(cores[i].m.ram + page * 256, shared + page * 256, 256);
+		}
+	}
+}
+
+// Everything done between quanta, by one thread while the others wait.
+static void sync_cores() {
+	merge_shared();
+	mailbox_deliver(mboxes, cores_len);
+	done = true;
+	for (int i = 0; i < cores_len; i++) {
+		flush_output(&cores[i], i, false);
+		done &= cores[i].stopped;
+	}
+	fflush(stdout);
+	quanta ++;
+}
+
+static void *core_thread(void *arg) {
+	smp_core_t *core = arg;
+	gr8cpurev3_t *cpu = &core->m.cpu;
+	while (1) {
+		// Run up to the end of this quantum.
+		uint64_t end = (quanta + 1) * quantum;
+		if (end > max_cycles) end = max_cycles;
+		while (!core->stopped && cpu->numCycles < end) {
+			core->res = gr8cpurev3_tick(cpu, end - cpu->numCycles, TICK_NORMAL << 16);
+			if (core->res != EXC_NORM) core->stopped = true;
+		}
+		if (cpu->numCycles >= max_cycles) core->stopped = true;
+		if (pthread_barrier_wait(&barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+			sync_cores();
+		}
+		pthread_barrier_wait(&barrier);
+		if (done) break;
+		// Take the shared memory the others changed.
+		for (int page = shared_page; page < shared_page + shared_pages; page++) {
+			if (changed[page]) memcpy(core->m.ram + page * 256, shared + page * 256, 256);
+		}
+	}
+	return NULL;
+}
+
+// Parses addr:len, both in hex and whole pages.
+static bool parse_shared(char *str) {
+	char *end;
+	unsigned long base = strtoul(str, &end, 16);
+	if (*end != ':') return false;
+	unsigned long len = strtoul(end + 1, &end, 16);
+	if (*end || base % 256 || len % 256 || base + len > MMIO_PAGE) return false;
+	shared_page  = base / 256;
+	shared_pages = len / 256;
+	return true;
+}
+
+int main(int argc, char **argv) {
+	// Parse the options.
+	shared_page  = SMP_SHARED / 256;
+	shared_pages = SMP_SHARED_LEN / 256;
+	int i;
+	for (i = 1; i < argc; i++) {
+		char *end = "";
+		if (i == argc - 1 || *argv[i] != '-') {
+			break;
+		} else if (!strcmp(argv[i], "-n") || !strcmp(argv[i], "--cores")) {
+			cores_len = strtoul(argv[++ i], &end, 10);
+		} else if (!strcmp(argv[i], "--quantum")) {
+			quantum = strtoull(argv[++ i], &end, 10);
+		} else if (!strcmp(argv[i], "--max-cycles")) {
+			max_cycles = strtoull(argv[++ i], &end, 10);
+		} else if (!strcmp(argv[i], "--shared")) {
+			if (!parse_shared(argv[++ i])) break;
+		} else {
+			break;
+		}
+		if (*end) break;
+	}
+	int roms_len = argc - i;
+	if (!cores_len) cores_len = roms_len;
+	if (roms_len < 1 || *argv[i] == '-' || cores_len < roms_len || cores_len > SMP_MAX_CORES || !quantum || !max_cycles) {
+		printf("%s [options] rom [rom...]\n\n", *argv);
+		printf("    -n count\n");
+		printf("    --cores count\n");
+		printf("                Number of cores, one per ROM by default. Cores without a\n");
+		printf("                ROM of their own run the last one.\n\n");
+		printf("    --quantum cycles\n");
+		printf("                Cycles the cores run between barriers, %d by default.\n\n", SMP_QUANTUM);
+		printf("    --max-cycles count\n");
+		printf("                Cycles each core may run, %d by default.\n\n", SMP_CYCLES);
+		printf("    --shared addr:len\n");
+		printf("                Memory shared by all cores, in hex and whole pages.\n");
+		printf("                %04x:%04x by default.\n\n", SMP_SHARED, SMP_SHARED_LEN);
+		printf("Runs a system of cores, each on its own thread, sharing memory and a mailbox.\n");
+		printf("Console output is prefixed with the core, a summary is written to stderr as JSON.\n");
+		printf("See src/smp/smp.h for how the cores are kept in step.\n");
+		return 2;
+	}
+	// Set up the cores.
+	cores = calloc(cores_len, sizeof(smp_core_t));
+	if (!cores) {
+		fputs("Out of memory\n", stderr);
+		return 2;
+	}
+	for (int c = 0; c < cores_len; c++) {
+		char *path = argv[i + (c < roms_len ? c : roms_len - 1)];
+		smp_core_t *core = &cores[c];
+		if (!program_load(&core->prog, path, EXEC_TYPE_AUTO)) {
+			fprintf(stderr, "Could not load '%s': %s\n", path, program_error);
+			return 2;
+		}
+		machine_init(&core->m, NULL, 0);
+		program_place(&core->prog, &core->m);
+		core->m.console    = console_out;
+		core->m.ctx        = core;
+		core->m.cpu.ramDirty = core->dirty;
+		mailbox_init(&core->mbox_dev, &core->mbox, c, cores_len);
+		devbus_attach(&core->m.bus, &core->mbox_dev);
+		mboxes[c] = &core->mbox_dev;
+	}
+	seed_shared();
+	// Run them all.
+	pthread_barrier_init(&barrier, NULL, cores_len);
+	pthread_t threads[cores_len];
+	uint64_t start = nanos();
+	for (int c = 0; c < cores_len; c++) {
+		pthread_create(&threads[c], NULL, core_thread, &cores[c]);
+	}
+	for (int c = 0; c < cores_len; c++) {
+		pthread_join(threads[c], NULL);
+	}
+	double secs = (nanos() - start) / 1000000000.0;
+	// Summarise.
+	uint64_t total = 0;
+	bool failed = false;
+	for (int c = 0; c < cores_len; c++) {
+		flush_output(&cores[c], c, true);
+		gr8cpurev3_t *cpu = &cores[c].m.cpu;
+		int res = cores[c].res;
+		total  += cpu->numCycles;
+		failed |= res != EXC_NORM && res != EXC_HALT;
+		fprintf(stderr, "{\"core\":%d,\"result\":\"%s\",\"cycles\":%lu,\"insns\":%lu,", c,
+				res == EXC_NORM ? "max_cycles" : exc_desc(res), cpu->numCycles, cpu->numInsns);
+		fprintf(stderr, "\"regs\":{\"pc\":%u,\"a\":%u,\"b\":%u,\"x\":%u,\"y\":%u,\"sp\":%u,\"flags\":%u}}\n",
+				cpu->regPC, cpu->regA, cpu->regB, cpu->regX, cpu->regY, cpu->stackPtr, gr8cpurev3_readflags(cpu));
+	}
+	fprintf(stderr, "{\"cores\":%d,\"quanta\":%lu,\"seconds\":%.6f,\"mhz\":%.3f}\n",
+			cores_len, quanta, secs, secs > 0 ? total / secs / 1000000.0 : 0.0);
+	return failed;
+}
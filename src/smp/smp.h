@@ -0,0 +1,56 @@
+
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "../machine.h"
+#include "../loader.h"
+#include "mailbox.h"
+
+// Most cores in a system.
+#define SMP_MAX_CORES  64
+// Cycles the cores run between barriers, unless set.
+#define SMP_QUANTUM    10000
+// Cycle limit per core, unless set.
+#define SMP_CYCLES     10000000
+// Memory shared by all cores, unless set.
+#define SMP_SHARED     0x8000
+#define SMP_SHARED_LEN 0x4000
+
+/*
+
+Every core is a whole machine with its own thread, RAM and peripherals, and a
+mailbox to reach the others. All cores run a quantum of cycles on their own,
+then meet at a barrier, where:
+	- Shared memory is made the same everywhere again. Each core sees its own
+	  writes to it right away and those of the others at the next barrier. A byte
+	  changed by several cores in one quantum gets the value of the highest
+	  numbered one.
+	- Bytes sent to mailboxes are delivered, those of the lowest numbered core
+	  first, and the doorbell IRQ is raised on cores that asked for it.
+	- Console output is written, a line at a time, prefixed with the core.
+None of this depends on how the threads get scheduled, so a system with the same
+ROMs and quantum always runs the same way. What the ROMs load into shared memory
+is merged the same way before the first quantum, as if written in quantum zero.
+
+A core stops when it halts, fails or reaches the cycle limit. The others carry
+on, and everything stops when all have.
+
+*/
+
+typedef struct smp_core {
+	machine_t  m;
+	program_t  prog;                    // Cores running the same ROM share its pages.
+	device_t   mbox_dev;
+	mailbox_t  mbox;
+	uint8_t    dirty[256];              // Pages written since the last barrier.
+	int        res;                     // Why it stopped, EXC_NORM while it hasn't.
+	bool       stopped;
+	char      *out;                     // Console output since the last line written.
+	size_t     out_len;
+	size_t     out_cap;
+} smp_core_t;
+
+#endif //SMP_H
@@ -0,0 +1,233 @@
+
+#include "snapshot.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void page_release(snap_page_t *page) {
+	if (page && !--page->refs) {
+		free(page);
+	}
+}
+
+static snap_page_t *page_retain(snap_page_t *page) {
+	page->refs ++;
+	return page;
+}
+
+// Copies memory into a new page, NULL if out of memory.
+static snap_page_t *page_copy(const uint8_t *data) {
+	snap_page_t *page = malloc(sizeof(snap_page_t));
+	if (!page) return NULL;
+	page->refs = 1;
+	memcpy(page->data, data, SNAP_PAGE_SIZE);
+	return page;
+}
+
+// Forgets what a bank matched, after it was freed.
+static void bank_forget(snapctx_t *ctx, int bank) {
+	for (int i = 0; i < MMU_BANK_PAGES; i++) {
+		page_release(ctx->bank_base[bank][i]);
+		ctx->bank_base[bank][i] = NULL;
+	}
+}
+
+// Copies the pages of a bank that changed into a snapshot.
+// Returns false if out of memory.
+static bool bank_take(snapctx_t *ctx, snapshot_t *snap, int bank) {
+	uint8_t *ram = ctx->banks->ram[bank];
+	uint8_t *dirty = ctx->banks->dirty[bank];
+	snap_page_t **base = ctx->bank_base[bank];
+	if (!ram) {
+		bank_forget(ctx, bank);
+		return true;
+	}
+	snap->banks[bank] = calloc(MMU_BANK_PAGES, sizeof(snap_page_t *));
+	if (!snap->banks[bank]) return false;
+	for (int i = 0; i < MMU_BANK_PAGES; i++) {
+		if (dirty[i] || !base[i]) {
+			snap_page_t *page = page_copy(ram + i * SNAP_PAGE_SIZE);
+			if (!page) return false;
+			page_release(base[i]);
+			base[i]  = page;
+			dirty[i] = 0;
+		}
+		snap->banks[bank][i] = page_retain(base[i]);
+	}
+	return true;
+}
+
+// Puts a bank back the way a snapshot has it, allocating or freeing it to match.
+static void bank_restore(snapctx_t *ctx, snapshot_t *snap, int bank) {
+	mmu_banks_t *banks = ctx->banks;
+	snap_page_t **pages = snap->banks[bank];
+	snap_page_t **base = ctx->bank_base[bank];
+	if (pages && !banks->ram[bank]) {
+		banks->ram[bank] = malloc(BANK_SIZE);
+		memset(banks->dirty[bank], 1, MMU_BANK_PAGES);
+	}
+	if (!pages || !banks->ram[bank]) {
+		// Not written yet, so it reads as zeroes again.
+		free(banks->ram[bank]);
+		banks->ram[bank] = NULL;
+		bank_forget(ctx, bank);
+		return;
+	}
+	for (int i = 0; i < MMU_BANK_PAGES; i++) {
+		if (banks->dirty[bank][i] || base[i] != pages[i]) {
+			memcpy(banks->ram[bank] + i * SNAP_PAGE_SIZE, pages[i]->data, SNAP_PAGE_SIZE);
+			page_retain(pages[i]);
+			page_release(base[i]);
+			base[i] = pages[i];
+			banks->dirty[bank][i] = 0;
+		}
+	}
+}
+
+// Starts tracking the machine for snapshots.
+void snapctx_init(snapctx_t *ctx, gr8cpurev3_t *cpu, devbus_t *bus) {
+	memset(ctx, 0, sizeof(snapctx_t));
+	ctx->cpu      = cpu;
+	ctx->bus      = bus;
+	ctx->banks    = dev_mmu_banks(bus);
+	cpu->ramDirty = ctx->dirty;
+	snapctx_invalidate(ctx);
+}
+
+// Stops tracking the machine for snapshots.
+void snapctx_destroy(snapctx_t *ctx) {
+	for (int i = 0; i < SNAP_PAGES; i++) {
+		page_release(ctx->base[i]);
+		ctx->base[i] = NULL;
+	}
+	for (int i = 1; ctx->banks && i <= MMU_RAM_BANKS; i++) {
+		bank_forget(ctx, i);
+	}
+	ctx->cpu->ramDirty = NULL;
+}
+
+// Marks all of RAM and the banks as changed, after the host wrote to them.
+void snapctx_invalidate(snapctx_t *ctx) {
+	memset(ctx->dirty, 1, SNAP_PAGES);
+	if (ctx->banks) memset(ctx->banks->dirty, 1, sizeof(ctx->banks->dirty));
+}
+
+// Takes a snapshot of the machine.
+// Only pages changed since the last snapshot are copied.
+// Returns NULL if out of memory.
+snapshot_t *snapshot_take(snapctx_t *ctx) {
+	snapshot_t *snap = calloc(1, sizeof(snapshot_t));
+	if (!snap) return NULL;
+	snap->dev_state_len = devbus_state_len(ctx->bus);
+	snap->dev_state     = malloc(snap->dev_state_len ? snap->dev_state_len : 1);
+	if (!snap->dev_state) {
+		free(snap);
+		return NULL;
+	}
+	// Copy the pages that changed.
+	for (int i = 0; i < SNAP_PAGES; i++) {
+		if (ctx->dirty[i] || !ctx->base[i]) {
+			snap_page_t *page = page_copy(ctx->cpu->ram + i * SNAP_PAGE_SIZE);
+			if (!page) {
+				snapshot_free(snap);
+				return NULL;
+			}
+			page_release(ctx->base[i]);
+			ctx->base[i]  = page;
+			ctx->dirty[i] = 0;
+		}
+		snap->pages[i] = page_retain(ctx->base[i]);
+	}
+	for (int i = 1; ctx->banks && i <= MMU_RAM_BANKS; i++) {
+		if (!bank_take(ctx, snap, i)) {
+			snapshot_free(snap);
+			return NULL;
+		}
+	}
+	// Copy the rest of the machine.
+	snap->cpu = *ctx->cpu;
+	devbus_save(ctx->bus, snap->dev_state);
+	return snap;
+}
+
+// Restores a snapshot of the machine.
+// Only pages that differ from the snapshot are copied.
+void snapshot_restore(snapctx_t *ctx, snapshot_t *snap) {
+	gr8cpurev3_t *cpu = ctx->cpu;
+	for (int i = 0; i < SNAP_PAGES; i++) {
+		if (ctx->dirty[i] || ctx->base[i] != snap->pages[i]) {
+			memcpy(cpu->ram + i * SNAP_PAGE_SIZE, snap->pages[i]->data, SNAP_PAGE_SIZE);
+			page_retain(snap->pages[i]);
+			page_release(ctx->base[i]);
+			ctx->base[i]  = snap->pages[i];
+			ctx->dirty[i] = 0;
+		}
+	}
+	for (int i = 1; ctx->banks && i <= MMU_RAM_BANKS; i++) {
+		bank_restore(ctx, snap, i);
+	}
+	// Restore the CPU, but keep what the host set up.
+	gr8cpurev3_t live = *cpu;
+	*cpu = snap->cpu;
+	cpu->breakpoints    = live.breakpoints;
+	cpu->breakpointsLen = live.breakpointsLen;
+	cpu->isaRom         = live.isaRom;
+	cpu->isaRomLen      = live.isaRomLen;
+	cpu->ram            = live.ram;
+	cpu->rom            = live.rom;
+	cpu->romLen         = live.romLen;
+	cpu->ramDirty       = live.ramDirty;
+	cpu->banked         = live.banked;
+	memcpy(cpu->bankRead, live.bankRead, sizeof(live.bankRead));
+	memcpy(cpu->bankWrite, live.bankWrite, sizeof(live.bankWrite));
+	memcpy(cpu->bankDirty, live.bankDirty, sizeof(live.bankDirty));
+	cpu->coverage       = live.coverage;
+	cpu->mmioCtx        = live.mmioCtx;
+	// Restore the devices, which also reschedules them and points the windows at the banks.
+	devbus_load(ctx->bus, snap->dev_state);
+}
+
+// Frees a snapshot, pages still used elsewhere are kept.
+void snapshot_free(snapshot_t *snap) {
+	if (!snap) return;
+	for (int i = 0; i < SNAP_PAGES; i++) {
+		page_release(snap->pages[i]);
+	}
+	for (int i = 1; i <= MMU_RAM_BANKS; i++) {
+		for (int j = 0; snap->banks[i] && j < MMU_BANK_PAGES; j++) {
+			page_release(snap->banks[i][j]);
+		}
+		free(snap->banks[i]);
+	}
+	free(snap->dev_state);
+	free(snap);
+}
+
+// FNV-1a over some bytes, continuing from hash.
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t len) {
+	const uint8_t *ptr = data;
+	for (size_t i = 0; i < len; i++) {
+		hash = (hash ^ ptr[i]) * 0x100000001b3;
+	}
+	return hash;
+}
+
+// Hashes the registers, flags and RAM of a CPU.
+uint64_t state_hash(gr8cpurev3_t *cpu) {
+	uint8_t regs[] = {
+		cpu->regA, cpu->regB, cpu->regX, cpu->regY, cpu->regIR,
+		cpu->regPC, cpu->regPC >> 8, cpu->regAR, cpu->regAR >> 8,
+		cpu->stackPtr, cpu->stackPtr >> 8, cpu->regIRQ, cpu->regIRQ >> 8,
+		cpu->regNMI, cpu->regNMI >> 8, gr8cpurev3_readflags(cpu)
+	};
+	// FNV-1a, a word at a time for the RAM.
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < sizeof(regs); i++) {
+		hash = (hash ^ regs[i]) * 0x100000001b3;
+	}
+	for (size_t i = 0; i < 65536; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, cpu->ram + i, sizeof(uint64_t));
+		hash = (hash ^ word) * 0x100000001b3;
+	}
+	return hash;
+}
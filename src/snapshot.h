@@ -0,0 +1,61 @@
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "common/GR8EMUr3_2.h"
+#include "devices.h"
+#include "dev_mmu.h"
+
+#define SNAP_PAGE_SIZE 256
+#define SNAP_PAGES     (65536 / SNAP_PAGE_SIZE)
+
+// A page of RAM, shared between all snapshots it didn't change in.
+typedef struct snap_page {
+	size_t  refs;
+	uint8_t data[SNAP_PAGE_SIZE];
+} snap_page_t;
+
+typedef struct snapshot {
+	gr8cpurev3_t  cpu;                  // Registers, flags, busses and statistics.
+	snap_page_t  *pages[SNAP_PAGES];    // RAM.
+	snap_page_t **banks[MMU_RAM_BANKS + 1];     // Pages of the RAM banks, NULL if not written yet.
+	uint8_t      *dev_state;            // Saved with devbus_save.
+	size_t        dev_state_len;
+} snapshot_t;
+
+// Tracks which RAM pages changed since the last snapshot taken or restored.
+typedef struct snapctx {
+	gr8cpurev3_t *cpu;
+	devbus_t     *bus;
+	uint8_t       dirty[SNAP_PAGES];    // Written by the CPU through ramDirty.
+	snap_page_t  *base[SNAP_PAGES];     // Pages that RAM matches if not dirty.
+	mmu_banks_t  *banks;                // The MMU's, if there is one, written through bankDirty.
+	snap_page_t  *bank_base[MMU_RAM_BANKS + 1][MMU_BANK_PAGES];  // Pages that the banks match if not dirty.
+} snapctx_t;
+
+// Starts tracking the machine for snapshots.
+void snapctx_init(snapctx_t *ctx, gr8cpurev3_t *cpu, devbus_t *bus);
+// Stops tracking the machine for snapshots.
+void snapctx_destroy(snapctx_t *ctx);
+// Marks all of RAM and the banks as changed, after the host wrote to them.
+void snapctx_invalidate(snapctx_t *ctx);
+
+// Takes a snapshot of the machine.
+// Only pages changed since the last snapshot are copied.
+// Returns NULL if out of memory.
+snapshot_t *snapshot_take(snapctx_t *ctx);
+// Restores a snapshot of the machine.
+// Only pages that differ from the snapshot are copied.
+void snapshot_restore(snapctx_t *ctx, snapshot_t *snap);
+// Frees a snapshot, pages still used elsewhere are kept.
+void snapshot_free(snapshot_t *snap);
+
+// FNV-1a over some bytes, continuing from hash.
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t len);
+// Hashes the registers, flags and RAM of a CPU.
+uint64_t state_hash(gr8cpurev3_t *cpu);
+
+#endif //SNAPSHOT_H
@@ -0,0 +1,90 @@
+
+#include "spsc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+// Makes a queue of at least cap elements of size bytes.
+bool spsc_init(spsc_t *q, size_t size, size_t cap) {
+	memset(q, 0, sizeof(spsc_t));
+	q->size = size;
+	q->cap  = 1;
+	while (q->cap < cap) q->cap <<= 1;
+	q->buf = malloc(q->size * q->cap);
+	q->fd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (!q->buf || q->fd < 0) {
+		spsc_free(q);
+		return false;
+	}
+	return true;
+}
+
+// Frees a queue, neither side may use it any more.
+void spsc_free(spsc_t *q) {
+	free(q->buf);
+	q->buf = NULL;
+	if (q->fd >= 0) close(q->fd);
+	q->fd = -1;
+}
+
+// Copies elements between the ring and a flat array, wrapping at the end of the ring.
+static void spsc_copy(spsc_t *q, size_t index, void *elems, size_t n, bool in) {
+	size_t at    = index & (q->cap - 1);
+	size_t first = n < q->cap - at ? n : q->cap - at;
+	uint8_t *ring = q->buf;
+	uint8_t *flat = elems;
+	if (in) {
+		memcpy(ring + at * q->size, flat, first * q->size);
+		memcpy(ring, flat + first * q->size, (n - first) * q->size);
+	} else {
+		memcpy(flat, ring + at * q->size, first * q->size);
+		memcpy(flat + first * q->size, ring, (n - first) * q->size);
+	}
+}
+
+// Pushes up to n elements, from the producer.
+// Returns how many fit.
+size_t spsc_push(spsc_t *q, const void *elems, size_t n) {
+	size_t head = q->head;
+	// The consumer must be done reading an element before it's overwritten.
+	size_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	size_t room = q->cap - (head - tail);
+	if (n > room) n = room;
+	if (!n) return 0;
+	spsc_copy(q, head, (void *) elems, n, true);
+	__atomic_store_n(&q->head, head + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+// Pops up to n elements, from the consumer.
+// Returns how many there were.
+size_t spsc_pop(spsc_t *q, void *elems, size_t n) {
+	size_t tail = q->tail;
+	size_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	if (n > head - tail) n = head - tail;
+	if (!n) return 0;
+	spsc_copy(q, tail, elems, n, false);
+	__atomic_store_n(&q->tail, tail + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+// Counts the elements pushed but not popped yet, from either side.
+// It may already be less for the producer, or more for the consumer.
+size_t spsc_used(spsc_t *q) {
+	size_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	size_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	return head - tail;
+}
+
+// Wakes the consumer if it's waiting on fd, from the producer.
+void spsc_notify(spsc_t *q) {
+	uint64_t one = 1;
+	write(q->fd, &one, sizeof(one));
+}
+
+// Makes fd not readable until the next notify, from the consumer.
+void spsc_clear(spsc_t *q) {
+	uint64_t count;
+	read(q->fd, &count, sizeof(count));
+}
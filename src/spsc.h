@@ -0,0 +1,49 @@
+
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+
+A queue between exactly one thread pushing and one thread popping, without
+locks: each side only writes its own index and reads the other's. Elements are
+a fixed number of bytes, copied in and out. Pushing never blocks; it pushes
+what fits and says how much that was.
+
+A consumer that has nothing to do can sleep in poll() on fd, which the producer
+makes readable with spsc_notify after pushing. The consumer clears it with
+spsc_clear before popping, so a notify is never lost in between.
+
+*/
+
+typedef struct spsc {
+	uint8_t *buf;
+	size_t   size;                                  // Bytes per element.
+	size_t   cap;                                   // Elements, a power of two.
+	int      fd;                                    // An eventfd, readable after spsc_notify.
+	size_t   head __attribute__((aligned(64)));     // Elements pushed, only written by the producer.
+	size_t   tail __attribute__((aligned(64)));     // Elements popped, only written by the consumer.
+} spsc_t;
+
+// Makes a queue of at least cap elements of size bytes.
+bool spsc_init(spsc_t *q, size_t size, size_t cap);
+// Frees a queue, neither side may use it any more.
+void spsc_free(spsc_t *q);
+// Pushes up to n elements, from the producer.
+// Returns how many fit.
+size_t spsc_push(spsc_t *q, const void *elems, size_t n);
+// Pops up to n elements, from the consumer.
+// Returns how many there were.
+size_t spsc_pop(spsc_t *q, void *elems, size_t n);
+// Counts the elements pushed but not popped yet, from either side.
+// It may already be less for the producer, or more for the consumer.
+size_t spsc_used(spsc_t *q);
+// Wakes the consumer if it's waiting on fd, from the producer.
+void spsc_notify(spsc_t *q);
+// Makes fd not readable until the next notify, from the consumer.
+void spsc_clear(spsc_t *q);
+
+#endif //SPSC_H
@@ -0,0 +1,73 @@
+
+#include "tty_input.h"
+#include "tty_utils.h"
+
+// Finds the key a finished sequence stands for, or 0 for none.
+static int tty_input_key(uint8_t final) {
+	switch (final) {
+		case 'A': return KEY_UP;
+		case 'B': return KEY_DOWN;
+		case 'C': return KEY_RIGHT;
+		case 'D': return KEY_LEFT;
+	}
+	return 0;
+}
+
+// Feeds a byte from the terminal, storing the keys it finishes in keys.
+// Returns how many there are, at most TTY_INPUT_MAX.
+size_t tty_input_feed(tty_input_t *in, uint8_t c, uint64_t now, int *keys) {
+	if (!in->len) {
+		if (c != ESC) {
+			keys[0] = c;
+			return 1;
+		}
+		in->seq[0] = ESC;
+		in->len    = 1;
+		in->since  = now;
+		return 0;
+	}
+	if (in->len == 1) {
+		if (c == '[' || c == 'O') {
+			in->seq[in->len ++] = c;
+			return 0;
+		}
+		// Not a sequence after all, so that was the escape key.
+		in->len = 0;
+		keys[0] = ESC;
+		return 1 + tty_input_feed(in, c, now, keys + 1);
+	}
+	if (in->seq[1] == 'O' || (c >= 0x40 && c <= 0x7e)) {
+		// Finished.
+		in->len = 0;
+		int key = tty_input_key(c);
+		if (!key) return 0;
+		keys[0] = key;
+		return 1;
+	}
+	if (c >= 0x20 && c <= 0x3f && in->len < TTY_INPUT_SEQ_LEN) {
+		// Parameters and intermediates.
+		in->seq[in->len ++] = c;
+		return 0;
+	}
+	// Broken off or too long, the rest of it is dropped.
+	in->len = 0;
+	return c < 0x20 ? tty_input_feed(in, c, now, keys) : 0;
+}
+
+// Gives up waiting for the rest of a sequence if it's been too long, storing the keys in keys.
+// Returns how many there are, at most TTY_INPUT_MAX.
+size_t tty_input_expire(tty_input_t *in, uint64_t now, int *keys) {
+	if (!in->len || now < in->since + TTY_INPUT_ESC_MS) return 0;
+	size_t n = 0;
+	if (in->len <= 2) {
+		// Escape on its own, maybe with the [ or O typed after it.
+		for (size_t i = 0; i < in->len; i++) keys[n ++] = in->seq[i];
+	}
+	in->len = 0;
+	return n;
+}
+
+// When tty_input_expire must be called, in milliseconds, or UINT64_MAX if it needn't be.
+uint64_t tty_input_deadline(tty_input_t *in) {
+	return in->len ? in->since + TTY_INPUT_ESC_MS : UINT64_MAX;
+}
@@ -0,0 +1,47 @@
+
+#ifndef TTY_INPUT_H
+#define TTY_INPUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Keys that aren't characters.
+#define KEY_UP    0x100
+#define KEY_DOWN  0x101
+#define KEY_RIGHT 0x102
+#define KEY_LEFT  0x103
+
+// Milliseconds an escape waits for the rest of a sequence.
+#define TTY_INPUT_ESC_MS 30
+// Longest escape sequence, longer ones are dropped.
+#define TTY_INPUT_SEQ_LEN 16
+// Most keys one byte can finish.
+#define TTY_INPUT_MAX 2
+
+/*
+
+Bytes from the terminal are fed as they arrive, without ever waiting for the
+next one. Escape sequences (ESC [ params final, and ESC O final) are held until
+they're complete; arrows become KEY_*, and the rest, like replies to cursor
+position queries, are dropped. An escape that isn't followed by anything within
+TTY_INPUT_ESC_MS is the escape key itself, so tty_input_expire must be called
+by tty_input_deadline.
+
+*/
+
+typedef struct tty_input {
+	uint8_t  seq[TTY_INPUT_SEQ_LEN];
+	size_t   len;                       // Bytes of an unfinished sequence.
+	uint64_t since;                     // When it started, in milliseconds.
+} tty_input_t;
+
+// Feeds a byte from the terminal, storing the keys it finishes in keys.
+// Returns how many there are, at most TTY_INPUT_MAX.
+size_t tty_input_feed(tty_input_t *in, uint8_t c, uint64_t now, int *keys);
+// Gives up waiting for the rest of a sequence if it's been too long, storing the keys in keys.
+// Returns how many there are, at most TTY_INPUT_MAX.
+size_t tty_input_expire(tty_input_t *in, uint64_t now, int *keys);
+// When tty_input_expire must be called, in milliseconds, or UINT64_MAX if it needn't be.
+uint64_t tty_input_deadline(tty_input_t *in);
+
+#endif //TTY_INPUT_H
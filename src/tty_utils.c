@@ -6,38 +6,55 @@
 #include <stdio.h>
 #include <string.h>
 #include <malloc.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
 
 int group_map_keyb[GROUP_LEN_KEYB] = {
 	MAP_UNKEYB
 };
 int group_map_run[GROUP_LEN_RUN] = {
 	MAP_KEYB, MAP_PAUSE,
+	MAP_SAVEST, MAP_LOADST,
+	MAP_IRQ, MAP_NMI,
 	MAP_RESET, MAP_SHOW
 };
 int group_map_stop[GROUP_LEN_STOP] = {
 	MAP_KEYB, MAP_UNPAUSE,
 	MAP_CSTEP, MAP_ISTEP, MAP_MSTEP, MAP_XSTEP,
+	MAP_CBACK, MAP_IBACK, MAP_RCONT, MAP_GOTO,
+	MAP_SAVEST, MAP_LOADST,
 	MAP_RESET, MAP_SHOW
 };
 int group_map_show[GROUP_LEN_SHOW] = {
 	MAP_BACK, MAP_SHOW_STAT, MAP_SHOW_PC, MAP_SHOW_REGS, MAP_SHOW_SREGS
 };
+int group_map_goto[GROUP_LEN_GOTO] = {
+	MAP_BACK, MAP_GOTO_OK
+};
 
 char *group_desc_keyb[GROUP_LEN_KEYB] = {
 	DESC_UNKEYB
 };
 char *group_desc_run[GROUP_LEN_RUN] = {
 	DESC_KEYB, DESC_PAUSE,
+	DESC_SAVEST, DESC_LOADST,
+	DESC_IRQ, DESC_NMI,
 	DESC_RESET, DESC_SHOW
 };
 char *group_desc_stop[GROUP_LEN_STOP] = {
 	DESC_KEYB, DESC_UNPAUSE,
 	DESC_CSTEP, DESC_ISTEP, DESC_MSTEP, DESC_XSTEP,
+	DESC_CBACK, DESC_IBACK, DESC_RCONT, DESC_GOTO,
+	DESC_SAVEST, DESC_LOADST,
 	DESC_RESET, DESC_SHOW
 };
 char *group_desc_show[GROUP_LEN_SHOW] = {
 	DESC_BACK, DESC_SHOW_STAT, DESC_SHOW_PC, DESC_SHOW_REGS, DESC_SHOW_SREGS
 };
+char *group_desc_goto[GROUP_LEN_GOTO] = {
+	DESC_BACK, DESC_GOTO_OK
+};
 
 ctrl_group_t group_keyb = {
 	.len = GROUP_LEN_KEYB,
@@ -59,11 +76,17 @@ ctrl_group_t group_show = {
 	.map = group_map_show,
 	.desc = group_desc_show
 };
+ctrl_group_t group_goto = {
+	.len = GROUP_LEN_GOTO,
+	.map = group_map_goto,
+	.desc = group_desc_goto
+};
 ctrl_group_t *groups[GROUPS_LEN] = {
 	&group_keyb,
 	&group_run,
 	&group_stop,
-	&group_show
+	&group_show,
+	&group_goto
 };
 
 bool showing[4] = { 0, 1, 1, 0 };
@@ -79,9 +102,8 @@ static void printkeyb() {
 	if (!tty_getsize(&screen_width, NULL)) {
 		screen_width = 60;
 	}
-	// Create a copy of the keyboard buffer.
-	char copy_buf[KEYB_BUF_LEN + 1];
-	keybbuf_copy(copy_buf, KEYB_BUF_LEN);
+	// The copy of the keyboard buffer the emulation thread sent.
+	char *copy_buf = core_status.keyb;
 	// This is how wide in visible character the string is.
 	size_t buf_width = 0;
 	// Convert it to a formatted string.
@@ -144,8 +166,23 @@ static void printkeyb() {
 	free(buf);
 }
 
+// Print the regions measured by the guest, average cycles per run, as many as fit.
+static void printregions(int room) {
+	for (size_t i = 0; i < core_status.regions; i++) {
+		status_region_t *region = &core_status.region[i];
+		char buf[64];
+		sprintf(buf, " [R%d " ANSI_BOLD "%lu" ANSI_RESET "x " ANSI_BOLD "%lu" ANSI_RESET " cyc]",
+				region->id, region->count, region->cycles / region->count);
+		int len = visiblelen(buf);
+		if (len > room) break;
+		fputs(buf, stdout);
+		room -= len;
+	}
+}
+
 // Redraws the things to show, keyboard and control mappings.
 void redraw() {
+	gr8cpurev3_t *cpu = &core_status.cpu;
 	int width, height;
 	if (tty_getsize(&width, &height)) {
 		// Set TTY cursor position.
@@ -171,7 +208,12 @@ void redraw() {
 		strcat(buf, "[");
 	}
 	if (showing[SHOW_INDEX_PC]) {
-		sprintf(buf + 1, "PC:" ANSI_BOLD "%04x" ANSI_RESET, cpu.regPC);
+		sprintf(buf + 1, "PC:" ANSI_BOLD "%04x" ANSI_RESET, cpu->regPC);
+		// Where that is in the source, if it was assembled.
+		char label[ASM_NAME_LEN + 8];
+		if (asm_symbolize(&program.symbols, cpu->regPC, label, sizeof(label))) {
+			sprintf(buf + strlen(buf), " (%s)", label);
+		}
 		if (showing[SHOW_INDEX_REGS] || showing[SHOW_INDEX_SREGS]) {
 			strcat(buf, " ");
 		}
@@ -180,7 +222,7 @@ void redraw() {
 		sprintf(buf + strlen(buf), "A:" ANSI_BOLD "%02x" ANSI_RESET " B:" ANSI_BOLD "%02x"
 				ANSI_RESET " X:" ANSI_BOLD "%02x" ANSI_RESET " Y:" ANSI_BOLD "%02x"
 				ANSI_RESET " ST:" ANSI_BOLD "%04x" ANSI_RESET,
-				cpu.regA, cpu.regB, cpu.regX, cpu.regY, cpu.stackPtr
+				cpu->regA, cpu->regB, cpu->regX, cpu->regY, cpu->stackPtr
 		);
 		if (showing[SHOW_INDEX_SREGS]) {
 			strcat(buf, " ");
@@ -190,7 +232,7 @@ void redraw() {
 		sprintf(buf + strlen(buf), "IR:" ANSI_BOLD "%02x" ANSI_RESET " AR:" ANSI_BOLD "%04x"
 				ANSI_RESET " NMI:" ANSI_BOLD "%04x" ANSI_RESET " IRQ:" ANSI_BOLD "%04x"
 				ANSI_RESET " F:%02x" ANSI_RESET " CU:" ANSI_BOLD "%1x/%1x" ANSI_RESET,
-				cpu.regIR, cpu.regAR, cpu.regNMI, cpu.regIRQ, gr8cpurev3_readflags(&cpu), cpu.mode, cpu.stage
+				cpu->regIR, cpu->regAR, cpu->regNMI, cpu->regIRQ, gr8cpurev3_readflags(cpu), cpu->mode, cpu->stage
 		);
 	}
 	if (showing[SHOW_INDEX_PC] || showing[SHOW_INDEX_REGS] || showing[SHOW_INDEX_SREGS]) {
@@ -203,8 +245,9 @@ void redraw() {
 		if (width >= 80)
 		printf(" [MMIO R:" ANSI_BOLD "%9lu" ANSI_RESET "   MMIO W:" ANSI_BOLD "%9lu" ANSI_RESET
 				"   CYC:" ANSI_BOLD "%9lu" ANSI_RESET "   INS:" ANSI_BOLD "%9lu" ANSI_RESET "   JSR:" ANSI_BOLD "%9lu" ANSI_RESET "]",
-				stats_mmio_r, stats_mmio_w, cpu.numCycles, cpu.numInsns, cpu.numSubs
+				core_status.reads, core_status.writes, cpu->numCycles, cpu->numInsns, cpu->numSubs
 		);
+		printregions(width >= 80 ? width - 87 : width - 1);
 	}
 	putc('\n', stdout);
 	// Draw the groups.
@@ -217,6 +260,12 @@ void redraw() {
 	}
 }
 
+// Where to start in the padding after a control, so it can't overflow.
+static int ctrlpad(int spacing, char *desc, int no) {
+	int used = strlen(desc) + no;
+	return used < spacing ? used : spacing - 1;
+}
+
 // Describe a group of controls.
 void ctrldesc(ctrl_group_t *group) {
 	// Get size.
@@ -238,7 +287,7 @@ void ctrldesc(ctrl_group_t *group) {
 		fputs(ANSI_RESET " ", stdout);
 		fputs(desc, stdout);
 		// Add some spaces.
-		fputs(buf + strlen(desc) + no, stdout);
+		fputs(buf + ctrlpad(spacing, desc, no), stdout);
 	}
 	// Next line.
 	fputs("\n" ANSI_CLRLN " ", stdout);
@@ -251,7 +300,7 @@ void ctrldesc(ctrl_group_t *group) {
 		fputs(ANSI_RESET " ", stdout);
 		fputs(desc, stdout);
 		// Add some spaces.
-		fputs(buf + strlen(desc) + no, stdout);
+		fputs(buf + ctrlpad(spacing, desc, no), stdout);
 	}
 }
 
@@ -308,6 +357,16 @@ bool tty_getsize(int *x, int *y) {
 		if (y) *y = last_y;
 		return true;
 	}
+	// The terminal knows, without a round trip.
+	struct winsize size;
+	if (!ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) && size.ws_col && size.ws_row) {
+		last_refresh = time(NULL);
+		last_x = size.ws_col;
+		last_y = size.ws_row;
+		if (x) *x = last_x;
+		if (y) *y = last_y;
+		return true;
+	}
 	// This to restore the position of the cursor.
 	int x0, y0;
 	if (tty_getpos(&x0, &y0)) {
@@ -339,10 +398,14 @@ bool tty_getpos(int *x0, int *y0) {
 	if (!has_failed) {
 		// Send the cursor very far away and ask for it's position.
 		fputs("\033[6n", stdout);
+		fflush(stdout);
 		// Wait for a response for at absolute most two seconds.
 		time_t start = time(NULL);
 		long pos = ftell(stdin);
 		while (time(NULL) < start + 2) {
+			// Don't wait for a reply that doesn't come.
+			struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+			if (poll(&pfd, 1, (start + 2 - time(NULL)) * 1000) <= 0) break;
 			char c = fgetc(stdin);
 			if (c == 0x1B) {
 				// We might have found it.
@@ -359,6 +422,7 @@ bool tty_getpos(int *x0, int *y0) {
 		}
 		// Reset the position on fail.
 		// fseek(stdin, pos, SEEK_SET);
+		has_failed = true;
 	}
 	// We didn't find it.
 	return false;
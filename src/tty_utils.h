@@ -10,6 +10,7 @@
 #define ANSI_DIM      "\033[2m"
 #define ANSI_INV      "\033[7m"
 #define ANSI_CLRLN    "\033[0J"
+#define ANSI_CLREOL   "\033[K"
 
 // Common groups of escape codes
 #define ANSI_BOLD_INV "\033[1;7m"
@@ -83,25 +84,29 @@ typedef struct ctrl_group {
 } ctrl_group_t;
 
 #define GROUP_LEN_KEYB 1
-#define GROUP_LEN_RUN  4
-#define GROUP_LEN_STOP 8
+#define GROUP_LEN_RUN  8
+#define GROUP_LEN_STOP 14
 #define GROUP_LEN_SHOW 5
-#define GROUPS_LEN 4
+#define GROUP_LEN_GOTO 2
+#define GROUPS_LEN 5
 
 extern int group_map_keyb[GROUP_LEN_KEYB];
 extern int group_map_run[GROUP_LEN_RUN];
 extern int group_map_stop[GROUP_LEN_STOP];
 extern int group_map_show[GROUP_LEN_SHOW];
+extern int group_map_goto[GROUP_LEN_GOTO];
 
 extern char *group_desc_keyb[GROUP_LEN_KEYB];
 extern char *group_desc_run[GROUP_LEN_RUN];
 extern char *group_desc_stop[GROUP_LEN_STOP];
 extern char *group_desc_show[GROUP_LEN_SHOW];
+extern char *group_desc_goto[GROUP_LEN_GOTO];
 
 extern ctrl_group_t group_keyb;
 extern ctrl_group_t group_run;
 extern ctrl_group_t group_stop;
 extern ctrl_group_t group_show;
+extern ctrl_group_t group_goto;
 extern ctrl_group_t *groups[GROUPS_LEN];
 
 // State in relation to control groups.
@@ -111,6 +116,7 @@ extern int state;
 #define STATE_RUN  1
 #define STATE_STOP 2
 #define STATE_SHOW 3
+#define STATE_GOTO 4
 
 // Stuff to show.
 #define SHOW_INDEX_STAT  0
@@ -129,14 +135,21 @@ extern bool showing[4];
 #define MAP_ISTEP       '2'
 #define MAP_MSTEP       '3'
 #define MAP_XSTEP       '4'
+#define MAP_CBACK       '5'
+#define MAP_IBACK       '6'
+#define MAP_RCONT       '7'
+#define MAP_GOTO        '8'
 #define MAP_RESET   CTRL_R
 #define MAP_SAVEST  CTRL_S
 #define MAP_LOADST  CTRL_O
 #define MAP_SHOW    CTRL_V
+#define MAP_IRQ     CTRL_T
+#define MAP_NMI     CTRL_N
 #define MAP_SHOW_STAT   '1'
 #define MAP_SHOW_PC     '2'
 #define MAP_SHOW_REGS   '3'
 #define MAP_SHOW_SREGS  '4'
+#define MAP_GOTO_OK '\r'
 
 // Control descriptions
 #define DESC_UNKEYB     "Exit keyboard"
@@ -148,14 +161,21 @@ extern bool showing[4];
 #define DESC_ISTEP      "Step in"
 #define DESC_MSTEP      "Step over"
 #define DESC_XSTEP      "Step out"
+#define DESC_CBACK      "Back cycle"
+#define DESC_IBACK      "Step back"
+#define DESC_RCONT      "Rev. cont."
+#define DESC_GOTO       "Go to cyc."
 #define DESC_RESET      "Reset"
 #define DESC_SAVEST     "Save state"
 #define DESC_LOADST     "Load state"
 #define DESC_SHOW       "Show..."
+#define DESC_IRQ        "Debug IRQ"
+#define DESC_NMI        "Debug NMI"
 #define DESC_SHOW_STAT  "Show statistics"
 #define DESC_SHOW_PC    "Show PC"
 #define DESC_SHOW_REGS  "Show regs"
 #define DESC_SHOW_SREGS "Show sregs"
+#define DESC_GOTO_OK    "Go"
 
 // Redraws the things to show, keyboard and control mappings.
 void redraw();
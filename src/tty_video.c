@@ -0,0 +1,131 @@
+
+#include "tty_video.h"
+#include "tty_utils.h"
+#include "utf_utils.h"
+#include "ibm437.h"
+#include <stdio.h>
+#include <string.h>
+
+// What the terminal shows right now.
+static uint8_t  shown[VIDEO_MAX_LEN];
+static uint8_t  shown_ctrl;
+static uint8_t  shown_page;
+static bool     everything;
+// Where the cursor is after the last cell, to skip moving it for the next one.
+static int      cursor_x;
+static int      cursor_y;
+
+static char *half_blocks[4] = { " ", "▀", "▄", "█" };
+
+// Moves the cursor to a cell of the framebuffer, unless it's already there.
+static void move_to(int x, int y) {
+	if (x != cursor_x || y != cursor_y) {
+		tty_setpos(x + 1, y + 1);
+	}
+	cursor_x = x + 1;
+	cursor_y = y;
+}
+
+// Reads the framebuffer, which may be cut short by the end of RAM.
+static uint8_t fb_read(const video_view_t *view, uint16_t offset) {
+	return offset < view->len ? view->bytes[offset] : 0;
+}
+
+// Whether a byte of the framebuffer isn't what the terminal shows.
+static bool fb_changed(const video_view_t *view, uint16_t offset) {
+	return everything || fb_read(view, offset) != shown[offset];
+}
+
+// Draws a character of the framebuffer.
+static void draw_char(const video_view_t *view, uint16_t offset) {
+	uint8_t value = fb_read(view, offset);
+	shown[offset] = value;
+	move_to(offset % VIDEO_TEXT_COLS, offset / VIDEO_TEXT_COLS);
+	if (value & 0x80) {
+		char buf[6] = {0};
+		utf_cat(buf, ibm437_table[value & 0x7f]);
+		fputs(buf, stdout);
+	} else {
+		fputc(value < ' ' || value == 0x7f ? ' ' : value, stdout);
+	}
+}
+
+// Draws the 8 cells a byte of the bitmap is in, along with the byte under or above it.
+static void draw_pixels(const video_view_t *view, uint16_t offset) {
+	int bytes_per_row = VIDEO_BITMAP_W / 8;
+	int row = offset / bytes_per_row & ~1;
+	int col = offset % bytes_per_row;
+	uint8_t top    = fb_read(view, row * bytes_per_row + col);
+	uint8_t bottom = fb_read(view, (row + 1) * bytes_per_row + col);
+	shown[row * bytes_per_row + col]       = top;
+	shown[(row + 1) * bytes_per_row + col] = bottom;
+	move_to(col * 8, row / 2);
+	for (int bit = 7; bit >= 0; bit--) {
+		fputs(half_blocks[(top >> bit & 1) | (bottom >> bit & 1) << 1], stdout);
+	}
+	cursor_x += 7;
+}
+
+// Copies the framebuffer of a machine.
+void video_capture(machine_t *m, video_view_t *view) {
+	uint16_t base;
+	view->ctrl = m->video.ctrl;
+	view->page = m->video.page;
+	dev_video_window(&m->video, &base, &view->len);
+	memcpy(view->bytes, m->cpu.ram + base, view->len);
+}
+
+// Repaints what changed since the last frame.
+void video_frame(const video_view_t *view) {
+	if (view->ctrl != shown_ctrl || view->page != shown_page) {
+		// Moved, turned on or off, or changed modes.
+		if (!(view->ctrl & VIDEO_CTRL_ON)) {
+			video_close();
+		} else if (!(shown_ctrl & VIDEO_CTRL_ON)) {
+			// Keep the console from scrolling the framebuffer away.
+			printf("\0337\033[%dr\0338", VIDEO_ROWS + 1);
+		}
+		shown_ctrl = view->ctrl;
+		shown_page = view->page;
+		everything = true;
+	}
+	if (!view->len || (!everything && !memcmp(view->bytes, shown, view->len))) return;
+	bool bitmap = view->ctrl & VIDEO_CTRL_BITMAP;
+	// Draw the cells, the terminal's cursor stays where it was.
+	fputs("\0337", stdout);
+	cursor_x = cursor_y = -1;
+	if (everything) {
+		for (int y = 0; y < VIDEO_ROWS; y++) {
+			if (bitmap) {
+				for (int x = 0; x < VIDEO_BITMAP_W / 8; x++) draw_pixels(view, y * VIDEO_BITMAP_W / 4 + x);
+			} else {
+				for (int x = 0; x < VIDEO_TEXT_COLS; x++) draw_char(view, y * VIDEO_TEXT_COLS + x);
+			}
+			fputs(ANSI_CLREOL, stdout);
+			cursor_x = -1;
+		}
+	} else {
+		for (uint16_t offset = 0; offset < view->len; offset++) {
+			if (!fb_changed(view, offset)) continue;
+			if (bitmap) {
+				draw_pixels(view, offset);
+			} else {
+				draw_char(view, offset);
+			}
+		}
+	}
+	fputs("\0338", stdout);
+	fflush(stdout);
+	everything = false;
+}
+
+// Gives the terminal lines back to the console.
+void video_close() {
+	if (!(shown_ctrl & VIDEO_CTRL_ON)) return;
+	fputs("\0337\033[r", stdout);
+	for (int y = 1; y <= VIDEO_ROWS; y++) {
+		printf("\033[%d;1H\033[2K", y);
+	}
+	fputs("\0338", stdout);
+	shown_ctrl = 0;
+}
@@ -0,0 +1,38 @@
+
+#ifndef TTY_VIDEO_H
+#define TTY_VIDEO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "machine.h"
+
+// Milliseconds between frames.
+#define VIDEO_FRAME_MS 40
+
+/*
+
+The framebuffer takes the top VIDEO_ROWS lines of the terminal while it is on,
+and the console scrolls in the lines below it. The emulation thread captures it
+into a view, which is painted on the terminal by the thread drawing everything
+else. A frame only repaints the bytes that differ from what the terminal shows,
+so an unchanged screen costs next to nothing and a changed one costs as much as
+the change.
+
+*/
+
+// A copy of the framebuffer and how to show it.
+typedef struct video_view {
+	uint8_t  ctrl;
+	uint8_t  page;
+	uint16_t len;                           // Bytes in use, 0 while it's off.
+	uint8_t  bytes[VIDEO_MAX_LEN];
+} video_view_t;
+
+// Copies the framebuffer of a machine.
+void video_capture(machine_t *m, video_view_t *view);
+// Repaints what changed since the last frame.
+void video_frame(const video_view_t *view);
+// Gives the terminal lines back to the console.
+void video_close();
+
+#endif //TTY_VIDEO_H